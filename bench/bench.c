@@ -0,0 +1,518 @@
+// runs lsc over a tree made by gentree with a matrix of options and writes a JSON report
+//
+// usage: bench [-l lsc] [-r runs] [-x "extra options"] [-o report.json] [-S] TREE
+//
+// every case (a directory of the tree and a set of options) is run -r times (default 5) with stdout read
+// through a pipe, like a pager would; for each case the report has the fastest and median wall time, the
+// user / system time and peak RSS of the child (from wait4), the bytes written and the output throughput
+// one more run of each case is traced with ptrace to count the system calls lsc makes, by name for the
+// ones that matter to a listing (-S skips it, tracing needs ptrace to be permitted)
+// -x adds options to every run (e.g. "--threads=4 --io-uring"), so two configurations can be compared
+// from their reports
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <spawn.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+
+// most arguments a run of lsc gets: its own, the case's options and path, and those given with -x
+#define MAX_ARGUMENTS 64
+
+// system call numbers counted, anything above is only part of the total
+#define MAX_SYSCALL 1024
+
+#define READ_BUFFER_SIZE (256 * 1024)
+
+// a directory of the tree, listed with the recursive or the flat options below
+typedef struct bench_target_t {
+    const char* path;
+    bool recursive;
+} bench_target_t;
+
+// one system call reported by name
+typedef struct syscall_name_t {
+    const char* name;
+    long number;
+} syscall_name_t;
+
+// what was measured for one case
+typedef struct bench_result_t {
+    const char* path;
+    const char* options;
+    int status;            // exit status of the last run, -1 if it was killed
+    double wall_min_ms;
+    double wall_median_ms;
+    double user_ms;        // of the median run
+    double sys_ms;
+    long max_rss_kb;       // highest of all runs
+    uint64_t output_bytes;
+    double throughput_mb_s; // output bytes over the median wall time
+    bool traced;
+    uint64_t syscalls_total;
+    uint64_t syscalls[MAX_SYSCALL];
+} bench_result_t;
+
+static const bench_target_t targets[] = {
+    { "flat", false },
+    { "links", false },
+    { "quoting", false },
+    { "owners", false },
+    { "wide", true },
+    { "deep", true },
+    { ".", true },
+};
+
+// the same number of each, case j of a target uses the j-th of either
+static const char* flat_options[] = { "", "-a", "-i", "-l", "-lh", "-li", "-lai" };
+static const char* recursive_options[] = { "-R", "-aR", "-iR", "-lR", "-lhR", "-liR", "-lihaR" };
+
+static const syscall_name_t syscall_names[] = {
+    { "getdents64", SYS_getdents64 },
+    { "statx", SYS_statx },
+#ifdef SYS_newfstatat
+    { "newfstatat", SYS_newfstatat },
+#endif
+#ifdef SYS_lstat
+    { "lstat", SYS_lstat },
+#endif
+#ifdef SYS_readlink
+    { "readlink", SYS_readlink },
+#endif
+    { "readlinkat", SYS_readlinkat },
+    { "openat", SYS_openat },
+    { "close", SYS_close },
+    { "write", SYS_write },
+    { "writev", SYS_writev },
+#ifdef SYS_io_uring_enter
+    { "io_uring_enter", SYS_io_uring_enter },
+#endif
+    { "mmap", SYS_mmap },
+    { "munmap", SYS_munmap },
+    { "brk", SYS_brk },
+    { "futex", SYS_futex },
+};
+
+extern char** environ;
+
+static void runCase(bench_result_t* result, char** argv, int runs, bool trace);
+static void timeRun(char** argv, double* wall_ms, struct rusage* usage, uint64_t* bytes, int* status);
+static bool traceRun(char** argv, bench_result_t* result);
+static int buildArguments(char** argv, char* lsc, const char* options, char* extra, const char* path);
+static void writeReport(FILE* out, char* lsc, char* tree, char* extra, int runs, bench_result_t* results, size_t count);
+static void writeString(FILE* out, const char* str);
+static double milliseconds(struct timeval time);
+static int compareDoubles(const void* a, const void* b);
+
+int main(int argc, char** argv) {
+    char* lsc = "./lsc";
+    char* extra = "";
+    char* report = "bench-report.json";
+    int runs = 5;
+    bool trace = true;
+    int opt;
+
+    while((opt = getopt(argc, argv, "l:r:x:o:S")) != -1) {
+        switch(opt) {
+            case 'l': lsc = optarg; break;
+            case 'r': runs = atoi(optarg); break;
+            case 'x': extra = optarg; break;
+            case 'o': report = optarg; break;
+            case 'S': trace = false; break;
+            default: runs = 0; break;
+        }
+    }
+
+    if(optind != argc - 1 || runs < 1) {
+        fprintf(stderr, "usage: %s [-l lsc] [-r runs] [-x \"extra options\"] [-o report.json] [-S] TREE\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    char* tree = argv[optind];
+    char lsc_path[PATH_MAX];
+
+    // lsc is run from inside the tree, so that its output doesn't depend on where the tree is
+    if(!realpath(lsc, lsc_path)) {
+        fprintf(stderr, "bench: cannot find '%s': %s\n", lsc, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    FILE* out = fopen(report, "w");
+
+    if(!out) {
+        fprintf(stderr, "bench: cannot write '%s': %s\n", report, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    if(chdir(tree) == -1) {
+        fprintf(stderr, "bench: cannot enter '%s': %s\n", tree, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    size_t num_targets = sizeof(targets) / sizeof(targets[0]);
+    size_t num_options = sizeof(flat_options) / sizeof(flat_options[0]);
+    bench_result_t* results = calloc(num_targets * num_options, sizeof(bench_result_t));
+    size_t count = 0;
+
+    if(!results) {
+        printf("malloc() failed...exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("%-8s %-8s %10s %10s %9s %12s %10s %10s\n", "path", "options", "min ms", "median ms", "rss KB", "bytes", "MB/s", "syscalls");
+
+    for(size_t i = 0; i < num_targets; i++) {
+        for(size_t j = 0; j < num_options; j++) {
+            bench_result_t* result = &results[count++];
+            char* run_argv[MAX_ARGUMENTS];
+            char* arguments = strdup(extra);
+
+            result->path = targets[i].path;
+            result->options = targets[i].recursive ? recursive_options[j] : flat_options[j];
+
+            if(!arguments || buildArguments(run_argv, lsc_path, result->options, arguments, result->path) == -1) {
+                fprintf(stderr, "bench: too many options\n");
+                return EXIT_FAILURE;
+            }
+
+            runCase(result, run_argv, runs, trace);
+            free(arguments);
+
+            printf("%-8s %-8s %10.2f %10.2f %9ld %12llu %10.1f %10llu\n", result->path, result->options,
+                   result->wall_min_ms, result->wall_median_ms, result->max_rss_kb,
+                   (unsigned long long)result->output_bytes, result->throughput_mb_s,
+                   (unsigned long long)result->syscalls_total);
+        }
+    }
+
+    writeReport(out, lsc_path, tree, extra, runs, results, count);
+    fclose(out);
+    free(results);
+
+    printf("report written to %s\n", report);
+    return EXIT_SUCCESS;
+}
+
+// run a case runs times (and once more traced) and fill in result
+static void runCase(bench_result_t* result, char** argv, int runs, bool trace) {
+    double* walls = malloc(sizeof(double) * runs);
+    double* users = malloc(sizeof(double) * runs);
+    double* systems = malloc(sizeof(double) * runs);
+
+    if(!walls || !users || !systems) {
+        printf("malloc() failed...exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for(int i = 0; i < runs; i++) {
+        struct rusage usage;
+
+        timeRun(argv, &walls[i], &usage, &result->output_bytes, &result->status);
+        users[i] = milliseconds(usage.ru_utime);
+        systems[i] = milliseconds(usage.ru_stime);
+
+        if(usage.ru_maxrss > result->max_rss_kb) {
+            result->max_rss_kb = usage.ru_maxrss;
+        }
+    }
+
+    // the median run's cpu times go with its wall time, sorted alongside through their index
+    double* order = malloc(sizeof(double) * runs);
+
+    if(!order) {
+        printf("malloc() failed...exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    memcpy(order, walls, sizeof(double) * runs);
+    qsort(order, runs, sizeof(double), compareDoubles);
+
+    result->wall_min_ms = order[0];
+    result->wall_median_ms = order[runs / 2];
+
+    for(int i = 0; i < runs; i++) {
+        if(walls[i] == result->wall_median_ms) {
+            result->user_ms = users[i];
+            result->sys_ms = systems[i];
+            break;
+        }
+    }
+
+    result->throughput_mb_s = result->wall_median_ms > 0 ? result->output_bytes / (result->wall_median_ms * 1000.0) : 0;
+    result->traced = trace && traceRun(argv, result);
+
+    free(order);
+    free(systems);
+    free(users);
+    free(walls);
+}
+
+// run lsc once with its output read through a pipe, and measure it
+static void timeRun(char** argv, double* wall_ms, struct rusage* usage, uint64_t* bytes, int* status) {
+    static char buffer[READ_BUFFER_SIZE];
+    int fds[2];
+
+    if(pipe(fds) == -1) {
+        perror("bench: pipe");
+        exit(EXIT_FAILURE);
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addclose(&actions, fds[0]);
+    posix_spawn_file_actions_addclose(&actions, fds[1]);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+
+    struct timespec start, end;
+    pid_t pid;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int error = posix_spawn(&pid, argv[0], &actions, NULL, argv, environ);
+
+    posix_spawn_file_actions_destroy(&actions);
+    close(fds[1]);
+
+    if(error != 0) {
+        fprintf(stderr, "bench: cannot run '%s': %s\n", argv[0], strerror(error));
+        exit(EXIT_FAILURE);
+    }
+
+    *bytes = 0;
+
+    for(ssize_t length; (length = read(fds[0], buffer, sizeof(buffer))) != 0; ) {
+        if(length == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
+
+            perror("bench: read");
+            exit(EXIT_FAILURE);
+        }
+
+        *bytes += length;
+    }
+
+    close(fds[0]);
+
+    int wait_status;
+
+    while(wait4(pid, &wait_status, 0, usage) == -1) {
+        if(errno != EINTR) {
+            perror("bench: wait4");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    *wall_ms = (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0;
+    *status = WIFEXITED(wait_status) ? WEXITSTATUS(wait_status) : -1;
+}
+
+// run lsc once under ptrace (output to /dev/null) and count the system calls of all of its threads
+// returns false if it can't be traced
+static bool traceRun(char** argv, bench_result_t* result) {
+    pid_t pid = fork();
+
+    if(pid == -1) {
+        perror("bench: fork");
+        exit(EXIT_FAILURE);
+    }
+
+    if(pid == 0) {
+        int null_fd = open("/dev/null", O_WRONLY);
+
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+
+        // stopped until the tracer has set its options, everything after exec is traced
+        if(ptrace(PTRACE_TRACEME, 0, NULL, NULL) == -1) {
+            _exit(127);
+        }
+
+        raise(SIGSTOP);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+
+    int status;
+
+    if(waitpid(pid, &status, 0) == -1 || !WIFSTOPPED(status)) {
+        return false;
+    }
+
+    // new threads are traced too, and lsc is killed if we exit
+    long options = PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_TRACEEXEC | PTRACE_O_EXITKILL;
+
+    if(ptrace(PTRACE_SETOPTIONS, pid, NULL, (void*)options) == -1) {
+        kill(pid, SIGKILL);
+        waitpid(pid, &status, 0);
+        return false;
+    }
+
+    bool exec_done = false;
+    ptrace(PTRACE_SYSCALL, pid, NULL, NULL);
+
+    // until every thread is gone
+    for(pid_t tid; (tid = waitpid(-1, &status, __WALL)) != -1 || errno == EINTR; ) {
+        if(tid == -1 || WIFEXITED(status) || WIFSIGNALED(status)) {
+            continue;
+        }
+
+        int signal = 0;
+
+        if(WIFSTOPPED(status)) {
+            int stop = WSTOPSIG(status);
+
+            if(stop == (SIGTRAP | 0x80)) {
+                // glibc's copy of the kernel's struct ptrace_syscall_info (glibc 2.31 and later)
+                struct __ptrace_syscall_info info;
+
+                // counted on entry, only once lsc is running (not the raise and exec of the child)
+                if(exec_done && ptrace(PTRACE_GET_SYSCALL_INFO, tid, (void*)sizeof(info), &info) > 0 &&
+                   info.op == PTRACE_SYSCALL_INFO_ENTRY) {
+                    result->syscalls_total++;
+
+                    if(info.entry.nr < MAX_SYSCALL) {
+                        result->syscalls[info.entry.nr]++;
+                    }
+                }
+            }
+            else if(stop == SIGTRAP && (status >> 16) == PTRACE_EVENT_EXEC) {
+                exec_done = true;
+            }
+            else if(stop == SIGTRAP || stop == SIGSTOP) {
+                // other events, and new threads starting
+            }
+            else {
+                signal = stop;
+            }
+        }
+
+        ptrace(PTRACE_SYSCALL, tid, NULL, (void*)(long)signal);
+    }
+
+    return true;
+}
+
+// argv for a run: lsc, the case's options, the extra ones (split on spaces, extra is modified) and path
+// returns the number of arguments, -1 if there are too many
+static int buildArguments(char** argv, char* lsc, const char* options, char* extra, const char* path) {
+    int argc = 0;
+
+    argv[argc++] = lsc;
+
+    if(options[0] != '\0') {
+        argv[argc++] = (char*)options;
+    }
+
+    for(char* token = strtok(extra, " "); token; token = strtok(NULL, " ")) {
+        if(argc == MAX_ARGUMENTS - 2) {
+            return -1;
+        }
+
+        argv[argc++] = token;
+    }
+
+    argv[argc++] = (char*)path;
+    argv[argc] = NULL;
+
+    return argc;
+}
+
+static void writeReport(FILE* out, char* lsc, char* tree, char* extra, int runs, bench_result_t* results, size_t count) {
+    // the tree's parameters, as gentree recorded them
+    char stamp[256] = "";
+    FILE* stamp_file = fopen(".gentree", "r");
+
+    if(stamp_file) {
+        if(!fgets(stamp, sizeof(stamp), stamp_file)) {
+            stamp[0] = '\0';
+        }
+
+        stamp[strcspn(stamp, "\n")] = '\0';
+        fclose(stamp_file);
+    }
+
+    fprintf(out, "{\n  \"lsc\": ");
+    writeString(out, lsc);
+    fprintf(out, ",\n  \"tree\": ");
+    writeString(out, tree);
+    fprintf(out, ",\n  \"tree_parameters\": ");
+    writeString(out, stamp);
+    fprintf(out, ",\n  \"extra_options\": ");
+    writeString(out, extra);
+    fprintf(out, ",\n  \"runs\": %d,\n  \"time\": %lld,\n  \"cases\": [\n", runs, (long long)time(NULL));
+
+    for(size_t i = 0; i < count; i++) {
+        bench_result_t* result = &results[i];
+
+        fprintf(out, "    {\"path\": ");
+        writeString(out, result->path);
+        fprintf(out, ", \"options\": ");
+        writeString(out, result->options);
+        fprintf(out, ", \"status\": %d, \"wall_min_ms\": %.3f, \"wall_median_ms\": %.3f, \"user_ms\": %.3f, "
+                "\"sys_ms\": %.3f, \"max_rss_kb\": %ld, \"output_bytes\": %llu, \"throughput_mb_s\": %.3f",
+                result->status, result->wall_min_ms, result->wall_median_ms, result->user_ms, result->sys_ms,
+                result->max_rss_kb, (unsigned long long)result->output_bytes, result->throughput_mb_s);
+
+        if(result->traced) {
+            fprintf(out, ", \"syscalls\": {\"total\": %llu", (unsigned long long)result->syscalls_total);
+
+            for(size_t j = 0; j < sizeof(syscall_names) / sizeof(syscall_names[0]); j++) {
+                fprintf(out, ", \"%s\": %llu", syscall_names[j].name,
+                        (unsigned long long)result->syscalls[syscall_names[j].number]);
+            }
+
+            fprintf(out, "}");
+        }
+
+        fprintf(out, "}%s\n", i < count - 1 ? "," : "");
+    }
+
+    fprintf(out, "  ]\n}\n");
+}
+
+// str as a JSON string
+static void writeString(FILE* out, const char* str) {
+    fputc('"', out);
+
+    for(const unsigned char* c = (const unsigned char*)str; *c; c++) {
+        if(*c == '"' || *c == '\\') {
+            fprintf(out, "\\%c", *c);
+        }
+        else if(*c < 0x20) {
+            fprintf(out, "\\u%04x", *c);
+        }
+        else {
+            fputc(*c, out);
+        }
+    }
+
+    fputc('"', out);
+}
+
+static double milliseconds(struct timeval time) {
+    return time.tv_sec * 1000.0 + time.tv_usec / 1000.0;
+}
+
+static int compareDoubles(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+
+    return (x > y) - (x < y);
+}
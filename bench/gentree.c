@@ -0,0 +1,415 @@
+// generates the synthetic directory tree the benchmarks run on
+// the tree only depends on the parameters (and the seed): names, sizes, modes, owners and times are all
+// drawn from the same pseudo-random sequence, so two runs (on two machines) list the same output
+//
+// usage: gentree [-n files] [-d depth] [-w width] [-L links] [-u owners] [-s seed] DIR
+//
+// DIR/flat     n files in a single directory (10k to 10M is the range we care about)
+// DIR/deep     a chain of d nested directories, a few files in each
+// DIR/wide     w directories, each with files and subdirectories of their own
+// DIR/links    L symlinks to files, directories and nowhere
+// DIR/quoting  names that are printed quoted (spaces, quotes, control characters, non-ASCII)
+// DIR/owners   u files owned by as many distinct users and groups (needs root, skipped otherwise)
+//
+// DIR/.gentree records the parameters; a tree generated with the same ones is left as is, so that
+// only the first benchmark run pays for creating millions of files
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+// first uid / gid given to the files in owners, far from the system's own
+#define FIRST_OWNER_ID 100000
+
+// times are spread over the three years before this one (2024-01-01), some of them in the last six months
+// so that -l prints both of its date formats
+#define BASE_TIME 1704067200
+#define TIME_SPREAD (3 * 365 * 24 * 3600)
+
+// files in each directory of wide and deep
+#define WIDE_FILES 50
+#define WIDE_SUBDIRS 2
+#define WIDE_SUBDIR_FILES 10
+#define DEEP_FILES 3
+
+#define STAMP_NAME ".gentree"
+
+typedef struct gen_params_t {
+    unsigned long files;
+    unsigned long depth;
+    unsigned long width;
+    unsigned long links;
+    unsigned long owners;
+    unsigned long seed;
+} gen_params_t;
+
+// state of the xorshift64* generator every random choice comes from
+static uint64_t random_state;
+
+// whether chown is permitted, cleared (with a warning) the first time it isn't
+static bool can_chown = true;
+
+static void makeFlat(int root_fd, gen_params_t* params);
+static void makeDeep(int root_fd, gen_params_t* params);
+static void makeWide(int root_fd, gen_params_t* params);
+static void makeLinks(int root_fd, gen_params_t* params);
+static void makeQuoting(int root_fd);
+static void makeOwners(int root_fd, gen_params_t* params);
+static int makeDirectory(int at_fd, const char* name);
+static void makeFile(int dir_fd, const char* name, uid_t uid, gid_t gid);
+static void finishDirectory(int dir_fd);
+static void setTime(int dir_fd, const char* name, int flags);
+static void randomTimes(struct timespec times[2]);
+static uint64_t nextRandom();
+static bool parseNumber(const char* str, unsigned long* number);
+static void fail(const char* what, const char* name);
+
+int main(int argc, char** argv) {
+    gen_params_t params = { 10000, 1000, 200, 10000, 1000, 1 };
+    int opt;
+
+    while((opt = getopt(argc, argv, "n:d:w:L:u:s:")) != -1) {
+        unsigned long* field = NULL;
+
+        switch(opt) {
+            case 'n': field = &params.files; break;
+            case 'd': field = &params.depth; break;
+            case 'w': field = &params.width; break;
+            case 'L': field = &params.links; break;
+            case 'u': field = &params.owners; break;
+            case 's': field = &params.seed; break;
+        }
+
+        if(!field || !parseNumber(optarg, field)) {
+            fprintf(stderr, "usage: %s [-n files] [-d depth] [-w width] [-L links] [-u owners] [-s seed] DIR\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if(optind != argc - 1) {
+        fprintf(stderr, "usage: %s [-n files] [-d depth] [-w width] [-L links] [-u owners] [-s seed] DIR\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    char* root = argv[optind];
+    char stamp[256];
+    int stamp_len = snprintf(stamp, sizeof(stamp), "files=%lu depth=%lu width=%lu links=%lu owners=%lu seed=%lu\n",
+                             params.files, params.depth, params.width, params.links, params.owners, params.seed);
+
+    // an existing tree is kept if it was made with the same parameters, anything else there is left alone
+    if(mkdir(root, 0755) == -1) {
+        if(errno != EEXIST) {
+            fail("cannot create", root);
+        }
+
+        char existing[256];
+        int stamp_fd = open(root, O_RDONLY | O_DIRECTORY);
+        int existing_fd = stamp_fd == -1 ? -1 : openat(stamp_fd, STAMP_NAME, O_RDONLY);
+        ssize_t existing_len = existing_fd == -1 ? -1 : read(existing_fd, existing, sizeof(existing));
+
+        if(existing_len == stamp_len && memcmp(existing, stamp, stamp_len) == 0) {
+            printf("%s is up to date\n", root);
+            return EXIT_SUCCESS;
+        }
+
+        fprintf(stderr, "%s exists and was not generated with these parameters, remove it first\n", root);
+        return EXIT_FAILURE;
+    }
+
+    int root_fd = open(root, O_RDONLY | O_DIRECTORY);
+
+    if(root_fd == -1) {
+        fail("cannot open", root);
+    }
+
+    random_state = params.seed * 0x9E3779B97F4A7C15ULL + 1;
+
+    makeFlat(root_fd, &params);
+    makeDeep(root_fd, &params);
+    makeWide(root_fd, &params);
+    makeLinks(root_fd, &params);
+    makeQuoting(root_fd);
+    makeOwners(root_fd, &params);
+
+    // written last: an interrupted run doesn't leave a tree that looks complete
+    int stamp_fd = openat(root_fd, STAMP_NAME, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if(stamp_fd == -1 || write(stamp_fd, stamp, stamp_len) != stamp_len) {
+        fail("cannot write", STAMP_NAME);
+    }
+
+    close(stamp_fd);
+    setTime(root_fd, STAMP_NAME, 0);
+    finishDirectory(root_fd);
+    close(root_fd);
+
+    printf("generated %s\n", root);
+    return EXIT_SUCCESS;
+}
+
+// flat: one large directory of files with random names, so that name order and creation order differ
+static void makeFlat(int root_fd, gen_params_t* params) {
+    int dir_fd = makeDirectory(root_fd, "flat");
+    char name[64];
+
+    for(unsigned long i = 0; i < params->files; i++) {
+        snprintf(name, sizeof(name), "%08x-%lu", (unsigned)nextRandom(), i);
+        makeFile(dir_fd, name, -1, -1);
+    }
+
+    finishDirectory(dir_fd);
+    close(dir_fd);
+}
+
+// deep: a chain of directories, each opened relative to its parent (the paths outgrow PATH_MAX)
+static void makeDeep(int root_fd, gen_params_t* params) {
+    int dir_fd = makeDirectory(root_fd, "deep");
+    char name[64];
+
+    for(unsigned long level = 0; level < params->depth; level++) {
+        for(int i = 0; i < DEEP_FILES; i++) {
+            snprintf(name, sizeof(name), "file%d", i);
+            makeFile(dir_fd, name, -1, -1);
+        }
+
+        snprintf(name, sizeof(name), "level%lu", level + 1);
+        int child_fd = makeDirectory(dir_fd, name);
+
+        close(dir_fd);
+        dir_fd = child_fd;
+    }
+
+    // back up through "..", a directory's time is set after everything in it was created
+    for(unsigned long level = params->depth; level > 0; level--) {
+        finishDirectory(dir_fd);
+
+        int parent_fd = openat(dir_fd, "..", O_RDONLY | O_DIRECTORY);
+
+        if(parent_fd == -1) {
+            fail("cannot open", "..");
+        }
+
+        close(dir_fd);
+        dir_fd = parent_fd;
+    }
+
+    finishDirectory(dir_fd);
+    close(dir_fd);
+}
+
+// wide: many sibling directories, each with files and a few small subdirectories
+static void makeWide(int root_fd, gen_params_t* params) {
+    int wide_fd = makeDirectory(root_fd, "wide");
+    char name[64];
+
+    for(unsigned long i = 0; i < params->width; i++) {
+        snprintf(name, sizeof(name), "dir%04lu", i);
+        int dir_fd = makeDirectory(wide_fd, name);
+
+        for(int j = 0; j < WIDE_FILES; j++) {
+            snprintf(name, sizeof(name), "file%02d", j);
+            makeFile(dir_fd, name, -1, -1);
+        }
+
+        for(int j = 0; j < WIDE_SUBDIRS; j++) {
+            snprintf(name, sizeof(name), "sub%d", j);
+            int sub_fd = makeDirectory(dir_fd, name);
+
+            for(int k = 0; k < WIDE_SUBDIR_FILES; k++) {
+                snprintf(name, sizeof(name), "file%02d", k);
+                makeFile(sub_fd, name, -1, -1);
+            }
+
+            finishDirectory(sub_fd);
+            close(sub_fd);
+        }
+
+        finishDirectory(dir_fd);
+        close(dir_fd);
+    }
+
+    finishDirectory(wide_fd);
+    close(wide_fd);
+}
+
+// links: symlinks to files in wide, to directories, and dangling ones (1 in 8 of each)
+static void makeLinks(int root_fd, gen_params_t* params) {
+    int dir_fd = makeDirectory(root_fd, "links");
+    char name[64];
+    char target[128];
+
+    for(unsigned long i = 0; i < params->links; i++) {
+        uint64_t choice = nextRandom();
+        unsigned long dir = params->width ? (choice >> 8) % params->width : 0;
+
+        switch(choice % 8) {
+            case 0:
+                snprintf(target, sizeof(target), "../nowhere/%lu", i);
+                break;
+            case 1:
+                snprintf(target, sizeof(target), "../wide/dir%04lu", dir);
+                break;
+            default:
+                snprintf(target, sizeof(target), "../wide/dir%04lu/file%02u", dir, (unsigned)((choice >> 32) % WIDE_FILES));
+                break;
+        }
+
+        snprintf(name, sizeof(name), "link%lu", i);
+
+        if(symlinkat(target, dir_fd, name) == -1) {
+            fail("cannot create", name);
+        }
+
+        setTime(dir_fd, name, AT_SYMLINK_NOFOLLOW);
+    }
+
+    finishDirectory(dir_fd);
+    close(dir_fd);
+}
+
+// quoting: every pair of the characters that make a name print quoted (and some that don't)
+static void makeQuoting(int root_fd) {
+    static const char* pieces[] = {
+        " ", "'", "\"", "$", "\\", "\t", "\n", "*", "?", "[", "!", "#", "~", "=", "&", ";", "|",
+        "\xc3\xa9", "\xe2\x82\xac", "\x7f", "\x01", "-", "_", ".", "a", "Z"
+    };
+    size_t num_pieces = sizeof(pieces) / sizeof(pieces[0]);
+    int dir_fd = makeDirectory(root_fd, "quoting");
+    char name[64];
+
+    for(size_t i = 0; i < num_pieces; i++) {
+        for(size_t j = 0; j < num_pieces; j++) {
+            snprintf(name, sizeof(name), "n%s%sx", pieces[i], pieces[j]);
+            makeFile(dir_fd, name, -1, -1);
+        }
+    }
+
+    finishDirectory(dir_fd);
+    close(dir_fd);
+}
+
+// owners: one file per user (and group), so that -l looks up as many distinct ids
+static void makeOwners(int root_fd, gen_params_t* params) {
+    int dir_fd = makeDirectory(root_fd, "owners");
+    char name[64];
+
+    for(unsigned long i = 0; i < params->owners; i++) {
+        snprintf(name, sizeof(name), "owned%lu", i);
+        makeFile(dir_fd, name, FIRST_OWNER_ID + i, FIRST_OWNER_ID + i);
+    }
+
+    finishDirectory(dir_fd);
+    close(dir_fd);
+}
+
+// create the directory name in at_fd and return it opened
+static int makeDirectory(int at_fd, const char* name) {
+    if(mkdirat(at_fd, name, 0755) == -1) {
+        fail("cannot create", name);
+    }
+
+    int dir_fd = openat(at_fd, name, O_RDONLY | O_DIRECTORY);
+
+    if(dir_fd == -1) {
+        fail("cannot open", name);
+    }
+
+    return dir_fd;
+}
+
+// create a file with a random (sparse) size, mode and time, owned by uid / gid unless they are -1
+static void makeFile(int dir_fd, const char* name, uid_t uid, gid_t gid) {
+    static const mode_t modes[] = { 0644, 0644, 0644, 0600, 0755, 0640, 0444, 04755 };
+    uint64_t choice = nextRandom();
+    int fd = openat(dir_fd, name, O_WRONLY | O_CREAT | O_EXCL, 0644);
+
+    if(fd == -1) {
+        fail("cannot create", name);
+    }
+
+    // sizes from empty to a few GiB, most of them small like in a real tree
+    off_t size = (off_t)((choice >> 16) & 0xFFFFF) >> ((choice >> 8) % 20);
+
+    if(choice % 64 == 0) {
+        size <<= 12;
+    }
+
+    if(ftruncate(fd, size) == -1) {
+        fail("cannot resize", name);
+    }
+
+    if(fchmod(fd, modes[choice % 8]) == -1) {
+        fail("cannot change the mode of", name);
+    }
+
+    if(uid != (uid_t)-1 && can_chown && fchown(fd, uid, gid) == -1) {
+        if(errno != EPERM) {
+            fail("cannot change the owner of", name);
+        }
+
+        fprintf(stderr, "not permitted to change owners, owners is left with a single one\n");
+        can_chown = false;
+    }
+
+    close(fd);
+    setTime(dir_fd, name, 0);
+}
+
+// give a directory its time once everything in it was created
+static void finishDirectory(int dir_fd) {
+    struct timespec times[2];
+
+    randomTimes(times);
+
+    if(futimens(dir_fd, times) == -1) {
+        fail("cannot set the time of", "directory");
+    }
+}
+
+// set a random access and modification time on name in dir_fd
+static void setTime(int dir_fd, const char* name, int flags) {
+    struct timespec times[2];
+
+    randomTimes(times);
+
+    if(utimensat(dir_fd, name, times, flags) == -1) {
+        fail("cannot set the time of", name);
+    }
+}
+
+static void randomTimes(struct timespec times[2]) {
+    times[0].tv_sec = BASE_TIME - (time_t)(nextRandom() % TIME_SPREAD);
+    times[0].tv_nsec = 0;
+    times[1].tv_sec = BASE_TIME - (time_t)(nextRandom() % TIME_SPREAD);
+    times[1].tv_nsec = (long)(nextRandom() % 1000000000);
+}
+
+// xorshift64*: fast, and the same sequence everywhere for a given seed
+static uint64_t nextRandom() {
+    random_state ^= random_state >> 12;
+    random_state ^= random_state << 25;
+    random_state ^= random_state >> 27;
+
+    return random_state * 0x2545F4914F6CDD1DULL;
+}
+
+static bool parseNumber(const char* str, unsigned long* number) {
+    char* end;
+
+    errno = 0;
+    *number = strtoul(str, &end, 10);
+
+    return errno == 0 && end != str && *end == '\0';
+}
+
+static void fail(const char* what, const char* name) {
+    fprintf(stderr, "gentree: %s '%s': %s\n", what, name, strerror(errno));
+    exit(EXIT_FAILURE);
+}
@@ -0,0 +1,313 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h> // strdup
+#include <errno.h>
+#include <fcntl.h> // AT_FDCWD
+#include <unistd.h> // close
+#include <sys/stat.h>
+
+#include "lsc.h"
+#include "liblsc.h"
+#include "util/context.h"
+#include "util/listing.h"
+#include "util/record.h"
+#include "util/dirreader.h"
+#include "util/vector.h"
+#include "util/arena.h"
+
+// first number of entries / pending directories an iterator has room for, doubled when needed
+#define ITER_INITIAL_CAPACITY 64
+
+struct lsc_t {
+    options_t options; // the caller's, adjusted for handing out entries; the context points at them
+    context_t* context;
+};
+
+// lists one directory per step (the subdirectories it finds are listed in later steps, in the order lsc -R
+// lists them) and hands out the entries collected by that step one at a time
+// directories are opened by their path, nothing stays open between steps
+struct lsc_iter_t {
+    lsc_t* lsc;
+    bool first; // the path given hasn't been listed yet, it may not be a directory
+
+    // paths of the directories still to be listed (malloc-ed), the next one last
+    char** pending;
+    size_t num_pending;
+    size_t pending_capacity;
+    char* path; // of the directory listed last, its entries' dir
+
+    // entries of the last step, their strings are copied into strings
+    lsc_entry_t* entries;
+    size_t num_entries;
+    size_t entries_capacity;
+    size_t next;
+    arena_t* strings;
+    const char* dir_from; // the last dir copied and its copy, all the entries of a directory share it
+    const char* dir_copy;
+
+    int error; // ENOMEM once a step ran out of memory, the iterator is done after the entries it did collect
+};
+
+static bool isDirectory(const char* path, options_t* options);
+static void iterStep(lsc_iter_t* iter);
+static bool iterPush(lsc_iter_t* iter, const char* path);
+static bool iterCollect(void* arg, const lsc_entry_t* entry);
+
+// creates a handle listing with a copy of options (as lsc would fill them out from its command line),
+// a read_buffer_size of 0 is the default; returns NULL if out of memory
+lsc_t* lscCreate(const options_t* options) {
+    lsc_t* lsc = malloc(sizeof(lsc_t));
+
+    if(!lsc) {
+        return NULL;
+    }
+
+    // entries are handed out as records instead of being printed, nothing that only formats or prints a
+    // listing applies; neither do the parts of lsc built around its output (threads, the pipeline, --du,
+    // --watch and --stats)
+    lsc->options = *options;
+    lsc->options.format = FORMAT_ENTRIES;
+    lsc->options.print_header = false;
+    lsc->options.threads = 1;
+    lsc->options.pipeline = false;
+    lsc->options.du = false;
+    lsc->options.watch = false;
+    lsc->options.stats = false;
+
+    if(lsc->options.read_buffer_size == 0) {
+        lsc->options.read_buffer_size = DIR_READ_BUFFER_SIZE;
+    }
+
+    lsc->context = contextCreate(&lsc->options, -1);
+
+    if(!lsc->context) {
+        free(lsc);
+        return NULL;
+    }
+
+    return lsc;
+}
+
+// list path (a directory, recursively with options.recursive, or a single file) calling callback with arg
+// for every entry; returns 0, ECANCELED if the callback stopped the listing or ENOMEM if it ran out of memory
+// (the entries before that were handed out)
+int lscList(lsc_t* lsc, const char* path, lsc_callback_t callback, void* arg) {
+    context_t* context = lsc->context;
+
+    context->emit = callback;
+    context->emit_arg = arg;
+    context->error = 0;
+
+    if(isDirectory(path, context->options)) {
+        listDirectory(context, (char*)path);
+    }
+    else {
+        char* files[1] = { (char*)path };
+        vector_t file_vector = { 1, 1, files };
+
+        recordDirectory(context, NULL);
+        listFiles(context, &file_vector, -1);
+        arenaReset(context->names);
+    }
+
+    int error = context->error;
+    context->error = 0;
+
+    return error;
+}
+
+// start listing path like lscList, the entries are then taken one at a time with lscIterNext
+// the handle can't be used for anything else until the iterator is freed; returns NULL if out of memory
+lsc_iter_t* lscIterCreate(lsc_t* lsc, const char* path) {
+    lsc_iter_t* iter = calloc(1, sizeof(lsc_iter_t));
+
+    if(!iter) {
+        return NULL;
+    }
+
+    iter->lsc = lsc;
+    iter->first = true;
+    iter->strings = arenaCreate();
+
+    if(!iter->strings || !iterPush(iter, path)) {
+        lscIterFree(iter);
+        return NULL;
+    }
+
+    return iter;
+}
+
+// fill out entry with the next entry of the listing (valid until the next call)
+// returns 1 for an entry, 0 once the listing is done or ENOMEM if it ran out of memory
+int lscIterNext(lsc_iter_t* iter, lsc_entry_t* entry) {
+    while(iter->next == iter->num_entries) {
+        if(iter->error != 0) {
+            return iter->error;
+        }
+
+        if(iter->num_pending == 0) {
+            return 0;
+        }
+
+        iterStep(iter);
+    }
+
+    *entry = iter->entries[iter->next++];
+
+    return 1;
+}
+
+void lscIterFree(lsc_iter_t* iter) {
+    for(size_t i = 0; i < iter->num_pending; i++) {
+        free(iter->pending[i]);
+    }
+
+    if(iter->strings) {
+        arenaFree(iter->strings);
+    }
+
+    free(iter->pending);
+    free(iter->path);
+    free(iter->entries);
+    free(iter);
+}
+
+// free the handle, with --index the next run's index is put in place
+void lscFree(lsc_t* lsc) {
+    contextFree(lsc->context);
+    free(lsc);
+}
+
+// whether path is listed as a directory, decided like lsc does for the paths it is given: a symbolic link
+// to a directory is one unless -l lists the link itself; paths that can't be stat-ed are listed as files
+// (their error is then handed out as an entry)
+static bool isDirectory(const char* path, options_t* options) {
+    struct stat path_stat;
+
+    if(lstat(path, &path_stat) == -1) {
+        return false;
+    }
+
+    if(S_ISLNK(path_stat.st_mode) && !options->long_list) {
+        return stat(path, &path_stat) == 0 && S_ISDIR(path_stat.st_mode);
+    }
+
+    return S_ISDIR(path_stat.st_mode);
+}
+
+// list the next pending directory (or the path given, on the first step) collecting its entries, and
+// with -R add its subdirectories to the pending ones
+static void iterStep(lsc_iter_t* iter) {
+    context_t* context = iter->lsc->context;
+
+    free(iter->path);
+    iter->path = iter->pending[--iter->num_pending];
+    iter->num_entries = 0;
+    iter->next = 0;
+    iter->dir_from = NULL;
+    arenaReset(iter->strings);
+
+    // if iterCollect stopped the listing, iter->error already says why
+    if(iter->first && !isDirectory(iter->path, context->options)) {
+        int error = lscList(iter->lsc, iter->path, iterCollect, iter);
+
+        iter->first = false;
+        iter->error = iter->error != 0 ? iter->error : error;
+        return;
+    }
+
+    iter->first = false;
+    context->emit = iterCollect;
+    context->emit_arg = iter;
+    context->error = 0;
+
+    int dir_fd = openDirectory(context, AT_FDCWD, iter->path, iter->path);
+
+    if(dir_fd != -1) {
+        size_t num_subdirs;
+        char** subdirs = listDirectoryContents(context, iter->path, dir_fd, &num_subdirs);
+
+        close(dir_fd);
+
+        // in reverse, so that the first one is listed next
+        for(size_t i = num_subdirs; i > 0 && context->error == 0; i--) {
+            if(!iterPush(iter, subdirs[i - 1])) {
+                context->error = ENOMEM;
+            }
+        }
+
+        arenaReset(context->paths);
+    }
+
+    // the entries collected up to an error are still handed out
+    if(iter->error == 0) {
+        iter->error = context->error;
+    }
+
+    context->error = 0;
+}
+
+// add a copy of path to the directories still to be listed, returns false if out of memory
+static bool iterPush(lsc_iter_t* iter, const char* path) {
+    if(iter->num_pending == iter->pending_capacity) {
+        size_t capacity = iter->pending_capacity ? iter->pending_capacity * 2 : ITER_INITIAL_CAPACITY;
+        char** pending = realloc(iter->pending, sizeof(char*) * capacity);
+
+        if(!pending) {
+            return false;
+        }
+
+        iter->pending = pending;
+        iter->pending_capacity = capacity;
+    }
+
+    char* copy = strdup(path);
+
+    if(!copy) {
+        return false;
+    }
+
+    iter->pending[iter->num_pending++] = copy;
+
+    return true;
+}
+
+// lsc_callback_t of an iterator: keep a copy of the entry until it is handed out
+// stops the listing (with iter->error set) if out of memory
+static bool iterCollect(void* arg, const lsc_entry_t* entry) {
+    lsc_iter_t* iter = arg;
+
+    if(iter->num_entries == iter->entries_capacity) {
+        size_t capacity = iter->entries_capacity ? iter->entries_capacity * 2 : ITER_INITIAL_CAPACITY;
+        lsc_entry_t* entries = realloc(iter->entries, sizeof(lsc_entry_t) * capacity);
+
+        if(!entries) {
+            iter->error = ENOMEM;
+            return false;
+        }
+
+        iter->entries = entries;
+        iter->entries_capacity = capacity;
+    }
+
+    lsc_entry_t copy = *entry;
+
+    if(entry->dir != iter->dir_from) {
+        iter->dir_copy = arenaCopy(iter->strings, entry->dir, strlen(entry->dir));
+        iter->dir_from = iter->dir_copy ? entry->dir : NULL;
+    }
+
+    copy.dir = iter->dir_copy;
+    copy.name = arenaCopy(iter->strings, entry->name, strlen(entry->name));
+    copy.target = entry->target ? arenaCopy(iter->strings, entry->target, strlen(entry->target)) : NULL;
+
+    // what is a string literal, it stays valid
+    if(!copy.dir || !copy.name || (entry->target && !copy.target)) {
+        iter->error = ENOMEM;
+        return false;
+    }
+
+    iter->entries[iter->num_entries++] = copy;
+
+    return true;
+}
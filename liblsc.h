@@ -0,0 +1,45 @@
+#ifndef _LIBLSC_H_
+#define _LIBLSC_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "lsc.h"
+
+// liblsc: the listing core of lsc as a library (liblsc.a / liblsc.so), handing entries to the caller instead
+// of printing them. A handle lists with the options it was created with, entries come either through a
+// callback (lscList) or one at a time from an iterator (lscIterCreate / lscIterNext)
+//
+// there is no global state: handles are independent and each can be used by one thread at a time (one
+// handle per thread), nothing exits the process, running out of memory is returned as ENOMEM
+
+typedef struct lsc_t lsc_t;
+typedef struct lsc_iter_t lsc_iter_t;
+
+// one entry of a listing, the same fields as the records of --format=json / nul
+// the strings are only valid until the callback returns, or until the next lscIterNext
+typedef struct lsc_entry_t {
+    const char* dir;    // directory the entry is in, "" for the path given itself when it isn't a directory
+    const char* name;   // "" for an error about dir itself (e.g. it can't be opened)
+    uint64_t ino;
+    uint32_t mode;      // file type and permission bits
+    uint32_t nlink;
+    uint32_t uid;
+    uint32_t gid;
+    int64_t size;
+    int64_t mtime_ns;   // modification time in nanoseconds since the epoch
+    const char* target; // where a symbolic link points, NULL otherwise
+    const char* what;   // what couldn't be done for an entry that can't be listed (e.g. "cannot access"), NULL otherwise
+    int error;          // errno of what couldn't be done, 0 for an entry that was listed (the metadata is then 0)
+} lsc_entry_t;
+
+// gets every entry of a listing, in the order lsc prints them; returning false stops the listing
+typedef bool (*lsc_callback_t)(void* arg, const lsc_entry_t* entry);
+
+lsc_t* lscCreate(const options_t* options);
+int lscList(lsc_t* lsc, const char* path, lsc_callback_t callback, void* arg);
+lsc_iter_t* lscIterCreate(lsc_t* lsc, const char* path);
+int lscIterNext(lsc_iter_t* iter, lsc_entry_t* entry);
+void lscIterFree(lsc_iter_t* iter);
+void lscFree(lsc_t* lsc);
+
+#endif
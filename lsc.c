@@ -4,59 +4,206 @@
 #include <sys/stat.h>
 #include <stdbool.h>
 #include <errno.h>
+#include <locale.h>
+#include <unistd.h> // STDOUT_FILENO
 
 #include "lsc.h"
 #include "util/vector.h"
 #include "util/listing.h"
+#include "util/context.h"
+#include "util/dirreader.h"
+#include "util/parallel.h"
+#include "util/pipeline.h"
+#include "util/idcache.h"
+#include "util/output.h"
+#include "util/arena.h"
+#include "util/sort.h"
+#include "util/spill.h"
+#include "util/du.h"
+#include "util/watch.h"
+#include "util/record.h"
 
 static const char PATH_INVALID = 0;
 static const char PATH_DIRECTORY = 1;
 static const char PATH_FILE = 2;
 
-static char* current_directory = ".";
+// upper limit for --threads
+#define MAX_THREADS 1024
 
-static bool argumentParser(int argc, char* argv[], options_t* options, vector_t* files, vector_t* directories);
+// a path given that can't be accessed, reported as a record once there is a context to write it with
+typedef struct path_error_t {
+    char* path;
+    int error;
+} path_error_t;
+
+static bool argumentParser(int argc, char* argv[], options_t* options, vector_t* files, vector_t* directories, path_error_t* path_errors, size_t* num_path_errors);
+static bool longOptionParser(char* option, options_t* options);
+static bool parseSize(char* str, size_t* size);
 static char checkPath(char* path, options_t* options);
+static void listPaths(context_t* context, vector_t* files, vector_t* directories);
 static void usageMessage();
 
 int main(int argc, char* argv[]) {
-    options_t options = {false, false, false, false, false, false};
+    options_t options = {
+        .read_buffer_size = DIR_READ_BUFFER_SIZE,
+        .threads = 1,
+    };
+
+    // names are sorted like ls does for the user's locale, only collation is taken from it so
+    // the rest of the output (e.g. the decimal point of -h sizes) stays the same
+    setlocale(LC_COLLATE, "");
+    options.collate = sortUsesLocale();
 
     vector_t* files = vectorCreate();
     vector_t* directories = vectorCreate();
 
+    // there can't be more than one per argument
+    path_error_t* path_errors = malloc(sizeof(path_error_t) * argc);
+    size_t num_path_errors = 0;
+
+    if(!files || !directories || !path_errors) {
+        printf("malloc() failed...exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
     // parse arguments
-    if(!argumentParser(argc, argv, &options, files, directories)) {
+    if(!argumentParser(argc, argv, &options, files, directories, path_errors, &num_path_errors)) {
         vectorFree(files);
         vectorFree(directories);
+        free(path_errors);
+        exit(EXIT_FAILURE);
+    }
+
+    context_t* context = contextCreate(&options, STDOUT_FILENO);
+
+    if(!context) {
+        printf("malloc() failed...exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // like liblsc, the records start with the paths given that can't be accessed
+    for(size_t i = 0; i < num_path_errors; i++) {
+        recordError(context, "", path_errors[i].path, "cannot access", path_errors[i].error);
+    }
+
+    free(path_errors);
+
+    // the paths were sorted by name, -S / -t / -r need them stat-ed to put the directories in order
+    // (the files are ordered along with the rest of their listing)
+    if(!options.unsorted && (options.sort_by != SORT_NAME || options.reverse) && directories->length > 1) {
+        entry_info_t* entry_infos = arenaAlloc(context->names, sizeof(entry_info_t) * directories->length);
+
+        if(!entry_infos) {
+            printf("malloc() failed...exiting\n");
+            exit(EXIT_FAILURE);
+        }
+
+        processEntries(context, entry_infos, directories, -1);
+        orderEntries(context, entry_infos, directories);
+        arenaReset(context->names);
+
+        if(context->error != 0) {
+            printf("malloc() failed...exiting\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // errors about the paths were printed with stdio, get them out before any listing output
+    fflush(stdout);
+
+    // the totals of the files then of each of the directories, one line each (more with -R)
+    if(options.du) {
+        du_t* du = diskUsageCreate(context);
+
+        diskUsageFiles(du, files);
+
+        for(size_t i = 0; i < directories->length; i++) {
+            diskUsageDirectory(du, directories->items[i]);
+        }
+
+        diskUsageFree(du);
+    }
+    else if(options.watch && directories->length != 0) {
+        // without inotify the paths are listed once, as if --watch wasn't given
+        watch_t* watch = watchCreate(context, files, directories);
+
+        if(watch) {
+            watchRun(watch);
+            watchFree(watch);
+        }
+        else {
+            listPaths(context, files, directories);
+        }
+    }
+    else {
+        listPaths(context, files, directories);
+    }
+
+    // the listing stopped where it ran out of memory, what was listed up to there is still printed
+    if(context->error != 0) {
+        outputFlush(context->out);
+        printf("malloc() failed...exiting\n");
         exit(EXIT_FAILURE);
     }
 
+    if(options.stats) {
+        // everything written before the time is taken
+        outputFlush(context->out);
+        contextPrintStats(context, stderr);
+    }
+
+    contextFree(context);
+
+    // only free vectors, not the items because they are from argv
+    vectorFree(files);
+    vectorFree(directories);
+    return 0;
+}
+
+// list the given files, then each of the directories
+static void listPaths(context_t* context, vector_t* files, vector_t* directories) {
+    options_t* options = context->options;
+
     // firstly list all of the given files
-    listFiles(&options, files, -1);
+    listFiles(context, files, -1);
+
+    if(context->error != 0) {
+        return;
+    }
 
     // newline between files and directories (only if we have both)
     if(files->length != 0 && directories->length != 0) {
-        printf("\n");
+        printSeparator(context->out, options);
     }
 
     // second list all of the given directories
     for(size_t i = 0; i < directories->length; i++) {
-        listDirectory(&options, directories->items[i]);
+        // reading, stat-ing and printing can overlap in a pipeline, and recursive listings can be spread over
+        // several threads (neither with a memory budget, they hold whole listings in memory until printed)
+        // the pipeline only lists in name order, as it is read, and reads directories itself (without the index)
+        if(options->pipeline && options->memory_budget == 0 && options->index_file == NULL && options->sort_by == SORT_NAME && !options->reverse && options->top == 0) {
+            listDirectoryPipelined(context, directories->items[i]);
+        }
+        else if(options->recursive && options->threads > 1 && options->memory_budget == 0) {
+            listDirectoryParallel(context, directories->items[i]);
+        }
+        else {
+            listDirectory(context, directories->items[i]);
+        }
+
+        if(context->error != 0) {
+            return;
+        }
 
         // add an additional newline only if this is not the last listing
         if(i < directories->length - 1) {
-            printf("\n");
+            printSeparator(context->out, options);
         }
     }
-
-    // only free vectors, not the items because they are from argv
-    vectorFree(files);
-    vectorFree(directories);
-    return 0;
 }
 
-static bool argumentParser(int argc, char* argv[], options_t* options, vector_t* files, vector_t* directories) {
+// paths that can't be accessed are printed straight away, or with --format=nul / json added to path_errors
+static bool argumentParser(int argc, char* argv[], options_t* options, vector_t* files, vector_t* directories, path_error_t* path_errors, size_t* num_path_errors) {
     // program name is argv[0], skip it
     int i = 1;
 
@@ -72,11 +219,30 @@ static bool argumentParser(int argc, char* argv[], options_t* options, vector_t*
             return false;
         }
 
+        // long options are given as a whole word (e.g. --read-buffer=64K), "--" ends the options
+        if(*c == '-') {
+            if(c[1] == '\0') {
+                i++;
+                break;
+            }
+
+            if(!longOptionParser(&c[1], options)) {
+                usageMessage();
+                return false;
+            }
+
+            continue;
+        }
+
         for(; *c != '\0'; c += sizeof(char)) {
             switch(*c) {
                 case 'a':
                     options->all = true;
                     break;
+                case 'f':
+                    options->all = true;
+                    options->unsorted = true;
+                    break;
                 case 'h':
                     options->nice_size = true;
                     break;
@@ -86,9 +252,23 @@ static bool argumentParser(int argc, char* argv[], options_t* options, vector_t*
                 case 'l':
                     options->long_list = true;
                     break;
+                case 'r':
+                    options->reverse = true;
+                    break;
                 case 'R':
                     options->recursive = true;
                     break;
+                case 'S':
+                    options->sort_by = SORT_SIZE;
+                    options->unsorted = false;
+                    break;
+                case 't':
+                    options->sort_by = SORT_TIME;
+                    options->unsorted = false;
+                    break;
+                case 'U':
+                    options->unsorted = true;
+                    break;
                 default:
                     printf("\n Unrecognized option: %c\n", *c);
                     usageMessage();
@@ -99,7 +279,10 @@ static bool argumentParser(int argc, char* argv[], options_t* options, vector_t*
 
     if(i == argc) {
         // user provided no paths, so let's use the current directory
-        vectorPush(directories, current_directory);
+        if(!vectorPush(directories, ".")) {
+            printf("malloc() failed...exiting\n");
+            exit(EXIT_FAILURE);
+        }
     }
 
     if(i <= argc - 2 || options->recursive) {
@@ -109,20 +292,216 @@ static bool argumentParser(int argc, char* argv[], options_t* options, vector_t*
 
     // loop through each path and determine if it is a file or a directory
     for(; i < argc; i++) {
-        // checkPath prints an error if the path is invalid
+        // checkPath prints an error if the path is invalid, except in the formats made of records (not used with --du)
         char path_type = checkPath(argv[i], options);
 
+        bool pushed = true;
+
+        if(path_type == PATH_INVALID && options->format != FORMAT_TEXT && !options->du) {
+            path_errors[(*num_path_errors)++] = (path_error_t){ argv[i], errno };
+        }
+
         if(path_type == PATH_FILE) {
-            vectorPush(files, argv[i]);
+            pushed = vectorPush(files, argv[i]);
         }
         else if(path_type == PATH_DIRECTORY) {
-            vectorPush(directories, argv[i]);
+            pushed = vectorPush(directories, argv[i]);
+        }
+
+        if(!pushed) {
+            printf("malloc() failed...exiting\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // --du prints totals instead of listings, nothing that only a listing shows has to be looked up
+    if(options->du) {
+        options->long_list = false;
+        options->index = false;
+        options->watch = false;
+        options->format = FORMAT_TEXT;
+    }
+
+    // every record says which directory it is in, there are no headers; and records aren't redrawn
+    if(options->format != FORMAT_TEXT) {
+        options->print_header = false;
+        options->watch = false;
+    }
+
+    // a watched listing is kept whole in memory and redrawn from there
+    if(options->watch) {
+        options->top = 0;
+    }
+
+    // with -U the paths are listed in the order they were given
+    if(!options->unsorted) {
+        arena_t* scratch = arenaCreate();
+
+        if(!scratch || !sortNames(files->items, files->length, options->collate, scratch) ||
+           !sortNames(directories->items, directories->length, options->collate, scratch)) {
+            printf("malloc() failed...exiting\n");
+            exit(EXIT_FAILURE);
+        }
+
+        arenaFree(scratch);
+    }
+
+    return true;
+}
+
+// parse a single long option (without the leading "--"), prints an error if it is invalid
+static bool longOptionParser(char* option, options_t* options) {
+    // options taking a value are given as name=value
+    char* value = strchr(option, '=');
+    size_t name_len = value ? (size_t)(value - option) : strlen(option);
+
+    if(value) {
+        value++;
+    }
+
+    if(name_len == strlen("read-buffer") && strncmp(option, "read-buffer", name_len) == 0) {
+        if(!value || !parseSize(value, &options->read_buffer_size) || options->read_buffer_size < DIR_READ_BUFFER_MIN) {
+            printf("\n Invalid read buffer size, expected at least %d bytes\n", DIR_READ_BUFFER_MIN);
+            return false;
+        }
+
+        return true;
+    }
+
+    if(name_len == strlen("format") && strncmp(option, "format", name_len) == 0) {
+        if(value && strcmp(value, "text") == 0) {
+            options->format = FORMAT_TEXT;
+        }
+        else if(value && strcmp(value, "nul") == 0) {
+            options->format = FORMAT_NUL;
+        }
+        else if(value && strcmp(value, "json") == 0) {
+            options->format = FORMAT_JSON;
+        }
+        else {
+            printf("\n Invalid format, expected text, nul or json\n");
+            return false;
+        }
+
+        return true;
+    }
+
+    if(name_len == strlen("watch") && strncmp(option, "watch", name_len) == 0 && !value) {
+        options->watch = true;
+        return true;
+    }
+
+    if(name_len == strlen("du") && strncmp(option, "du", name_len) == 0 && !value) {
+        options->du = true;
+        return true;
+    }
+
+    if(name_len == strlen("index") && strncmp(option, "index", name_len) == 0) {
+        if(!value || *value == '\0') {
+            printf("\n Invalid index, expected a file name\n");
+            return false;
+        }
+
+        options->index_file = value;
+        return true;
+    }
+
+    if(name_len == strlen("inode-order") && strncmp(option, "inode-order", name_len) == 0 && !value) {
+        options->inode_order = true;
+        return true;
+    }
+
+    if(name_len == strlen("io-uring") && strncmp(option, "io-uring", name_len) == 0 && !value) {
+        options->io_uring = true;
+        return true;
+    }
+
+    if(name_len == strlen("memory-budget") && strncmp(option, "memory-budget", name_len) == 0) {
+        if(!value || !parseSize(value, &options->memory_budget) || options->memory_budget < SPILL_BUDGET_MIN) {
+            printf("\n Invalid memory budget, expected at least %d bytes\n", SPILL_BUDGET_MIN);
+            return false;
+        }
+
+        return true;
+    }
+
+    if(name_len == strlen("pipeline") && strncmp(option, "pipeline", name_len) == 0 && !value) {
+        options->pipeline = true;
+        return true;
+    }
+
+    if(name_len == strlen("preload-ids") && strncmp(option, "preload-ids", name_len) == 0 && !value) {
+        options->preload_ids = true;
+        return true;
+    }
+
+    if(name_len == strlen("stats") && strncmp(option, "stats", name_len) == 0 && !value) {
+        options->stats = true;
+        return true;
+    }
+
+    if(name_len == strlen("top") && strncmp(option, "top", name_len) == 0) {
+        if(!value || !parseSize(value, &options->top) || options->top < 1) {
+            printf("\n Invalid number of entries for top, expected at least 1\n");
+            return false;
+        }
+
+        return true;
+    }
+
+    if(name_len == strlen("threads") && strncmp(option, "threads", name_len) == 0) {
+        if(!value || !parseSize(value, &options->threads) || options->threads < 1 || options->threads > MAX_THREADS) {
+            printf("\n Invalid number of threads, expected 1 to %d\n", MAX_THREADS);
+            return false;
+        }
+
+        return true;
+    }
+
+    printf("\n Unrecognized option: --%.*s\n", (int)name_len, option);
+    return false;
+}
+
+// parse a size in bytes with an optional K, M or G suffix (e.g. 64K)
+static bool parseSize(char* str, size_t* size) {
+    char* end;
+
+    errno = 0;
+    unsigned long long value = strtoull(str, &end, 10);
+
+    if(errno != 0 || end == str || *str == '-') {
+        return false;
+    }
+
+    int shifts = 0;
+
+    switch(*end) {
+        case 'G':
+            shifts++;
+            // fall through
+        case 'M':
+            shifts++;
+            // fall through
+        case 'K':
+            shifts++;
+            end++;
+            break;
+    }
+
+    // each step must not wrap around
+    for(; shifts > 0; shifts--) {
+        if(value > SIZE_MAX >> 10) {
+            return false;
         }
+
+        value *= 1024;
     }
 
-    vectorSort(files);
-    vectorSort(directories);
+    if(*end != '\0' || value > SIZE_MAX) {
+        return false;
+    }
 
+    *size = value;
     return true;
 }
 
@@ -131,9 +510,12 @@ static bool argumentParser(int argc, char* argv[], options_t* options, vector_t*
 static char checkPath(char* path, options_t* options) {
     struct stat stat_entry;
 
-    // check if path is valid, if not then print error message
+    // check if path is valid, if not then print error message (records are written by the caller, with errno)
     if(lstat(path, &stat_entry) == -1) {
-        printf("lsc: cannot access '%s': %s\n", path, strerror(errno));
+        if(options->format == FORMAT_TEXT || options->du) {
+            printf("lsc: cannot access '%s': %s\n", path, strerror(errno));
+        }
+
         return PATH_INVALID;
     }
 
@@ -169,10 +551,30 @@ static void usageMessage() {
 
     printf(" Options (prefix with '-'):\n");
     printf("     a: show all files\n");
+    printf("     f: same as 'aU'\n");
     printf("     h: show human-readable sizes (to be used with 'l')\n");
     printf("     i: show file inode numbers\n");
     printf("     l: long format list\n");
-    printf("     R: recursive list\n\n");
+    printf("     r: reverse the order entries are sorted in\n");
+    printf("     R: recursive list\n");
+    printf("     S: sort by size, largest first\n");
+    printf("     t: sort by modification time, newest first\n");
+    printf("     U: do not sort, list entries in directory order as they are read\n\n");
+
+    printf(" Long options (prefix with '--'):\n");
+    printf("     read-buffer=SIZE: bytes to read from a directory at once (default 1M)\n");
+    printf("     threads=N: number of threads used to read directories with 'R' (default 1)\n");
+    printf("     du: print the total allocated and apparent size and number of files of each path instead of listing it (with 'R', of every directory)\n");
+    printf("     index=FILE: keep the names in each directory listed in FILE, and read them from there next time if the directory hasn't changed\n");
+    printf("     format=FORMAT: print 'text' (the default), or a record per entry with its directory, name, inode, mode, links, uid, gid, size, mtime in ns and link target: 'nul' (each field ends with a nul), 'json' (JSON Lines)\n");
+    printf("     inode-order: stat the files of a directory in inode number order (fewer seeks on spinning disks)\n");
+    printf("     io-uring: stat files in batches through io_uring when the kernel supports it\n");
+    printf("     memory-budget=SIZE: sort directories too large for SIZE bytes of memory through temporary files\n");
+    printf("     pipeline: read directories ahead in one thread while others stat and print them (stat threads set by 'threads')\n");
+    printf("     preload-ids: read all users and groups at once instead of looking them up one by one\n");
+    printf("     top=N: only list the first N entries of each directory (with 'R', only those are recursed into)\n");
+    printf("     watch: keep listing the paths, redrawn whenever the directories (with 'R', the trees) change; stop with Ctrl-C\n");
+    printf("     stats: print timings, system call counts and memory use to stderr when done\n\n");
 
     printf(" Paths: one or more absolute or relative paths separated by spaces; if none provided the current directory is assumed\n");
     printf("\n");
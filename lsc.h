@@ -2,14 +2,47 @@
 #define _LSC_H_
 
 #include <stdbool.h>
+#include <stdlib.h>
+
+// what the entries of a listing are sorted by, their names break ties
+typedef enum sort_by_t {
+    SORT_NAME,
+    SORT_SIZE, // -S, largest first
+    SORT_TIME  // -t, newest first
+} sort_by_t;
+
+// how the entries are printed
+typedef enum format_t {
+    FORMAT_TEXT, // columns like ls
+    FORMAT_NUL,  // --format=nul, the raw fields of every entry, each terminated by a nul
+    FORMAT_JSON, // --format=json, one JSON object per entry and line
+    FORMAT_ENTRIES // not a user specified option, entries are handed to the library's callback (see liblsc.h)
+} format_t;
 
 typedef struct options_t {
     bool all;           // -a
     bool index;         // -i
     bool long_list;     // -l
     bool recursive;     // -R
+    bool unsorted;      // -U (and -f), list entries in directory order as they are read
+    sort_by_t sort_by;  // -S / -t
+    bool reverse;       // -r
     bool nice_size;     // -h
     bool print_header;  // not a user specified option, based on number of paths or -R
+    bool collate;       // not a user specified option, names are sorted by the LC_COLLATE locale
+    size_t read_buffer_size; // --read-buffer, bytes read from a directory per getdents64 call
+    size_t threads;          // --threads, number of worker threads used by -R
+    bool io_uring;           // --io-uring, batch statx calls through io_uring when available
+    bool preload_ids;        // --preload-ids, read every user and group up front
+    bool stats;              // --stats, print statistics to stderr at exit
+    bool inode_order;        // --inode-order, stat the entries of a directory in inode number order
+    char* index_file;        // --index, keeps the names of the directories listed in this file for the next run (NULL if not given)
+    bool du;                 // --du, print the total size of each directory tree instead of listing it
+    size_t top;              // --top, only list the first N entries of each listing (0 for all of them)
+    bool pipeline;           // --pipeline, read, stat and print directories in separate threads at the same time
+    size_t memory_budget;    // --memory-budget, bytes a sorted directory may take in memory before it is spilled to disk (0 for no limit)
+    format_t format;         // --format, text unless a machine readable format is asked for
+    bool watch;              // --watch, keep the listing on screen and redraw it as the directories change
 } options_t;
 
 #endif
\ No newline at end of file
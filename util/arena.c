@@ -0,0 +1,189 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h> // memcpy
+#include "arena.h"
+
+// size of a regular block, larger allocations get a block of their own
+static const size_t BLOCK_SIZE = 64 * 1024;
+
+// arenaReset keeps this many bytes of blocks for reuse and frees the rest,
+// so one huge directory doesn't pin its memory for the rest of the run
+static const size_t RETAIN_SIZE = 8 * 1024 * 1024;
+
+// every allocation is aligned to this so any struct can be placed in the arena
+static const size_t ALIGNMENT = sizeof(void*);
+
+static size_t alignSize(size_t size);
+
+// creates an empty arena, the first block is allocated on first use
+// returns NULL if out of memory
+arena_t* arenaCreate() {
+    arena_t* arena = malloc(sizeof(arena_t));
+
+    if(!arena) {
+        return NULL;
+    }
+
+    arena->first = NULL;
+    arena->current = NULL;
+    arena->used = 0;
+    arena->peak = 0;
+    arena->total = 0;
+
+    return arena;
+}
+
+// allocate size bytes from the arena; moves on to the next free block (or a new one) if the current one is full
+// returns NULL if out of memory, the arena is left as it was
+void* arenaAlloc(arena_t* arena, size_t size) {
+    size = alignSize(size);
+
+    arena_block_t* block = arena->current;
+
+    if(block == NULL || block->size - block->used < size) {
+        arena_block_t* next = block ? block->next : arena->first;
+
+        // reuse the next block if the allocation fits, otherwise put a new block in front of it
+        if(next != NULL && next->size >= size) {
+            block = next;
+        }
+        else {
+            size_t block_size = size > BLOCK_SIZE ? size : BLOCK_SIZE;
+            arena_block_t* new_block = malloc(sizeof(arena_block_t) + block_size);
+
+            if(!new_block) {
+                return NULL;
+            }
+
+            new_block->size = block_size;
+            new_block->next = next;
+
+            if(block) {
+                block->next = new_block;
+            }
+            else {
+                arena->first = new_block;
+            }
+
+            block = new_block;
+        }
+
+        block->used = 0;
+        arena->current = block;
+    }
+
+    void* ptr = &block->data[block->used];
+    block->used += size;
+
+    arena->used += size;
+    arena->total += size;
+
+    if(arena->used > arena->peak) {
+        arena->peak = arena->used;
+    }
+
+    return ptr;
+}
+
+// shrink the most recent allocation ptr from old_size to new_size bytes, giving the rest back to the arena
+// (e.g. a buffer allocated for the longest possible string once the actual length is known)
+void arenaTrim(arena_t* arena, void* ptr, size_t old_size, size_t new_size) {
+    arena_block_t* block = arena->current;
+    size_t released = alignSize(old_size) - alignSize(new_size);
+
+    if(block && (char*)ptr + alignSize(old_size) == &block->data[block->used]) {
+        block->used -= released;
+        arena->used -= released;
+        arena->total -= released;
+    }
+}
+
+// copy length bytes of str into the arena and null terminate it, returns NULL if out of memory
+char* arenaCopy(arena_t* arena, const char* str, size_t length) {
+    char* copy = arenaAlloc(arena, length + 1);
+
+    if(!copy) {
+        return NULL;
+    }
+
+    memcpy(copy, str, length);
+    copy[length] = '\0';
+
+    return copy;
+}
+
+// remember the current position, allocations made after it can be released with arenaRewind
+arena_mark_t arenaMark(arena_t* arena) {
+    arena_mark_t mark;
+
+    mark.block = arena->current;
+    mark.block_used = arena->current ? arena->current->used : 0;
+    mark.used = arena->used;
+
+    return mark;
+}
+
+// release everything allocated since mark was taken, the memory is reused by later allocations
+void arenaRewind(arena_t* arena, arena_mark_t mark) {
+    arena->current = mark.block;
+    arena->used = mark.used;
+
+    if(mark.block) {
+        mark.block->used = mark.block_used;
+    }
+}
+
+// release everything allocated from the arena, keeping up to RETAIN_SIZE bytes of blocks for reuse
+void arenaReset(arena_t* arena) {
+    size_t retained = 0;
+    arena_block_t** link = &arena->first;
+
+    while(*link != NULL) {
+        arena_block_t* block = *link;
+
+        if(retained + block->size <= RETAIN_SIZE) {
+            retained += block->size;
+            link = &block->next;
+        }
+        else {
+            *link = block->next;
+            free(block);
+        }
+    }
+
+    arena->current = NULL;
+    arena->used = 0;
+}
+
+// fold the counters of another arena into this one (e.g. of a thread that is done)
+// total is the sum of both, peak the larger of the two
+void arenaAddStats(arena_t* arena, arena_t* other) {
+    arena->total += other->total;
+
+    if(other->peak > arena->peak) {
+        arena->peak = other->peak;
+    }
+}
+
+// print the peak / total counters (for --stats)
+void arenaPrintStats(arena_t* arena, const char* label, FILE* out) {
+    fprintf(out, "%s arena: %zu bytes peak, %zu bytes total\n", label, arena->peak, arena->total);
+}
+
+// free every block owned by the arena and the arena itself
+void arenaFree(arena_t* arena) {
+    arena_block_t* block = arena->first;
+
+    while(block != NULL) {
+        arena_block_t* next = block->next;
+        free(block);
+        block = next;
+    }
+
+    free(arena);
+}
+
+// round size up to ALIGNMENT
+static size_t alignSize(size_t size) {
+    return (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+}
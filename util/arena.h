@@ -0,0 +1,44 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// one chunk of memory owned by an arena; allocations are carved from data
+typedef struct arena_block_t {
+    struct arena_block_t* next;
+    size_t size;
+    size_t used;
+    char data[];
+} arena_block_t;
+
+// a bump allocator; everything allocated from it is released at once by arenaReset (or arenaRewind)
+// the blocks are kept for the next round, so an arena that is reused stops touching the heap
+typedef struct arena_t {
+    arena_block_t* first;
+    arena_block_t* current; // blocks after current are free for reuse
+
+    size_t used;  // bytes allocated since the last reset
+    size_t peak;  // most bytes allocated at once
+    size_t total; // bytes allocated over the arena's lifetime
+} arena_t;
+
+// position in an arena to rewind to, everything allocated after it is released
+typedef struct arena_mark_t {
+    arena_block_t* block;
+    size_t block_used;
+    size_t used;
+} arena_mark_t;
+
+arena_t* arenaCreate();
+void* arenaAlloc(arena_t* arena, size_t size);
+void arenaTrim(arena_t* arena, void* ptr, size_t old_size, size_t new_size);
+char* arenaCopy(arena_t* arena, const char* str, size_t length);
+arena_mark_t arenaMark(arena_t* arena);
+void arenaRewind(arena_t* arena, arena_mark_t mark);
+void arenaReset(arena_t* arena);
+void arenaAddStats(arena_t* arena, arena_t* other);
+void arenaPrintStats(arena_t* arena, const char* label, FILE* out);
+void arenaFree(arena_t* arena);
+
+#endif
@@ -0,0 +1,172 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h> // memset
+#include <malloc.h> // mallinfo2
+#include <unistd.h> // STDOUT_FILENO
+
+#include "../lsc.h"
+#include "context.h"
+#include "record.h"
+#include "entries.h"
+
+static context_t* contextAlloc(options_t* options);
+
+// creates a listing context for the given options, along with the state shared by the whole run
+// listings are written to fd (kept in memory if it is -1)
+// returns NULL if out of memory
+context_t* contextCreate(options_t* options, int fd) {
+    context_t* context = contextAlloc(options);
+
+    if(!context) {
+        return NULL;
+    }
+
+    context->owner = true;
+    context->out = outputCreate(fd);
+    context->ids = idcacheCreate();
+    context->index = options->index_file ? indexOpen(options->index_file) : NULL;
+
+    if(!context->out || !context->ids || (options->index_file && !context->index)) {
+        contextFree(context);
+        return NULL;
+    }
+
+    context->out->stats = context->stats;
+
+    if(options->preload_ids) {
+        idcachePreload(context->ids);
+    }
+
+    return context;
+}
+
+// creates a context for another thread, sharing the run-wide state of parent
+// returns NULL if out of memory
+context_t* contextFork(context_t* parent) {
+    context_t* context = contextAlloc(parent->options);
+
+    if(!context) {
+        return NULL;
+    }
+
+    context->owner = false;
+    context->out = outputCreate(-1);
+    context->ids = parent->ids;
+    context->index = parent->index;
+
+    if(!context->out) {
+        contextFree(context);
+        return NULL;
+    }
+
+    return context;
+}
+
+// allocate the per-thread part of a context, NULL if out of memory
+static context_t* contextAlloc(options_t* options) {
+    // everything not set here starts out NULL / 0, so a context that is only partly allocated can be freed
+    context_t* context = calloc(1, sizeof(context_t));
+
+    if(!context) {
+        return NULL;
+    }
+
+    context->options = options;
+    metadataPlan(&context->plan, options);
+
+    // the only place the per-entry code looks at the options, everything after this runs the variants picked
+    context->process_kernel = processKernel(&context->plan);
+    context->print_kernel = printKernel(options);
+
+    // falls back to synchronous lstat if io_uring can't be set up
+    context->uring = options->io_uring ? uringCreate() : NULL;
+    context->read_buffer = malloc(options->read_buffer_size);
+    context->names = arenaCreate();
+    context->paths = arenaCreate();
+    context->entry_vector = vectorCreate();
+    context->subdir_vector = vectorCreate();
+    context->record_prefix = options->format == FORMAT_NUL || options->format == FORMAT_JSON ? outputCreate(-1) : NULL;
+    timefmtInit(&context->times);
+    context->stats = options->stats ? statsCreate() : NULL;
+
+    bool prefix_failed = (options->format == FORMAT_NUL || options->format == FORMAT_JSON) && !context->record_prefix;
+
+    if(!context->read_buffer || !context->names || !context->paths || !context->entry_vector || !context->subdir_vector || prefix_failed || (options->stats && !context->stats)) {
+        contextFree(context);
+        return NULL;
+    }
+
+    recordDirectory(context, NULL);
+
+    return context;
+}
+
+// print the counters of --stats (with those of forked contexts added in) and of the state shared by the run
+void contextPrintStats(context_t* context, FILE* out) {
+    statsPrint(context->stats, out);
+    idcachePrintStats(context->ids, context->stats->id_memo_hits, out);
+
+    if(context->index) {
+        indexPrintStats(context->index, out);
+    }
+
+    arenaPrintStats(context->names, "names", out);
+    arenaPrintStats(context->paths, "paths", out);
+
+    struct mallinfo2 heap = mallinfo2();
+    fprintf(out, "heap: %zu bytes in use, %zu bytes from the system\n", heap.uordblks + heap.hblkhd, heap.arena + heap.hblkhd);
+}
+
+// free memory malloc-ed by contextCreate / contextFork; the options are not owned by the context
+// forked contexts have to be freed before their owner
+// also frees contexts that were only partly allocated, whatever wasn't is NULL
+void contextFree(context_t* context) {
+    if(context->owner) {
+        if(context->ids) {
+            idcacheFree(context->ids);
+        }
+
+        // the next run's index is put in place once everything was listed
+        if(context->index) {
+            indexClose(context->index);
+        }
+    }
+
+    if(context->uring) {
+        uringFree(context->uring);
+    }
+
+    if(context->out) {
+        outputFree(context->out);
+    }
+
+    if(context->record_prefix) {
+        outputFree(context->record_prefix);
+    }
+
+    if(context->names) {
+        arenaFree(context->names);
+    }
+
+    if(context->paths) {
+        arenaFree(context->paths);
+    }
+
+    if(context->entry_vector) {
+        vectorFree(context->entry_vector);
+    }
+
+    if(context->subdir_vector) {
+        vectorFree(context->subdir_vector);
+    }
+
+    free(context->read_buffer);
+    free(context->index_record.buffer);
+
+    // after the output, its last flush is timed
+    if(context->stats) {
+        statsFree(context->stats);
+    }
+
+    free(context);
+}
@@ -0,0 +1,60 @@
+#ifndef _CONTEXT_H_
+#define _CONTEXT_H_
+
+#include "../lsc.h"
+#include "../liblsc.h"
+#include "uring.h"
+#include "metadata.h"
+#include "idcache.h"
+#include "output.h"
+#include "arena.h"
+#include "vector.h"
+#include "timefmt.h"
+#include "stats.h"
+#include "index.h"
+
+struct process_kernel_t;
+struct print_kernel_t;
+struct subdir_file_t;
+
+// state reused by every directory listed through it, so that it is only allocated once per run
+// a context must only be used by one thread at a time, other threads get their own with contextFork
+typedef struct context_t {
+    options_t* options;
+    bool owner;        // created by contextCreate, frees the state shared with forked contexts
+    char* read_buffer; // options->read_buffer_size bytes, handed to the directory reader
+    output_t* out;     // where listings and per-entry errors are printed, stdout for the owner, in memory otherwise
+    uring_t* uring;    // for batched statx with --io-uring, NULL if disabled or unavailable
+    metadata_plan_t plan; // what processEntry has to statx for the options
+    const struct process_kernel_t* process_kernel; // processEntry compiled for the plan, see entries.c
+    const struct print_kernel_t* print_kernel;     // printEntry compiled for the options
+    time_cache_t times;   // dates printed by -l
+    stats_t* stats;       // counters for --stats, NULL if it isn't given
+
+    // scratch space reused by every directory, so that listing a tree doesn't touch the heap once warmed up
+    arena_t* names;         // entry names, link targets and per-listing arrays, reset for every directory
+    arena_t* paths;         // paths of subdirectories still to be listed, used as a stack with -R
+    vector_t* entry_vector; // names of the directory being listed
+    vector_t* subdir_vector; // paths of the subdirectories of the directory being listed, with -R
+    struct subdir_file_t* subdir_file; // where spilled directories put the names of their subdirectories instead
+                                       // (set by listDirectory with -R and --memory-budget), NULL otherwise
+    index_record_t index_record; // names of the directory being listed, for the next --index
+    char* listing_path;          // directory whose entries are being printed (NULL for the paths given), see recordDirectory
+    output_t* record_prefix;     // with --format, the start of the records of entries in listing_path, NULL otherwise
+    lsc_callback_t emit;         // with FORMAT_ENTRIES, gets every entry instead of it being printed (see liblsc.h)
+    void* emit_arg;
+    int error;                   // ENOMEM once anything failed to allocate, ECANCELED once emit asked to stop; sticky,
+                                 // the listing stops as soon as it is set (what was printed up to then stays)
+
+    // shared by all contexts forked from the same owner
+    idcache_t* ids;    // user / group names
+    id_memo_t id_memo; // last ids this context looked up in ids
+    index_t* index;    // --index, NULL if it isn't given
+} context_t;
+
+context_t* contextCreate(options_t* options, int fd);
+context_t* contextFork(context_t* parent);
+void contextPrintStats(context_t* context, FILE* out);
+void contextFree(context_t* context);
+
+#endif
@@ -0,0 +1,82 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h> // strlen / memcpy
+#include <errno.h>
+#include <unistd.h> // syscall
+#include <sys/syscall.h> // SYS_getdents64
+
+#include "dirreader.h"
+
+// layout of the records written by getdents64 (glibc doesn't export it)
+typedef struct linux_dirent64_t {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+} linux_dirent64_t;
+
+// prepare reader to read the directory open on fd using the caller's buffer
+// the buffer can be reused for the next directory once this one has been read
+// the reads are counted in stats, unless it's NULL
+void dirReaderInit(dir_reader_t* reader, int fd, char* buffer, size_t buffer_size, stats_t* stats) {
+    reader->fd = fd;
+    reader->buffer = buffer;
+    reader->buffer_size = buffer_size;
+    reader->position = 0;
+    reader->length = 0;
+    reader->error = 0;
+    reader->stats = stats;
+}
+
+// fill out entry with the next entry of the directory
+// returns false at the end of the directory or on error (reader->error is set)
+bool dirReaderNext(dir_reader_t* reader, dir_entry_t* entry) {
+    // refill the buffer once every record in it has been handed out
+    if(reader->position >= reader->length) {
+        uint64_t start = statsStart(reader->stats);
+        long read_res = syscall(SYS_getdents64, reader->fd, reader->buffer, reader->buffer_size);
+
+        statsStop(reader->stats, STATS_READ, start);
+        statsCall(reader->stats, STATS_GETDENTS, read_res == -1);
+
+        if(read_res == -1) {
+            reader->error = errno;
+            return false;
+        }
+
+        // end of the directory
+        if(read_res == 0) {
+            return false;
+        }
+
+        reader->position = 0;
+        reader->length = read_res;
+    }
+
+    linux_dirent64_t* record = (linux_dirent64_t*)&reader->buffer[reader->position];
+    reader->position += record->d_reclen;
+
+    entry->ino = record->d_ino;
+    entry->type = record->d_type;
+    entry->name = record->d_name;
+    entry->name_len = strlen(record->d_name);
+
+    return true;
+}
+
+// copy the entry's name and dirent data into the arena, returns the copied name (NULL if out of memory)
+char* dirNameCopy(arena_t* arena, dir_entry_t* entry) {
+    dir_name_t* dir_name = arenaAlloc(arena, sizeof(dir_name_t) + entry->name_len + 1);
+
+    if(!dir_name) {
+        return NULL;
+    }
+
+    dir_name->ino = entry->ino;
+    dir_name->type = entry->type;
+    memcpy(dir_name->name, entry->name, entry->name_len + 1);
+
+    return dir_name->name;
+}
@@ -0,0 +1,53 @@
+#ifndef _DIRREADER_H_
+#define _DIRREADER_H_
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <stddef.h> // offsetof
+#include "arena.h"
+#include "stats.h"
+
+// default size of the buffer handed to getdents64 (1 MiB), can be changed with --read-buffer
+#define DIR_READ_BUFFER_SIZE (1024 * 1024)
+
+// smallest buffer we accept, anything less may not fit a single entry
+#define DIR_READ_BUFFER_MIN 4096
+
+// one directory entry; name points into the reader's buffer and is only valid until the next read
+typedef struct dir_entry_t {
+    ino_t ino;
+    unsigned char type; // DT_* constant, DT_UNKNOWN if the filesystem doesn't report it
+    size_t name_len;
+    char* name;
+} dir_entry_t;
+
+// a name copied out of the read buffer together with its dirent data
+// the rest of the program only sees name, dirNameOf gets back to the whole struct
+typedef struct dir_name_t {
+    ino_t ino;
+    unsigned char type;
+    char name[];
+} dir_name_t;
+
+// reads the entries of an open directory in large batches with getdents64
+typedef struct dir_reader_t {
+    int fd;
+    char* buffer;
+    size_t buffer_size;
+    size_t position; // offset of the next unread record in buffer
+    size_t length;   // number of valid bytes in buffer
+    int error;       // errno of a failed read, 0 otherwise
+    stats_t* stats;  // where reads are counted and timed, NULL if not
+} dir_reader_t;
+
+void dirReaderInit(dir_reader_t* reader, int fd, char* buffer, size_t buffer_size, stats_t* stats);
+bool dirReaderNext(dir_reader_t* reader, dir_entry_t* entry);
+char* dirNameCopy(arena_t* arena, dir_entry_t* entry);
+
+// only valid for names returned by dirNameCopy
+static inline dir_name_t* dirNameOf(char* name) {
+    return (dir_name_t*)(name - offsetof(dir_name_t, name));
+}
+
+#endif
@@ -0,0 +1,998 @@
+// _DEFAULT_SOURCE needed for d_type
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h> // strcmp / strlen / memcpy
+#include <errno.h>
+#include <stddef.h> // offsetof
+#include <stdint.h>
+#include <pthread.h>
+#include <fcntl.h> // AT_FDCWD
+#include <unistd.h> // close
+#include <sys/stat.h>
+
+#include "../lsc.h"
+#include "du.h"
+#include "listing.h"
+#include "entries.h"
+#include "context.h"
+#include "dirreader.h"
+#include "workpool.h"
+#include "output.h"
+#include "utility.h"
+#include "vector.h"
+#include "arena.h"
+#include "sort.h"
+#include "stats.h"
+
+// initial number of slots of the table of hard linked inodes, grown once half full
+#define INITIAL_INODE_CAPACITY 1024
+
+// directories kept open (per thread) to open their subdirectories relative to, instead of by their full path
+#define MAX_PARENT_FDS 64
+
+// bytes the workers may hold for directories they scanned before they stop taking new ones, until the calling
+// thread catches up adding them up
+#define SCAN_BUDGET (1024 * 1024)
+
+// first number of frames on sumTree's stack, doubled when needed
+#define INITIAL_STACK_SIZE 64
+
+// what a directory tree adds up to
+typedef struct du_totals_t {
+    uint64_t size;   // apparent size in bytes
+    uint64_t blocks; // 512-byte blocks allocated
+    uint64_t files;  // entries other than directories
+} du_totals_t;
+
+// a file with more than one hard link, only counted the first time it is found
+typedef struct du_link_t {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    uint64_t blocks;
+} du_link_t;
+
+// one directory of the tree; scanned by a worker (or the calling thread), added up and freed by the calling thread
+typedef struct du_node_t {
+    struct du_t* du;
+    struct du_node_t* parent; // NULL for the top of the tree, its path is only made for output
+    uint64_t dev;       // device of the directory, and so of its hard linked files
+    uint64_t ino;
+    du_totals_t totals; // the directory itself and its entries, then its subdirectories once they are added up
+
+    // hard linked files, left out of totals until it is known whether they were found before
+    du_link_t* links;
+    size_t num_links;
+    size_t links_capacity;
+
+    // subdirectories in the order they are added up (and printed with -R), set before done
+    struct du_node_t** children;
+    size_t num_children;
+    size_t children_capacity;
+
+    // errors printed while a worker scanned the directory, NULL without workers (printed straight away)
+    char* output;
+    size_t output_len;
+
+    // protected by du->fd_lock; like a directory on walkTree's stack, the directory is kept open until it is
+    // added up, unless it was closed to stay within du->max_fds
+    int fd;               // -1 once closed (or if it was never kept)
+    size_t unopened;      // subdirectories not opened yet, it is opened again for them if it was closed
+    size_t fd_users;      // threads opening a subdirectory relative to fd, it isn't closed under them
+    struct du_node_t* fd_older; // the directories kept open, oldest first
+    struct du_node_t* fd_newer;
+
+    // protected by du->done_lock
+    size_t buffered; // bytes held for the node by its worker, counted in du->buffered until it is added up
+    bool queued;     // not taken by a worker yet (or waiting in scanNode), which frees the node if it is added up
+    bool claimed;    // being scanned, by a worker or by the calling thread
+    bool summed;     // added up and freed but for the node itself, left to the queued scanNode
+    bool done;
+    char name[];     // the path given for the top of the tree
+} du_node_t;
+
+// a directory being added up by sumTree, it stays on the stack until its subdirectories are added up
+typedef struct du_frame_t {
+    du_node_t* node;
+    size_t next; // index of the next subdirectory to add up
+} du_frame_t;
+
+// (dev, ino) of a hard linked file that was counted
+typedef struct du_inode_t {
+    uint64_t dev;
+    uint64_t ino;
+    bool used;
+} du_inode_t;
+
+// --du: the directories are scanned by the same directory reader and processEntry as listings, with options->threads
+// workers scanning subtrees at the same time; the calling thread adds them up depth first, which is also the order
+// a file with several hard links is counted in (in the first directory it is found in), so the totals don't
+// depend on the number of threads
+// like walkTree, subdirectories are opened relative to their parent's fd, so only the paths printed are ever made
+struct du_t {
+    context_t* context; // the caller's, the totals are printed to its output
+    workpool_t* pool;   // NULL with a single thread, directories are then scanned as they are added up
+    context_t** contexts; // one per worker
+
+    pthread_mutex_t done_lock;
+    pthread_cond_t done_cond;  // a node is done
+    pthread_cond_t space_cond; // nodes added up made room in the budget, or the calling thread waits on a new node
+    size_t buffered;     // bytes held for nodes scanned but not added up yet
+    du_node_t* waiting;  // the node the calling thread waits for, it is scanned even over the budget
+
+    // directories kept open, the oldest is closed first to make room
+    pthread_mutex_t fd_lock;
+    du_node_t* fd_oldest;
+    du_node_t* fd_newest;
+    size_t open_fds;
+    size_t max_fds;
+
+    // hard linked files counted so far, over all the paths given; only used by the calling thread
+    du_inode_t* inodes;
+    size_t num_inodes;
+    size_t inodes_capacity;
+};
+
+static du_node_t* nodeCreate(du_t* du, du_node_t* parent, char* name);
+static du_node_t* nodeOf(char* name);
+static char* nodePath(du_node_t* node, arena_t* arena);
+static void scanNode(void* arg, size_t worker);
+static void expandNode(du_node_t* node, context_t* context, size_t worker);
+static void scanDirectory(du_node_t* node, context_t* context);
+static void scanWindow(du_node_t* node, context_t* context, int dir_fd);
+static int openNode(du_node_t* node, context_t* context);
+static void keepOpen(du_node_t* node, int dir_fd);
+static void closeNode(du_t* du, du_node_t* node);
+static void reopenNode(du_t* du, du_node_t* node, du_node_t* child);
+static void sumTree(du_t* du, du_node_t* root);
+static void enterNode(du_t* du, du_node_t* node);
+static void nodeFree(du_t* du, du_node_t* node);
+static void addEntry(du_t* du, du_totals_t* totals, entry_info_t* entry_info, uint64_t dev);
+static bool inodeFirstSeen(du_t* du, uint64_t dev, uint64_t ino);
+static void printTotals(du_t* du, du_totals_t* totals, char* path);
+
+du_t* diskUsageCreate(context_t* context) {
+    options_t* options = context->options;
+    du_t* du = calloc(1, sizeof(du_t));
+
+    if(!du) {
+        printf("malloc() failed...exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    du->context = context;
+    du->inodes_capacity = INITIAL_INODE_CAPACITY;
+    du->inodes = calloc(du->inodes_capacity, sizeof(du_inode_t));
+
+    if(!du->inodes) {
+        printf("malloc() failed...exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_mutex_init(&du->done_lock, NULL);
+    pthread_cond_init(&du->done_cond, NULL);
+    pthread_cond_init(&du->space_cond, NULL);
+    pthread_mutex_init(&du->fd_lock, NULL);
+    du->max_fds = MAX_PARENT_FDS;
+
+    if(options->threads > 1) {
+        du->contexts = malloc(sizeof(context_t*) * options->threads);
+
+        if(!du->contexts) {
+            printf("malloc() failed...exiting\n");
+            exit(EXIT_FAILURE);
+        }
+
+        for(size_t i = 0; i < options->threads; i++) {
+            du->contexts[i] = contextFork(context);
+
+            if(!du->contexts[i]) {
+                printf("malloc() failed...exiting\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        du->pool = workpoolCreate(options->threads);
+        du->max_fds = MAX_PARENT_FDS * options->threads;
+    }
+
+    return du;
+}
+
+// print the totals of each of the given files (relative to cwd), in order
+void diskUsageFiles(du_t* du, vector_t* files) {
+    context_t* context = du->context;
+
+    if(files->length == 0) {
+        return;
+    }
+
+    entry_info_t* entry_infos = arenaAlloc(context->names, sizeof(entry_info_t) * files->length);
+
+    if(!entry_infos) {
+        printf("malloc() failed...exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    processEntries(context, entry_infos, files, -1);
+
+    for(size_t i = 0; i < files->length; i++) {
+        du_totals_t totals = { 0, 0, 0 };
+        struct stat stat_entry;
+
+        if(entry_infos[i].error != ENTRY_OK) {
+            printEntryError(&entry_infos[i], context);
+            continue;
+        }
+
+        // only needed for files with several hard links, which are all on the device of their directory
+        uint64_t dev = entry_infos[i].nlinks > 1 && lstat(files->items[i], &stat_entry) == 0 ? stat_entry.st_dev : 0;
+
+        addEntry(du, &totals, &entry_infos[i], dev);
+        printTotals(du, &totals, files->items[i]);
+    }
+
+    arenaReset(context->names);
+}
+
+// print the totals of the tree at path, and with -R of every directory in it (after their subdirectories, like du)
+void diskUsageDirectory(du_t* du, char* path) {
+    du_node_t* root = nodeCreate(du, NULL, path);
+    struct stat stat_entry;
+
+    // the size of every other directory comes from the entry in its parent
+    if(stat(path, &stat_entry) == 0) {
+        root->totals.size = stat_entry.st_size;
+        root->totals.blocks = stat_entry.st_blocks;
+    }
+
+    if(du->pool) {
+        workpoolSubmit(du->pool, 0, scanNode, root);
+    }
+
+    sumTree(du, root);
+}
+
+void diskUsageFree(du_t* du) {
+    context_t* context = du->context;
+
+    if(du->pool) {
+        workpoolFree(du->pool);
+
+        for(size_t i = 0; i < context->options->threads; i++) {
+            if(context->stats) {
+                statsAdd(context->stats, du->contexts[i]->stats);
+            }
+
+            arenaAddStats(context->names, du->contexts[i]->names);
+            arenaAddStats(context->paths, du->contexts[i]->paths);
+            contextFree(du->contexts[i]);
+        }
+
+        free(du->contexts);
+    }
+
+    pthread_mutex_destroy(&du->done_lock);
+    pthread_cond_destroy(&du->done_cond);
+    pthread_cond_destroy(&du->space_cond);
+    pthread_mutex_destroy(&du->fd_lock);
+    free(du->inodes);
+    free(du);
+}
+
+// create a node for the directory name within parent (or the path name if parent is NULL)
+static du_node_t* nodeCreate(du_t* du, du_node_t* parent, char* name) {
+    size_t name_len = strlen(name);
+    du_node_t* node = calloc(1, sizeof(du_node_t) + name_len + 1);
+
+    if(!node) {
+        printf("malloc() failed...exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    node->du = du;
+    node->parent = parent;
+    node->fd = -1;
+    node->queued = true;
+    memcpy(node->name, name, name_len + 1);
+
+    return node;
+}
+
+// the node a name returned by nodeCreate belongs to
+static du_node_t* nodeOf(char* name) {
+    return (du_node_t*)(name - offsetof(du_node_t, name));
+}
+
+// the full path of node, allocated from arena; its parents are all still there until it is added up
+static char* nodePath(du_node_t* node, arena_t* arena) {
+    size_t length = strlen(node->name);
+
+    // like joinPath, extra slashes at the end of the path given are cut off
+    for(du_node_t* parent = node->parent; parent; parent = parent->parent) {
+        size_t name_len = strlen(parent->name);
+
+        while(!parent->parent && name_len > 0 && parent->name[name_len - 1] == '/') {
+            name_len--;
+        }
+
+        length += name_len + 1;
+    }
+
+    char* path = arenaAlloc(arena, length + 1);
+
+    if(!path) {
+        printf("malloc() failed...exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // filled in from the end, the parents are only known going up
+    size_t end = length - strlen(node->name);
+
+    memcpy(&path[end], node->name, length - end + 1);
+
+    for(du_node_t* parent = node->parent; parent; parent = parent->parent) {
+        size_t name_len = parent->parent ? strlen(parent->name) : end - 1;
+
+        path[--end] = '/';
+        end -= name_len;
+        memcpy(&path[end], parent->name, name_len);
+    }
+
+    return path;
+}
+
+// worker task: scan one directory and queue up its subdirectories
+// while the calling thread is more than SCAN_BUDGET behind, the worker waits here (unless it holds the node the
+// calling thread waits for) and the calling thread may take the node over
+static void scanNode(void* arg, size_t worker) {
+    du_node_t* node = arg;
+    du_t* du = node->du;
+    context_t* context = du->contexts[worker];
+
+    pthread_mutex_lock(&du->done_lock);
+
+    while(!node->claimed && du->buffered > SCAN_BUDGET && du->waiting != node) {
+        pthread_cond_wait(&du->space_cond, &du->done_lock);
+    }
+
+    // the calling thread scanned it itself, and frees it if it isn't done with it yet
+    if(node->claimed) {
+        bool summed = node->summed;
+        node->queued = false;
+        pthread_mutex_unlock(&du->done_lock);
+
+        if(summed) {
+            free(node);
+        }
+
+        return;
+    }
+
+    node->claimed = true;
+    node->queued = false;
+    pthread_mutex_unlock(&du->done_lock);
+
+    expandNode(node, context, worker);
+
+    if(context->out->error != 0) {
+        printf("malloc() failed...exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // errors are kept until the calling thread gets to the directory
+    node->output = outputTake(context->out, &node->output_len);
+
+    pthread_mutex_lock(&du->done_lock);
+    node->buffered = node->output_len + node->num_links * sizeof(du_link_t) + node->num_children * sizeof(du_node_t);
+    node->done = true;
+    du->buffered += node->buffered;
+    pthread_cond_broadcast(&du->done_cond);
+    pthread_mutex_unlock(&du->done_lock);
+}
+
+// scan the directory of node into context and queue up its subdirectories on the deque of worker
+static void expandNode(du_node_t* node, context_t* context, size_t worker) {
+    du_t* du = node->du;
+
+    scanDirectory(node, context);
+    arenaReset(context->names);
+
+    if(!du->pool) {
+        return;
+    }
+
+    // pushed last to first so this worker carries on with the first child (the next one added up),
+    // while idle workers steal from the other end
+    for(size_t i = node->num_children; i > 0; i--) {
+        workpoolSubmit(du->pool, worker, scanNode, node->children[i - 1]);
+    }
+}
+
+// read and stat the entries of the directory of node, adding them up (except for hard linked files) and
+// creating the nodes of its subdirectories; errors are printed to context->out
+static void scanDirectory(du_node_t* node, context_t* context) {
+    options_t* options = context->options;
+    uint64_t start = statsStart(context->stats);
+    size_t num_entries = 0;
+
+    vector_t* entry_vector = context->entry_vector;
+    vectorClear(entry_vector);
+    arenaReset(context->names);
+
+    int dir_fd = openNode(node, context);
+
+    if(dir_fd == -1) {
+        return;
+    }
+
+    struct stat dir_stat;
+
+    if(fstat(dir_fd, &dir_stat) == 0) {
+        node->dev = dir_stat.st_dev;
+        node->ino = dir_stat.st_ino;
+    }
+
+    dir_reader_t reader;
+    dirReaderInit(&reader, dir_fd, context->read_buffer, options->read_buffer_size, context->stats);
+
+    // every entry counts towards the totals, hidden or not
+    for(dir_entry_t entry; dirReaderNext(&reader, &entry); ) {
+        if(entry.name[0] == '\0' || strcmp(entry.name, ".") == 0 || strcmp(entry.name, "..") == 0) {
+            continue;
+        }
+
+        char* name = dirNameCopy(context->names, &entry);
+
+        if(!name || !vectorPush(entry_vector, name)) {
+            printf("malloc() failed...exiting\n");
+            exit(EXIT_FAILURE);
+        }
+
+        num_entries++;
+
+        // only the totals are kept, so the names are processed a window at a time
+        if(entry_vector->length == STREAM_WINDOW_SIZE) {
+            scanWindow(node, context, dir_fd);
+        }
+    }
+
+    arena_mark_t mark = arenaMark(context->paths);
+
+    if(reader.error != 0) {
+        printError(context->out, "reading directory", nodePath(node, context->paths), reader.error);
+    }
+
+    scanWindow(node, context, dir_fd);
+
+    // subdirectories are added up (and printed with -R) in name order, unless -U
+    if(!options->unsorted && node->num_children > 1) {
+        char** names = arenaAlloc(context->names, sizeof(char*) * node->num_children);
+
+        if(!names) {
+            printf("malloc() failed...exiting\n");
+            exit(EXIT_FAILURE);
+        }
+
+        for(size_t i = 0; i < node->num_children; i++) {
+            names[i] = node->children[i]->name;
+        }
+
+        if(!sortNames(names, node->num_children, options->collate, context->names)) {
+            printf("malloc() failed...exiting\n");
+            exit(EXIT_FAILURE);
+        }
+
+        for(size_t i = 0; i < node->num_children; i++) {
+            node->children[i] = nodeOf(names[i]);
+        }
+    }
+
+    // the subdirectories are opened relative to it (and it from them, if it had to be closed)
+    node->unopened = node->num_children;
+    keepOpen(node, dir_fd);
+
+    // the path is only made for a directory the stats keep it of
+    if(context->stats) {
+        stats_t* stats = context->stats;
+        bool largest = num_entries > stats->largest_entries || !stats->largest_path;
+
+        statsDirectory(stats, largest ? nodePath(node, context->paths) : "", num_entries, start);
+    }
+
+    arenaRewind(context->paths, mark);
+}
+
+// stat the entries in context->entry_vector (within the directory of node, opened as dir_fd) and add them to
+// node, then release them
+static void scanWindow(du_node_t* node, context_t* context, int dir_fd) {
+    vector_t* entry_vector = context->entry_vector;
+    size_t count = entry_vector->length;
+
+    if(count == 0) {
+        return;
+    }
+
+    entry_info_t* entry_infos = arenaAlloc(context->names, sizeof(entry_info_t) * count);
+
+    if(!entry_infos) {
+        printf("malloc() failed...exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    processEntries(context, entry_infos, entry_vector, dir_fd);
+
+    for(size_t i = 0; i < count; i++) {
+        entry_info_t* entry_info = &entry_infos[i];
+
+        if(entry_info->error != ENTRY_OK) {
+            printEntryError(entry_info, context);
+        }
+        // a subdirectory counts its own size, so it is still there if it can't be opened
+        else if(S_ISDIR(entry_info->mode)) {
+            if(node->num_children == node->children_capacity) {
+                node->children_capacity = node->children_capacity ? node->children_capacity * 2 : 16;
+                node->children = realloc(node->children, sizeof(du_node_t*) * node->children_capacity);
+
+                if(!node->children) {
+                    printf("realloc() failed...exiting\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+
+            du_node_t* child = nodeCreate(node->du, node, entry_info->name);
+
+            child->totals.size = entry_info->size;
+            child->totals.blocks = entry_info->blocks;
+            node->children[node->num_children++] = child;
+        }
+        // whether it was counted before is only known once the directories found before this one are added up
+        else if(entry_info->nlinks > 1) {
+            if(node->num_links == node->links_capacity) {
+                node->links_capacity = node->links_capacity ? node->links_capacity * 2 : 16;
+                node->links = realloc(node->links, sizeof(du_link_t) * node->links_capacity);
+
+                if(!node->links) {
+                    printf("realloc() failed...exiting\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+
+            node->links[node->num_links++] = (du_link_t){
+                .dev = node->dev,
+                .ino = entry_info->ino,
+                .size = entry_info->size,
+                .blocks = entry_info->blocks,
+            };
+        }
+        else {
+            node->totals.size += entry_info->size;
+            node->totals.blocks += entry_info->blocks;
+            node->totals.files++;
+        }
+    }
+
+    vectorClear(entry_vector);
+    arenaReset(context->names);
+}
+
+// open the directory of node relative to its parent's fd, or by its full path if that was closed (the
+// path given for the top of the tree); prints an error and returns -1 if it can't be opened
+static int openNode(du_node_t* node, context_t* context) {
+    du_t* du = node->du;
+    du_node_t* parent = node->parent;
+
+    if(!parent) {
+        return openDirectory(context, AT_FDCWD, node->name, node->name);
+    }
+
+    int at_fd;
+
+    pthread_mutex_lock(&du->fd_lock);
+    at_fd = parent->fd;
+
+    if(at_fd != -1) {
+        parent->fd_users++;
+    }
+
+    pthread_mutex_unlock(&du->fd_lock);
+
+    int dir_fd = -1;
+    int error = 0;
+
+    if(at_fd != -1) {
+        dir_fd = openDirectory(context, at_fd, node->name, NULL);
+        error = errno;
+    }
+
+    pthread_mutex_lock(&du->fd_lock);
+
+    if(at_fd != -1) {
+        parent->fd_users--;
+    }
+
+    parent->unopened--;
+    pthread_mutex_unlock(&du->fd_lock);
+
+    if(at_fd != -1 && dir_fd != -1) {
+        return dir_fd;
+    }
+
+    arena_mark_t mark = arenaMark(context->paths);
+    char* path = nodePath(node, context->paths);
+
+    if(at_fd == -1) {
+        dir_fd = openDirectory(context, AT_FDCWD, path, path);
+    }
+    else {
+        printDirectoryError(context, "cannot open directory", path, error);
+    }
+
+    arenaRewind(context->paths, mark);
+
+    return dir_fd;
+}
+
+// keep the scanned directory of node open as dir_fd until it is added up, making room by closing the
+// directory kept open the longest, preferably one with no subdirectories left to open
+static void keepOpen(du_node_t* node, int dir_fd) {
+    du_t* du = node->du;
+
+    pthread_mutex_lock(&du->fd_lock);
+
+    if(du->open_fds == du->max_fds) {
+        du_node_t* oldest = NULL;
+
+        // rather one whose subdirectories are all opened, that is only kept to come back up from them
+        for(du_node_t* kept = du->fd_oldest; kept; kept = kept->fd_newer) {
+            if(kept->fd_users == 0 && (!oldest || (oldest->unopened > 0 && kept->unopened == 0))) {
+                oldest = kept;
+            }
+
+            if(oldest && oldest->unopened == 0) {
+                break;
+            }
+        }
+
+        if(oldest) {
+            closeNode(du, oldest);
+        }
+    }
+
+    // every fd kept is in use by a thread opening a subdirectory
+    if(du->open_fds == du->max_fds) {
+        pthread_mutex_unlock(&du->fd_lock);
+        close(dir_fd);
+        return;
+    }
+
+    node->fd = dir_fd;
+    node->fd_older = du->fd_newest;
+    node->fd_newer = NULL;
+
+    if(du->fd_newest) {
+        du->fd_newest->fd_newer = node;
+    }
+    else {
+        du->fd_oldest = node;
+    }
+
+    du->fd_newest = node;
+    du->open_fds++;
+    pthread_mutex_unlock(&du->fd_lock);
+}
+
+// close the directory of node and take it off the list of those kept open, called with du->fd_lock held
+static void closeNode(du_t* du, du_node_t* node) {
+    close(node->fd);
+    node->fd = -1;
+
+    if(node->fd_older) {
+        node->fd_older->fd_newer = node->fd_newer;
+    }
+    else {
+        du->fd_oldest = node->fd_newer;
+    }
+
+    if(node->fd_newer) {
+        node->fd_newer->fd_older = node->fd_older;
+    }
+    else {
+        du->fd_newest = node->fd_older;
+    }
+
+    du->open_fds--;
+}
+
+// coming back up from child, open the directory of node again if it was closed and still has subdirectories to
+// open, as the parent of child like walkTree does for long paths; it is left closed (and its subdirectories
+// opened by their full path) if that isn't the same directory any more
+static void reopenNode(du_t* du, du_node_t* node, du_node_t* child) {
+    pthread_mutex_lock(&du->fd_lock);
+
+    int child_fd = child->fd;
+    bool reopen = node->fd == -1 && node->unopened > 0 && child_fd != -1;
+
+    // workers making room mustn't close it meanwhile
+    if(reopen) {
+        child->fd_users++;
+    }
+
+    pthread_mutex_unlock(&du->fd_lock);
+
+    if(!reopen) {
+        return;
+    }
+
+    int dir_fd = openat(child_fd, "..", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    struct stat dir_stat;
+
+    pthread_mutex_lock(&du->fd_lock);
+    child->fd_users--;
+    pthread_mutex_unlock(&du->fd_lock);
+
+    if(dir_fd == -1) {
+        return;
+    }
+
+    if(fstat(dir_fd, &dir_stat) != 0 || dir_stat.st_dev != node->dev || dir_stat.st_ino != node->ino) {
+        close(dir_fd);
+        return;
+    }
+
+    keepOpen(node, dir_fd);
+}
+
+// add up the tree at root depth first, printing the totals of root (and with -R of every directory, after
+// those of its subdirectories) and freeing the nodes along the way
+// like printTree, the directories being added up are kept on an explicit stack
+static void sumTree(du_t* du, du_node_t* root) {
+    context_t* context = du->context;
+    size_t capacity = INITIAL_STACK_SIZE;
+    size_t depth = 0;
+    du_frame_t* stack = malloc(sizeof(du_frame_t) * capacity);
+
+    if(!stack) {
+        printf("malloc() failed...exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    enterNode(du, root);
+    stack[depth++] = (du_frame_t){ root, 0 };
+
+    while(depth > 0) {
+        du_frame_t* frame = &stack[depth - 1];
+        du_node_t* node = frame->node;
+
+        if(frame->next == node->num_children) {
+            depth--;
+
+            if(depth == 0 || context->options->recursive) {
+                arena_mark_t mark = arenaMark(context->paths);
+
+                printTotals(du, &node->totals, nodePath(node, context->paths));
+                arenaRewind(context->paths, mark);
+            }
+
+            if(depth > 0) {
+                du_totals_t* totals = &stack[depth - 1].node->totals;
+
+                reopenNode(du, stack[depth - 1].node, node);
+
+                totals->size += node->totals.size;
+                totals->blocks += node->totals.blocks;
+                totals->files += node->totals.files;
+            }
+
+            nodeFree(du, node);
+            continue;
+        }
+
+        du_node_t* child = node->children[frame->next++];
+
+        enterNode(du, child);
+
+        if(depth == capacity) {
+            capacity *= 2;
+            du_frame_t* grown = realloc(stack, sizeof(du_frame_t) * capacity);
+
+            if(!grown) {
+                printf("malloc() failed...exiting\n");
+                exit(EXIT_FAILURE);
+            }
+
+            stack = grown;
+        }
+
+        stack[depth++] = (du_frame_t){ child, 0 };
+    }
+
+    free(stack);
+}
+
+// wait for node to be scanned (or scan it without workers, or if the workers are over the budget and nobody
+// has started on it), then add up its hard linked files
+static void enterNode(du_t* du, du_node_t* node) {
+    context_t* context = du->context;
+    bool scan_here = !du->pool;
+
+    if(du->pool) {
+        pthread_mutex_lock(&du->done_lock);
+
+        // a worker holding this node can go ahead
+        du->waiting = node;
+        pthread_cond_broadcast(&du->space_cond);
+
+        while(!node->done) {
+            // the workers may all be waiting on other nodes while this one is still queued
+            if(!node->claimed && du->buffered > SCAN_BUDGET) {
+                node->claimed = true;
+                scan_here = true;
+                break;
+            }
+
+            pthread_cond_wait(&du->done_cond, &du->done_lock);
+        }
+
+        du->waiting = NULL;
+        pthread_mutex_unlock(&du->done_lock);
+    }
+
+    if(scan_here) {
+        expandNode(node, context, 0);
+    }
+    else {
+        outputWrite(context->out, node->output, node->output_len);
+        free(node->output);
+        node->output = NULL;
+
+        pthread_mutex_lock(&du->done_lock);
+        du->buffered -= node->buffered;
+
+        // waiting workers are woken once there is room for a few directories, not after every one
+        if(du->buffered <= SCAN_BUDGET / 2) {
+            pthread_cond_broadcast(&du->space_cond);
+        }
+
+        pthread_mutex_unlock(&du->done_lock);
+    }
+
+    for(size_t i = 0; i < node->num_links; i++) {
+        du_link_t* link = &node->links[i];
+
+        if(inodeFirstSeen(du, link->dev, link->ino)) {
+            node->totals.size += link->size;
+            node->totals.blocks += link->blocks;
+            node->totals.files++;
+        }
+    }
+
+    free(node->links);
+    node->links = NULL;
+}
+
+// free a node that was added up and its list of children, the node itself is left to scanNode if it is still queued
+static void nodeFree(du_t* du, du_node_t* node) {
+    free(node->children);
+
+    pthread_mutex_lock(&du->fd_lock);
+
+    if(node->fd != -1) {
+        closeNode(du, node);
+    }
+
+    pthread_mutex_unlock(&du->fd_lock);
+
+    if(!du->pool) {
+        free(node);
+        return;
+    }
+
+    pthread_mutex_lock(&du->done_lock);
+    bool queued = node->queued;
+    node->summed = true;
+
+    // a worker may be waiting on it
+    if(queued) {
+        pthread_cond_broadcast(&du->space_cond);
+    }
+
+    pthread_mutex_unlock(&du->done_lock);
+
+    if(!queued) {
+        free(node);
+    }
+}
+
+// add a file given as a path to totals, once if it has several hard links (on device dev)
+static void addEntry(du_t* du, du_totals_t* totals, entry_info_t* entry_info, uint64_t dev) {
+    if(!S_ISDIR(entry_info->mode) && entry_info->nlinks > 1 && !inodeFirstSeen(du, dev, entry_info->ino)) {
+        return;
+    }
+
+    totals->size += entry_info->size;
+    totals->blocks += entry_info->blocks;
+    totals->files += !S_ISDIR(entry_info->mode);
+}
+
+// whether the inode wasn't counted yet (it is from now on)
+static bool inodeFirstSeen(du_t* du, uint64_t dev, uint64_t ino) {
+    // grown once half full, the inodes are put back in their slots in the new table
+    if((du->num_inodes + 1) * 2 > du->inodes_capacity) {
+        du_inode_t* old = du->inodes;
+        size_t old_capacity = du->inodes_capacity;
+
+        du->inodes_capacity *= 2;
+        du->inodes = calloc(du->inodes_capacity, sizeof(du_inode_t));
+
+        if(!du->inodes) {
+            printf("malloc() failed...exiting\n");
+            exit(EXIT_FAILURE);
+        }
+
+        du->num_inodes = 0;
+
+        for(size_t i = 0; i < old_capacity; i++) {
+            if(old[i].used) {
+                inodeFirstSeen(du, old[i].dev, old[i].ino);
+            }
+        }
+
+        free(old);
+    }
+
+    // inode numbers are often close together, fibonacci hashing spreads them out
+    size_t mask = du->inodes_capacity - 1;
+    size_t index = ((ino ^ dev * 31) * 11400714819323198485ull) >> 32 & mask;
+
+    for(;; index = (index + 1) & mask) {
+        du_inode_t* inode = &du->inodes[index];
+
+        if(!inode->used) {
+            *inode = (du_inode_t){ .dev = dev, .ino = ino, .used = true };
+            du->num_inodes++;
+            return true;
+        }
+
+        if(inode->dev == dev && inode->ino == ino) {
+            return false;
+        }
+    }
+}
+
+// print a line of totals: allocated and apparent size (human readable with -h), number of files and path
+static void printTotals(du_t* du, du_totals_t* totals, char* path) {
+    context_t* context = du->context;
+    output_t* out = context->out;
+    char buffer[MAX_STR_SIZE];
+    size_t length;
+    uint64_t sizes[2] = { totals->blocks * 512, totals->size };
+
+    for(int i = 0; i < 2; i++) {
+        if(context->options->nice_size) {
+            length = getNiceSize(buffer, sizes[i]);
+        }
+        else {
+            length = formatUnsigned(buffer, sizes[i]);
+        }
+
+        outputWrite(out, buffer, length);
+        outputChar(out, '\t');
+    }
+
+    length = formatUnsigned(buffer, totals->files);
+    outputWrite(out, buffer, length);
+    outputChar(out, '\t');
+
+    size_t path_len;
+    char path_quotes = classifyName(path, &path_len);
+
+    printWithQuotes(out, path, path_len, path_quotes);
+    outputChar(out, '\n');
+    outputCheckpoint(out);
+}
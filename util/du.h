@@ -0,0 +1,15 @@
+#ifndef _DU_H_
+#define _DU_H_
+
+#include "../lsc.h"
+#include "context.h"
+#include "vector.h"
+
+typedef struct du_t du_t;
+
+du_t* diskUsageCreate(context_t* context);
+void diskUsageFiles(du_t* du, vector_t* files);
+void diskUsageDirectory(du_t* du, char* path);
+void diskUsageFree(du_t* du);
+
+#endif
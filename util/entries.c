@@ -1,94 +1,134 @@
+// _GNU_SOURCE needed for statx
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <stdlib.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h> // strerror
 #include <errno.h>
 #include <time.h>
-#include <pwd.h> // user
-#include <grp.h> // group
-#include <sys/stat.h> // lstat / fstatat
+#include <sys/stat.h> // statx
 #include <unistd.h> // readlink
 #include <fcntl.h> // AT_SYMLINK_NOFOLLOW
+#include <dirent.h> // DT_UNKNOWN
 
 #include "../lsc.h"
 #include "entries.h"
 #include "utility.h"
+#include "context.h"
+#include "dirreader.h"
+#include "metadata.h"
+#include "idcache.h"
+#include "output.h"
+#include "arena.h"
+#include "timefmt.h"
+#include "stats.h"
+#include "sort.h"
+#include "record.h"
+
+// the per-entry hot path is written once, as the static inline kernels below taking the options that change it
+// as const parameters; every combination of them that is listed often is compiled into its own variant
+// (see PROCESS_KERNEL / PRINT_KERNEL), with the branches on those options folded away, and a context picks
+// its variants once when it is created, so the loops over the entries of a listing never look at the options
+// anything else (records, --du, sort keys the columns don't need) goes through the variant taking the plan
+// as it is
+
+static void recordWidths(column_widths_t* column_widths, entry_info_t* entry_infos, size_t count, context_t* context);
+static void printRecord(column_widths_t* column_widths, entry_info_t* entry_info, context_t* context);
+static void printRecords(column_widths_t* column_widths, entry_info_t* entry_infos, size_t count, context_t* context);
+static unsigned maxWidth(unsigned a, unsigned b);
+static size_t formatBytes(int64_t size, char* buffer);
 
 // take a 'name' within an optional directory given by dir_fd (-1 if relative to cwd)
-// and fill out the entry_info struct based upon the user's specified options
-void processEntry(entry_info_t* entry_info, options_t* options, char* name, int dir_fd) {
-    struct stat stat_entry;
+// and fill out the entry_info struct with the fields of mask (the plan's), and the target of a symbolic link
+// if read_links; -i on its own (a mask of only STATX_INO) takes the inode number from the dirent data
+// names listed from dir_fd must have been copied with dirNameCopy, their dirent data saves a statx for -i
+// prefetched is the result of an earlier statx of the entry, or NULL to statx it here if needed
+// if the entry can't be listed, its error is recorded for printEntryError
+__attribute__((always_inline))
+static inline void processEntryWith(entry_info_t* entry_info, context_t* context, char* name, int dir_fd, struct statx* prefetched,
+                                    const unsigned int mask, const bool read_links) {
+    dir_name_t* dir_name = dir_fd != -1 ? dirNameOf(name) : NULL;
+    unsigned char d_type = dir_name ? dir_name->type : DT_UNKNOWN;
+    struct statx stat_entry;
+    size_t name_len;
 
-    // if we need it based upon the current options, grab the stat_entry for the file
-    if(options->index || options->long_list) {
-        int stat_res;
+    // NAME
+    entry_info->name = name;
+    entry_info->name_quotes = classifyName(name, &name_len);
+    entry_info->name_len = name_len;
 
-        if(dir_fd != -1) {
-            stat_res = fstatat(dir_fd, name, &stat_entry, AT_SYMLINK_NOFOLLOW);
-        }
-        else {
-            stat_res = lstat(name, &stat_entry);
-        }
+    if(prefetched) {
+        stat_entry = *prefetched;
+    }
+    // if we need it based upon the current options, grab the fields of the plan for the file
+    // (with -i on its own, only directories and entries of unknown type, see metadataNeedsStat)
+    else if(mask != 0 && (mask != STATX_INO || d_type == DT_UNKNOWN || d_type == DT_DIR)) {
+        int at_fd = dir_fd != -1 ? dir_fd : AT_FDCWD;
+
+        int stat_res = statx(at_fd, name, AT_SYMLINK_NOFOLLOW, mask, &stat_entry);
+
+        statsCall(context->stats, STATS_STATX, stat_res == -1);
 
         if(stat_res == -1) {
-            printf("lsc: cannot access '%s': %s\n", name, strerror(errno));
-            entry_info->error = true;
+            entry_info->error = ENTRY_ERROR_ACCESS;
+            entry_info->error_number = errno;
             return;
         }
     }
+    // only the inode number is needed, and readdir has it
+    else if(mask == STATX_INO) {
+        stat_entry.stx_ino = dir_name->ino;
+    }
 
-    if(options->index) {
+    if(mask & STATX_INO) {
         // INO
-        snprintf(entry_info->ino, MAX_STR_INO, "%lu", (unsigned long)stat_entry.st_ino);
+        entry_info->ino = stat_entry.stx_ino;
     }
 
-    if(options->long_list) {
-        // MODE
-        getModeString(entry_info->mode, stat_entry.st_mode);
+    // printed by -l, sorted by with -S / -t and added up by --du
+    if(mask & STATX_SIZE) {
+        entry_info->size = stat_entry.stx_size;
+    }
 
-        // NLINKS
-        snprintf(entry_info->nlinks, MAX_STR_NLINKS, "%u", (unsigned)stat_entry.st_nlink);
+    if(mask & STATX_MTIME) {
+        entry_info->mtime = stat_entry.stx_mtime.tv_sec;
+        entry_info->mtime_nsec = stat_entry.stx_mtime.tv_nsec;
+    }
 
-        // USER / GROUP
-        struct passwd* user = getpwuid(stat_entry.st_uid);
-        struct group* grp = getgrgid(stat_entry.st_gid);
+    if(mask & STATX_MODE) {
+        entry_info->mode = stat_entry.stx_mode;
+    }
 
-        if(user) {
-            snprintf(entry_info->user, MAX_STR_USER, "%s", user->pw_name);
-        }
-        else {
-            snprintf(entry_info->user, MAX_STR_USER, "%u", stat_entry.st_uid);
-        }
+    if(mask & STATX_NLINK) {
+        entry_info->nlinks = stat_entry.stx_nlink;
+    }
 
-        if(grp) {
-            snprintf(entry_info->group, MAX_STR_GROUP, "%s", grp->gr_name);
-        }
-        else {
-            snprintf(entry_info->group, MAX_STR_GROUP, "%u", stat_entry.st_gid);
-        }
+    if(mask & STATX_BLOCKS) {
+        entry_info->blocks = stat_entry.stx_blocks;
+    }
 
-        // SIZE
-        if(options->nice_size) {
-            getNiceSize(entry_info->size, stat_entry.st_size);
-        }
-        else {
-            snprintf(entry_info->size, MAX_STR_SIZE, "%ld", (long)stat_entry.st_size);
-        }
+    if(mask & STATX_UID) {
+        entry_info->uid = stat_entry.stx_uid;
+        entry_info->gid = stat_entry.stx_gid;
+    }
 
-        // DATE / TIME:  mmm dd yyyy hh:mm
-        strftime(entry_info->time, MAX_STR_TIME, "%b %e %Y %H:%M", localtime(&stat_entry.st_mtime));
+    if(read_links) {
+        // if its a link, in long mode format (and in records) we show the path where it's pointing
+        // it lives in the names arena along with the entry's name
+        if(S_ISLNK(stat_entry.stx_mode)) {
+            char* buffer = arenaAlloc(context->names, MAX_STR_PATH);
+            ssize_t link_res;
 
-        // if its a link, in long mode format we show the path where it's pointing
-        // malloc here is freed when it is printed
-        if(S_ISLNK(stat_entry.st_mode)) {
-            char* buffer = malloc(sizeof(char) * MAX_STR_PATH);
+            // reported like a link that can't be read
             if(!buffer) {
-                printf("malloc() failed...exiting\n");
-                exit(EXIT_FAILURE);
+                entry_info->error = ENTRY_ERROR_LINK;
+                entry_info->error_number = ENOMEM;
+                return;
             }
 
-            ssize_t link_res;
-
             if(dir_fd != -1) {
                 link_res = readlinkat(dir_fd, name, buffer, MAX_STR_PATH - 1);
             }
@@ -96,14 +136,17 @@ void processEntry(entry_info_t* entry_info, options_t* options, char* name, int
                 link_res = readlink(name, buffer, MAX_STR_PATH - 1);
             }
 
+            statsCall(context->stats, STATS_READLINK, link_res == -1);
+
             if(link_res == -1) {
-                printf("lsc: cannot read symbolic link '%s': %s\n", name, strerror(errno));
-                entry_info->error = true;
-                free(buffer);
+                entry_info->error = ENTRY_ERROR_LINK;
+                entry_info->error_number = errno;
+                arenaTrim(context->names, buffer, MAX_STR_PATH, 0);
                 return;
             }
 
             buffer[link_res] = '\0';
+            arenaTrim(context->names, buffer, MAX_STR_PATH, link_res + 1);
 
             entry_info->path = buffer;
         }
@@ -112,48 +155,334 @@ void processEntry(entry_info_t* entry_info, options_t* options, char* name, int
         }
     }
 
-    // NAME
-    entry_info->name = name;
-    entry_info->name_quotes = stringNeedsQuotes(name);
+    entry_info->error = ENTRY_OK;
+}
+
+// get the column widths based upon the max length of the data in each column, for the columns of -i, -l and -h
+// numbers are measured by their digit count, nothing is formatted except -h sizes
+__attribute__((always_inline))
+static inline void columnWidthsWith(column_widths_t* column_widths, entry_info_t* entry_infos, size_t num_entries, context_t* context,
+                                    const bool index, const bool long_list, const bool nice_size) {
+    char buffer[MAX_STR_SIZE];
+    const char* str;
+
+    // zero out the lengths initially
+    memset(column_widths, 0, sizeof(column_widths_t));
+
+    for(size_t i = 0; i < num_entries; i++) {
+        entry_info_t* entry_info = &entry_infos[i];
+
+        if(entry_info->error) {
+            continue;
+        }
+
+        if(index) {
+            column_widths->ino = maxWidth(column_widths->ino, digitCount(entry_info->ino));
+        }
 
-    entry_info->error = false;
+        if(long_list) {
+            column_widths->nlinks = maxWidth(column_widths->nlinks, digitCount(entry_info->nlinks));
+            column_widths->user = maxWidth(column_widths->user, formatUser(context, entry_info, buffer, &str));
+            column_widths->group = maxWidth(column_widths->group, formatGroup(context, entry_info, buffer, &str));
+
+            if(nice_size) {
+                column_widths->size = maxWidth(column_widths->size, getNiceSize(buffer, entry_info->size));
+            }
+            else {
+                column_widths->size = maxWidth(column_widths->size, digitCount(entry_info->size) + (entry_info->size < 0));
+            }
+
+            // with the -l option, file names are lined up if one of them has quotes
+            column_widths->name_needs_space |= entry_info->name_quotes != QUOTE_NONE;
+        }
+    }
 }
 
-// print the entry based upon the proper column widths and current options
-void printEntry(column_widths_t* column_widths, entry_info_t* entry_info, options_t* options) {
+// print the entry based upon the proper column widths and the columns of -i, -l and -h
+__attribute__((always_inline))
+static inline void printEntryWith(column_widths_t* column_widths, entry_info_t* entry_info, context_t* context,
+                                  const bool index, const bool long_list, const bool nice_size) {
+    output_t* out = context->out;
+
     if(entry_info->error) {
         return;
     }
 
-    if(options->index) {
-        printf("%*s ", column_widths->ino, entry_info->ino);
+    if(index) {
+        outputUnsigned(out, entry_info->ino, column_widths->ino);
+        outputChar(out, ' ');
     }
 
-    if(options->long_list) {
-        printf("%s ", entry_info->mode); // mode is fixed width
-        printf("%*s ", column_widths->nlinks,   entry_info->nlinks);
-        printf("%-*s ", column_widths->user,    entry_info->user);
-        printf("%-*s ", column_widths->group,   entry_info->group);
-        printf("%*s ", column_widths->size,     entry_info->size);
-        printf("%s ", entry_info->time); // time is fixed width
+    if(long_list) {
+        char buffer[MAX_STR_PATH];
+        const char* str;
+        size_t length;
+
+        // MODE (fixed width)
+        getModeString(buffer, entry_info->mode);
+        outputWrite(out, buffer, MAX_STR_MODE - 1);
+        outputChar(out, ' ');
+
+        // NLINKS
+        outputUnsigned(out, entry_info->nlinks, column_widths->nlinks);
+        outputChar(out, ' ');
+
+        // USER / GROUP
+        length = formatUser(context, entry_info, buffer, &str);
+        outputPadded(out, str, length, column_widths->user, true);
+        outputChar(out, ' ');
+
+        length = formatGroup(context, entry_info, buffer, &str);
+        outputPadded(out, str, length, column_widths->group, true);
+        outputChar(out, ' ');
+
+        // SIZE
+        length = nice_size ? getNiceSize(buffer, entry_info->size) : formatBytes(entry_info->size, buffer);
+        outputPadded(out, buffer, length, column_widths->size, false);
+        outputChar(out, ' ');
+
+        // DATE / TIME:  mmm dd yyyy hh:mm
+        length = timefmtFormat(&context->times, entry_info->mtime, buffer);
+        outputWrite(out, buffer, length);
+        outputChar(out, ' ');
     }
 
     // NAME
     if(!entry_info->name_quotes && column_widths->name_needs_space) {
         // line this name up if required (-l option and other file with quotes)
-        printf(" %s", entry_info->name);
+        outputChar(out, ' ');
+        outputWrite(out, entry_info->name, entry_info->name_len);
     }
     else {
-        printWithQuotes(entry_info->name, entry_info->name_quotes);
+        printWithQuotes(out, entry_info->name, entry_info->name_len, entry_info->name_quotes);
     }
 
     // if this is a symlink, we'll print the path where it points
-    // then free the malloc-ed memory. in C, we take out the garbage ourselves :)
-    if(options->long_list && entry_info->path != NULL) {
-        printf(" -> ");
-        printWithQuotes(entry_info->path, stringNeedsQuotes(entry_info->path));
-        free(entry_info->path);
+    if(long_list && entry_info->path != NULL) {
+        size_t path_len;
+        char path_quotes = classifyName(entry_info->path, &path_len);
+
+        outputWrite(out, " -> ", 4);
+        printWithQuotes(out, entry_info->path, path_len, path_quotes);
+    }
+
+    outputChar(out, '\n');
+}
+
+// defines kernel, a process_kernel_t for a constant mask and read_links, with its functions named prefix...
+#define PROCESS_KERNEL(kernel, prefix, mask, read_links) \
+    static void prefix##Entry(entry_info_t* entry_info, context_t* context, char* name, int dir_fd, struct statx* prefetched) { \
+        processEntryWith(entry_info, context, name, dir_fd, prefetched, mask, read_links); \
+    } \
+    static void prefix##Entries(entry_info_t* entry_infos, context_t* context, char** names, size_t count, int dir_fd) { \
+        for(size_t i = 0; i < count; i++) { \
+            processEntryWith(&entry_infos[i], context, names[i], dir_fd, NULL, mask, read_links); \
+        } \
+    } \
+    static const process_kernel_t kernel = { prefix##Entry, prefix##Entries };
+
+// defines kernel, a print_kernel_t for the text columns of constant index, long_list and nice_size options
+#define PRINT_KERNEL(kernel, prefix, index, long_list, nice_size) \
+    static void prefix##Widths(column_widths_t* column_widths, entry_info_t* entry_infos, size_t count, context_t* context) { \
+        columnWidthsWith(column_widths, entry_infos, count, context, index, long_list, nice_size); \
+    } \
+    static void prefix##Entry(column_widths_t* column_widths, entry_info_t* entry_info, context_t* context) { \
+        printEntryWith(column_widths, entry_info, context, index, long_list, nice_size); \
+    } \
+    static void prefix##Entries(column_widths_t* column_widths, entry_info_t* entry_infos, size_t count, context_t* context) { \
+        for(size_t i = 0; i < count; i++) { \
+            printEntryWith(column_widths, &entry_infos[i], context, index, long_list, nice_size); \
+        } \
+    } \
+    static const print_kernel_t kernel = { prefix##Widths, prefix##Entry, prefix##Entries };
+
+// names only, -i, -l and -li (the sort keys of -S and -t are part of the -l mask), and anything else
+PROCESS_KERNEL(PROCESS_NAMES, processNames, 0, false)
+PROCESS_KERNEL(PROCESS_INODES, processInodes, STATX_INO, false)
+PROCESS_KERNEL(PROCESS_LONG, processLong, METADATA_LONG_MASK, true)
+PROCESS_KERNEL(PROCESS_LONG_INODES, processLongInodes, METADATA_LONG_MASK | STATX_INO, true)
+PROCESS_KERNEL(PROCESS_PLAN, processPlan, context->plan.mask, context->plan.read_links)
+
+// names only, -i, -l, -lh, -li and -lih (-h only changes the -l columns)
+PRINT_KERNEL(PRINT_NAMES, printNames, false, false, false)
+PRINT_KERNEL(PRINT_INODES, printInodes, true, false, false)
+PRINT_KERNEL(PRINT_LONG, printLong, false, true, false)
+PRINT_KERNEL(PRINT_LONG_NICE, printLongNice, false, true, true)
+PRINT_KERNEL(PRINT_LONG_INODES, printLongInodes, true, true, false)
+PRINT_KERNEL(PRINT_LONG_INODES_NICE, printLongInodesNice, true, true, true)
+
+// records have every field whatever the options, and no columns to line up
+static const print_kernel_t PRINT_RECORDS = { recordWidths, printRecord, printRecords };
+
+// the variant of processEntry for a plan
+const process_kernel_t* processKernel(metadata_plan_t* plan) {
+    if(plan->mask == 0 && !plan->read_links) {
+        return &PROCESS_NAMES;
+    }
+
+    if(plan->mask == STATX_INO && !plan->read_links) {
+        return &PROCESS_INODES;
+    }
+
+    if(plan->mask == METADATA_LONG_MASK && plan->read_links) {
+        return &PROCESS_LONG;
+    }
+
+    if(plan->mask == (METADATA_LONG_MASK | STATX_INO) && plan->read_links) {
+        return &PROCESS_LONG_INODES;
+    }
+
+    return &PROCESS_PLAN;
+}
+
+// the variant of printEntry / getColumnWidths for the options
+const print_kernel_t* printKernel(options_t* options) {
+    if(options->format != FORMAT_TEXT) {
+        return &PRINT_RECORDS;
+    }
+
+    if(!options->long_list) {
+        return options->index ? &PRINT_INODES : &PRINT_NAMES;
+    }
+
+    if(options->index) {
+        return options->nice_size ? &PRINT_LONG_INODES_NICE : &PRINT_LONG_INODES;
+    }
+
+    return options->nice_size ? &PRINT_LONG_NICE : &PRINT_LONG;
+}
+
+// take a 'name' within an optional directory given by dir_fd (-1 if relative to cwd)
+// and fill out the entry_info struct based upon the user's specified options
+// names listed from dir_fd must have been copied with dirNameCopy, their dirent data saves a statx for -i
+// prefetched is the result of an earlier statx of the entry, or NULL to statx it here if needed
+// if the entry can't be listed, its error is recorded for printEntryError
+void processEntry(entry_info_t* entry_info, context_t* context, char* name, int dir_fd, struct statx* prefetched) {
+    context->process_kernel->entry(entry_info, context, name, dir_fd, prefetched);
+}
+
+// get the column widths based upon the max length of the data in each column
+void getColumnWidths(column_widths_t* column_widths, entry_info_t* entry_infos, size_t num_entries, context_t* context) {
+    context->print_kernel->widths(column_widths, entry_infos, num_entries, context);
+}
+
+// how two entries are ordered by -S / -t (their names breaking ties) and -r
+// negative if a is listed before b, positive if after
+int entryCompare(options_t* options, entry_info_t* a, entry_info_t* b) {
+    int result;
+
+    if(options->sort_by == SORT_SIZE && a->size != b->size) {
+        result = a->size > b->size ? -1 : 1;
+    }
+    else if(options->sort_by == SORT_TIME && a->mtime != b->mtime) {
+        result = a->mtime > b->mtime ? -1 : 1;
+    }
+    else if(options->sort_by == SORT_TIME && a->mtime_nsec != b->mtime_nsec) {
+        result = a->mtime_nsec > b->mtime_nsec ? -1 : 1;
+    }
+    else {
+        result = sortCompare(a->name, b->name, options->collate);
+    }
+
+    return options->reverse ? -result : result;
+}
+
+// print why the entry couldn't be listed, if it couldn't
+void printEntryError(entry_info_t* entry_info, context_t* context) {
+    const char* what;
+
+    switch(entry_info->error) {
+        case ENTRY_ERROR_ACCESS:
+            what = "cannot access";
+            break;
+        case ENTRY_ERROR_LINK:
+            what = "cannot read symbolic link";
+            break;
+        default:
+            return;
     }
 
-    printf("\n");
-}
\ No newline at end of file
+    if(context->options->format != FORMAT_TEXT) {
+        recordError(context, context->listing_path ? context->listing_path : "", entry_info->name, what, entry_info->error_number);
+        return;
+    }
+
+    printError(context->out, what, entry_info->name, entry_info->error_number);
+}
+
+// print the entry based upon the proper column widths and current options
+void printEntry(column_widths_t* column_widths, entry_info_t* entry_info, context_t* context) {
+    context->print_kernel->entry(column_widths, entry_info, context);
+}
+
+// print count entries (those that can't be listed are skipped, see printEntryError) in the columns of column_widths
+void printEntryList(column_widths_t* column_widths, entry_info_t* entry_infos, size_t count, context_t* context) {
+    context->print_kernel->entries(column_widths, entry_infos, count, context);
+}
+
+// the user column of an entry: points str at the user name, or formats the uid into buffer if it has none
+// returns the length of the column (names are cut at MAX_STR_USER - 1 characters)
+size_t formatUser(context_t* context, entry_info_t* entry_info, char* buffer, const char** str) {
+    uint64_t start = statsStart(context->stats);
+    const char* user = idmemoUser(&context->id_memo, context->ids, context->stats, entry_info->uid);
+
+    statsStop(context->stats, STATS_IDS, start);
+
+    if(!user) {
+        *str = buffer;
+        return formatUnsigned(buffer, entry_info->uid);
+    }
+
+    *str = user;
+    return strnlen(user, MAX_STR_USER - 1);
+}
+
+// the group column of an entry, see formatUser
+size_t formatGroup(context_t* context, entry_info_t* entry_info, char* buffer, const char** str) {
+    uint64_t start = statsStart(context->stats);
+    const char* grp = idmemoGroup(&context->id_memo, context->ids, context->stats, entry_info->gid);
+
+    statsStop(context->stats, STATS_IDS, start);
+
+    if(!grp) {
+        *str = buffer;
+        return formatUnsigned(buffer, entry_info->gid);
+    }
+
+    *str = grp;
+    return strnlen(grp, MAX_STR_GROUP - 1);
+}
+
+static void recordWidths(column_widths_t* column_widths, entry_info_t* entry_infos, size_t count, context_t* context) {
+    memset(column_widths, 0, sizeof(column_widths_t));
+}
+
+static void printRecord(column_widths_t* column_widths, entry_info_t* entry_info, context_t* context) {
+    if(entry_info->error) {
+        return;
+    }
+
+    recordEntry(context, entry_info);
+}
+
+// stops early once context->error is set (e.g. the library's callback asked to)
+static void printRecords(column_widths_t* column_widths, entry_info_t* entry_infos, size_t count, context_t* context) {
+    for(size_t i = 0; i < count && context->error == 0; i++) {
+        printRecord(column_widths, &entry_infos[i], context);
+    }
+}
+
+// return the maximum of a, b (used for the column widths)
+static unsigned maxWidth(unsigned a, unsigned b) {
+    return a > b ? a : b;
+}
+
+// format the size column of -l without -h into buffer (at least MAX_STR_SIZE bytes), returns its length
+static size_t formatBytes(int64_t size, char* buffer) {
+    if(size < 0) {
+        buffer[0] = '-';
+        return formatUnsigned(&buffer[1], -(uint64_t)size) + 1;
+    }
+
+    return formatUnsigned(buffer, size);
+}
@@ -2,12 +2,21 @@
 #define _ENTRIES_H_
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <sys/stat.h>
 #include "../lsc.h"
+#include "context.h"
+#include "metadata.h"
 
 #define QUOTE_NONE 0
 #define QUOTE_SINGLE 1
 #define QUOTE_DOUBLE 2
 
+// what went wrong with an entry that can't be listed
+#define ENTRY_OK 0
+#define ENTRY_ERROR_ACCESS 1 // statx failed
+#define ENTRY_ERROR_LINK 2   // readlink failed
+
 // max string sizes (including \0)
 #define MAX_STR_INO 21
 #define MAX_STR_MODE 11
@@ -19,18 +28,23 @@
 #define MAX_STR_PATH 4097
 
 // one entry struct will be filled per file / directory
+// only the raw metadata is kept, the columns are formatted when the entry is printed
 typedef struct entry_info_t {
-    bool error;
-    char ino[MAX_STR_INO];
-    char mode[MAX_STR_MODE];
-    char nlinks[MAX_STR_NLINKS];
-    char user[MAX_STR_USER];
-    char group[MAX_STR_GROUP];
-    char size[MAX_STR_SIZE];
-    char time[MAX_STR_TIME];
+    uint64_t ino;
+    int64_t size;
+    int64_t mtime;
+    uint64_t blocks; // 512-byte blocks allocated, only used by --du
+    uint32_t nlinks;
+    uint32_t uid;
+    uint32_t gid;
+    uint32_t name_len;
+    uint32_t mtime_nsec; // only used to sort by time (-t)
     char* name;
+    char* path; // for symlinks, allocated from the names arena
+    int error_number; // errno of the call that failed
+    uint16_t mode; // file type and permission bits
+    char error; // either ENTRY_OK or ENTRY_ERROR_*
     char name_quotes; // either QUOTE_NONE, QUOTE_SINGLE, QUOTE_DOUBLE
-    char* path; // for symlinks, big so will malloc if needed
 } entry_info_t;
 
 // columns that are variable width
@@ -43,7 +57,31 @@ typedef struct column_widths_t {
     bool name_needs_space; // fix spacing if one of the file names will be wrapped in quotes
 } column_widths_t;
 
-void processEntry(entry_info_t* entry_info, options_t* options, char* name, int dir_fd);
-void printEntry(column_widths_t* column_widths, entry_info_t* entry_info, options_t* options);
+// processEntry compiled for one combination of the options it depends on (see entries.c), a context picks
+// one with processKernel when it is created; entries processes count names into entry_infos
+typedef struct process_kernel_t {
+    void (*entry)(entry_info_t* entry_info, context_t* context, char* name, int dir_fd, struct statx* prefetched);
+    void (*entries)(entry_info_t* entry_infos, context_t* context, char** names, size_t count, int dir_fd);
+} process_kernel_t;
+
+// getColumnWidths / printEntry / printEntryList compiled for one combination of the options they depend on,
+// picked with printKernel
+typedef struct print_kernel_t {
+    void (*widths)(column_widths_t* column_widths, entry_info_t* entry_infos, size_t count, context_t* context);
+    void (*entry)(column_widths_t* column_widths, entry_info_t* entry_info, context_t* context);
+    void (*entries)(column_widths_t* column_widths, entry_info_t* entry_infos, size_t count, context_t* context);
+} print_kernel_t;
+
+const process_kernel_t* processKernel(metadata_plan_t* plan);
+const print_kernel_t* printKernel(options_t* options);
+
+void processEntry(entry_info_t* entry_info, context_t* context, char* name, int dir_fd, struct statx* prefetched);
+void getColumnWidths(column_widths_t* column_widths, entry_info_t* entry_infos, size_t num_entries, context_t* context);
+void printEntry(column_widths_t* column_widths, entry_info_t* entry_info, context_t* context);
+void printEntryList(column_widths_t* column_widths, entry_info_t* entry_infos, size_t count, context_t* context);
+int entryCompare(options_t* options, entry_info_t* a, entry_info_t* b);
+void printEntryError(entry_info_t* entry_info, context_t* context);
+size_t formatUser(context_t* context, entry_info_t* entry_info, char* buffer, const char** str);
+size_t formatGroup(context_t* context, entry_info_t* entry_info, char* buffer, const char** str);
 
 #endif
\ No newline at end of file
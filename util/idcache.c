@@ -0,0 +1,347 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h> // strdup
+#include <errno.h>
+#include <unistd.h> // sysconf
+#include <pwd.h>
+#include <grp.h>
+#include <pthread.h>
+
+#include "idcache.h"
+
+// initial number of slots in each table, grown once half full
+static const size_t INITIAL_CAPACITY = 64;
+
+// first size of the scratch buffer used by getpwuid_r / getgrgid_r if sysconf doesn't suggest one,
+// doubled while it is too small
+#define ID_BUFFER_SIZE 4096
+
+// the buffer isn't grown past this (a group with a huge member list)
+#define ID_BUFFER_MAX (64 * 1024 * 1024)
+
+static char* lookupUser(uid_t uid, bool* answered);
+static char* lookupGroup(gid_t gid, bool* answered);
+static size_t bufferSize(int name);
+static bool tableInit(id_table_t* table);
+static id_entry_t* tableFind(id_table_t* table, uint32_t id, bool* found);
+static id_entry_t* tableInsert(id_table_t* table, uint32_t id, const char* name);
+static void tableFree(id_table_t* table);
+
+// creates an empty cache, NULL if out of memory
+idcache_t* idcacheCreate() {
+    idcache_t* cache = malloc(sizeof(idcache_t));
+
+    if(!cache) {
+        return NULL;
+    }
+
+    if(!tableInit(&cache->users)) {
+        free(cache);
+        return NULL;
+    }
+
+    if(!tableInit(&cache->groups)) {
+        tableFree(&cache->users);
+        free(cache);
+        return NULL;
+    }
+
+    pthread_mutex_init(&cache->lock, NULL);
+    cache->hits = 0;
+    cache->misses = 0;
+
+    return cache;
+}
+
+// fill the cache with every user and group in one pass over the databases, instead of one
+// lookup per id (those that don't fit in memory are looked up later); not thread safe, call it
+// before the cache is shared
+void idcachePreload(idcache_t* cache) {
+    setpwent();
+
+    for(struct passwd* user = getpwent(); user != NULL; user = getpwent()) {
+        bool found;
+        tableFind(&cache->users, user->pw_uid, &found);
+
+        // like getpwuid, the first entry for an id wins
+        if(!found) {
+            tableInsert(&cache->users, user->pw_uid, user->pw_name);
+        }
+    }
+
+    endpwent();
+    setgrent();
+
+    for(struct group* grp = getgrent(); grp != NULL; grp = getgrent()) {
+        bool found;
+        tableFind(&cache->groups, grp->gr_gid, &found);
+
+        if(!found) {
+            tableInsert(&cache->groups, grp->gr_gid, grp->gr_name);
+        }
+    }
+
+    endgrent();
+}
+
+// name of the user with the given uid, NULL if there is none (or it couldn't be looked up or cached)
+// the string stays valid until the cache is freed; cached is set to whether the answer is in the cache
+const char* idcacheUser(idcache_t* cache, uid_t uid, bool* cached) {
+    pthread_mutex_lock(&cache->lock);
+
+    bool found;
+    id_entry_t* entry = tableFind(&cache->users, uid, &found);
+
+    if(found) {
+        cache->hits++;
+    }
+    else {
+        bool answered;
+        char* user = lookupUser(uid, &answered);
+
+        // ids without a user are cached too, so they aren't looked up again, but not those that
+        // couldn't be looked up (e.g. the user database couldn't be read)
+        entry = answered ? tableInsert(&cache->users, uid, user) : NULL;
+        cache->misses++;
+        free(user);
+    }
+
+    const char* name = entry ? entry->name : NULL;
+    *cached = entry != NULL;
+    pthread_mutex_unlock(&cache->lock);
+    return name;
+}
+
+// name of the group with the given gid, see idcacheUser
+const char* idcacheGroup(idcache_t* cache, gid_t gid, bool* cached) {
+    pthread_mutex_lock(&cache->lock);
+
+    bool found;
+    id_entry_t* entry = tableFind(&cache->groups, gid, &found);
+
+    if(found) {
+        cache->hits++;
+    }
+    else {
+        bool answered;
+        char* grp = lookupGroup(gid, &answered);
+
+        entry = answered ? tableInsert(&cache->groups, gid, grp) : NULL;
+        cache->misses++;
+        free(grp);
+    }
+
+    const char* name = entry ? entry->name : NULL;
+    *cached = entry != NULL;
+    pthread_mutex_unlock(&cache->lock);
+    return name;
+}
+
+// idcacheUser going through memo first, memo must be zeroed before its first use
+// answers from the memo are counted in stats (if not NULL), only those that are in the cache are kept there
+const char* idmemoUser(id_memo_t* memo, idcache_t* cache, stats_t* stats, uid_t uid) {
+    if(memo->has_user && memo->uid == uid) {
+        if(stats) {
+            stats->id_memo_hits++;
+        }
+
+        return memo->user;
+    }
+
+    bool cached;
+    const char* user = idcacheUser(cache, uid, &cached);
+
+    memo->user = user;
+    memo->uid = uid;
+    memo->has_user = cached;
+
+    return user;
+}
+
+// idcacheGroup going through memo first, see idmemoUser
+const char* idmemoGroup(id_memo_t* memo, idcache_t* cache, stats_t* stats, gid_t gid) {
+    if(memo->has_group && memo->gid == gid) {
+        if(stats) {
+            stats->id_memo_hits++;
+        }
+
+        return memo->group;
+    }
+
+    bool cached;
+    const char* grp = idcacheGroup(cache, gid, &cached);
+
+    memo->group = grp;
+    memo->gid = gid;
+    memo->has_group = cached;
+
+    return grp;
+}
+
+// print the hit / miss counts (for --stats), memo_hits being those answered by the contexts' memos
+void idcachePrintStats(idcache_t* cache, uint64_t memo_hits, FILE* out) {
+    pthread_mutex_lock(&cache->lock);
+
+    fprintf(out, "id cache: %llu hits (%llu by the last id looked up), %zu misses, %zu users, %zu groups\n",
+        (unsigned long long)(cache->hits + memo_hits), (unsigned long long)memo_hits, cache->misses,
+        cache->users.length, cache->groups.length);
+
+    pthread_mutex_unlock(&cache->lock);
+}
+
+// free the cache and every name in it
+void idcacheFree(idcache_t* cache) {
+    tableFree(&cache->users);
+    tableFree(&cache->groups);
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+// look up the name of a user, returns a malloc-ed copy of it, or NULL if there is no such user
+// answered is set to false if it couldn't be looked up (an error reading the database, or out of memory)
+static char* lookupUser(uid_t uid, bool* answered) {
+    struct passwd user_entry;
+    struct passwd* user = NULL;
+    char* buffer = NULL;
+    char* name = NULL;
+    int error = ERANGE;
+
+    *answered = false;
+
+    // the buffer has to hold every field of the entry, so it grows until it does
+    for(size_t size = bufferSize(_SC_GETPW_R_SIZE_MAX); error == ERANGE && size <= ID_BUFFER_MAX; size *= 2) {
+        char* grown = realloc(buffer, size);
+
+        if(!grown) {
+            break;
+        }
+
+        buffer = grown;
+        error = getpwuid_r(uid, &user_entry, buffer, size, &user);
+    }
+
+    if(error == 0) {
+        name = user ? strdup(user->pw_name) : NULL;
+        *answered = !user || name;
+    }
+
+    free(buffer);
+    return name;
+}
+
+// lookupUser for groups
+static char* lookupGroup(gid_t gid, bool* answered) {
+    struct group grp_entry;
+    struct group* grp = NULL;
+    char* buffer = NULL;
+    char* name = NULL;
+    int error = ERANGE;
+
+    *answered = false;
+
+    for(size_t size = bufferSize(_SC_GETGR_R_SIZE_MAX); error == ERANGE && size <= ID_BUFFER_MAX; size *= 2) {
+        char* grown = realloc(buffer, size);
+
+        if(!grown) {
+            break;
+        }
+
+        buffer = grown;
+        error = getgrgid_r(gid, &grp_entry, buffer, size, &grp);
+    }
+
+    if(error == 0) {
+        name = grp ? strdup(grp->gr_name) : NULL;
+        *answered = !grp || name;
+    }
+
+    free(buffer);
+    return name;
+}
+
+// first buffer size for getpwuid_r / getgrgid_r, from sysconf(name)
+static size_t bufferSize(int name) {
+    long size = sysconf(name);
+
+    return size > 0 ? (size_t)size : ID_BUFFER_SIZE;
+}
+
+// returns false if out of memory
+static bool tableInit(id_table_t* table) {
+    table->capacity = INITIAL_CAPACITY;
+    table->length = 0;
+    table->entries = calloc(table->capacity, sizeof(id_entry_t));
+
+    return table->entries != NULL;
+}
+
+// returns the slot holding id (found set to true) or the empty slot where it would go
+static id_entry_t* tableFind(id_table_t* table, uint32_t id, bool* found) {
+    // fibonacci hashing spreads out the runs of consecutive ids that are common for users
+    size_t mask = table->capacity - 1;
+    size_t index = ((uint64_t)id * 11400714819323198485ull) >> 32 & mask;
+
+    for(;; index = (index + 1) & mask) {
+        id_entry_t* entry = &table->entries[index];
+
+        if(!entry->used || entry->id == id) {
+            *found = entry->used;
+            return entry;
+        }
+    }
+}
+
+// add an id that is not in the table yet with a copy of name, growing the table if it gets half full
+// returns its entry, NULL if out of memory (the table is left as it was)
+static id_entry_t* tableInsert(id_table_t* table, uint32_t id, const char* name) {
+    char* copy = NULL;
+
+    if(name) {
+        copy = strdup(name);
+
+        if(!copy) {
+            return NULL;
+        }
+    }
+
+    if((table->length + 1) * 2 > table->capacity) {
+        id_table_t grown;
+        grown.capacity = table->capacity * 2;
+        grown.length = table->length;
+        grown.entries = calloc(grown.capacity, sizeof(id_entry_t));
+
+        if(!grown.entries) {
+            free(copy);
+            return NULL;
+        }
+
+        for(size_t i = 0; i < table->capacity; i++) {
+            if(table->entries[i].used) {
+                bool found;
+                *tableFind(&grown, table->entries[i].id, &found) = table->entries[i];
+            }
+        }
+
+        free(table->entries);
+        *table = grown;
+    }
+
+    bool found;
+    id_entry_t* entry = tableFind(table, id, &found);
+
+    entry->id = id;
+    entry->used = true;
+    entry->name = copy;
+    table->length++;
+
+    return entry;
+}
+
+static void tableFree(id_table_t* table) {
+    for(size_t i = 0; i < table->capacity; i++) {
+        free(table->entries[i].name);
+    }
+
+    free(table->entries);
+}
@@ -0,0 +1,57 @@
+#ifndef _IDCACHE_H_
+#define _IDCACHE_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "stats.h"
+
+// one resolved id; name is NULL if the id has no user / group
+typedef struct id_entry_t {
+    uint32_t id;
+    bool used;
+    char* name;
+} id_entry_t;
+
+// open addressing hash table from id to name
+typedef struct id_table_t {
+    id_entry_t* entries;
+    size_t capacity; // always a power of 2
+    size_t length;
+} id_table_t;
+
+// caches getpwuid / getgrgid results for the whole run, safe to share between threads
+typedef struct idcache_t {
+    pthread_mutex_t lock;
+    id_table_t users;
+    id_table_t groups;
+    size_t hits;
+    size_t misses;
+} idcache_t;
+
+// the last user and group looked up by one thread, entries of a directory mostly share them
+// so most lookups are answered here without taking the cache's lock
+// only answers that are in the cache are kept, an id that couldn't be looked up is asked again
+typedef struct id_memo_t {
+    bool has_user;  // user is the cached name of uid
+    bool has_group; // group is the cached name of gid
+    uint32_t uid;
+    uint32_t gid;
+    const char* user;
+    const char* group;
+} id_memo_t;
+
+idcache_t* idcacheCreate();
+void idcachePreload(idcache_t* cache);
+const char* idcacheUser(idcache_t* cache, uid_t uid, bool* cached);
+const char* idcacheGroup(idcache_t* cache, gid_t gid, bool* cached);
+const char* idmemoUser(id_memo_t* memo, idcache_t* cache, stats_t* stats, uid_t uid);
+const char* idmemoGroup(id_memo_t* memo, idcache_t* cache, stats_t* stats, gid_t gid);
+void idcachePrintStats(idcache_t* cache, uint64_t memo_hits, FILE* out);
+void idcacheFree(idcache_t* cache);
+
+#endif
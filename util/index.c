@@ -0,0 +1,490 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h> // memcmp / memcpy / strerror
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h> // open
+#include <unistd.h> // close / pwrite / unlink
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "index.h"
+#include "dirreader.h"
+#include "output.h"
+#include "arena.h"
+#include "sort.h"
+
+// --index=FILE keeps the names of every directory listed (with their dirent data, as read) in FILE for the
+// next run, which reads them from there instead of the directory if it hasn't changed since: same inode,
+// modification and change time. Only names can be kept this way, a directory's timestamps change when
+// entries are added, removed or renamed but not when an entry's own metadata does, so entries are still
+// stat-ed as usual
+//
+// the file is a header, the records of the directories and a table of (hash of path, offset of record)
+// sorted by hash; it is mapped as a whole and replaced once the run is done by a new one with the
+// directories of that run, written to FILE.tmp alongside it
+
+#define INDEX_MAGIC "lscidx01"
+
+typedef struct index_header_t {
+    char magic[8];
+    uint64_t num_dirs;
+    uint64_t table_offset;
+} index_header_t;
+
+// one directory, followed by its path (not null terminated) and its entries; records are 8-byte aligned
+// an entry is its inode number (8 bytes, unaligned), type (1 byte), name length (1 byte) and null terminated name
+typedef struct index_dir_t {
+    uint64_t length; // of the whole record, padding included
+    uint64_t dev;
+    uint64_t ino;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    int64_t ctime_sec;
+    int64_t ctime_nsec;
+    uint64_t path_len;
+} index_dir_t;
+
+typedef struct index_slot_t {
+    uint64_t hash;
+    uint64_t offset;
+} index_slot_t;
+
+#define ENTRY_HEADER_SIZE 10
+
+struct index_t {
+    // the index of the last run, NULL if there is none (or it isn't valid)
+    char* map;
+    size_t map_size;
+    index_slot_t* slots;
+    uint64_t num_slots;
+
+    // the index of this run, written to temp_path then renamed to path; fd is -1 if it couldn't be created
+    char* path;
+    char* temp_path;
+    int fd;
+    output_t* writer;
+    uint64_t offset;        // where the next record goes
+    sort_pair_t* new_slots; // hash of each record's path and its offset
+    size_t num_new_slots;
+    size_t slots_capacity;
+
+    pthread_mutex_t lock; // of everything written, records are added by every thread listing directories
+    uint64_t kept;    // directories read from the index
+    uint64_t read;    // directories read and added to the index
+    uint64_t skipped; // directories read but not added, modified too recently
+};
+
+static void indexMap(index_t* index);
+static void indexAbandon(index_t* index, int error);
+static void indexAppend(index_t* index, const char* path, size_t path_len, const char* record, size_t length);
+static uint64_t pathHash(const char* path, size_t length);
+static void recordWrite(index_record_t* record, const void* data, size_t length);
+
+// open the index at path, reading what the last run left there (if anything) and starting the one of this run
+// problems with the file are reported to stderr and only mean directories are read as usual
+// returns NULL if out of memory
+index_t* indexOpen(const char* path) {
+    index_t* index = calloc(1, sizeof(index_t));
+    size_t path_len = strlen(path);
+
+    if(!index) {
+        return NULL;
+    }
+
+    index->path = malloc(path_len + 1);
+    index->temp_path = malloc(path_len + sizeof(".tmp"));
+
+    if(!index->path || !index->temp_path) {
+        free(index->path);
+        free(index->temp_path);
+        free(index);
+        return NULL;
+    }
+
+    memcpy(index->path, path, path_len + 1);
+    memcpy(index->temp_path, path, path_len);
+    memcpy(&index->temp_path[path_len], ".tmp", sizeof(".tmp"));
+
+    pthread_mutex_init(&index->lock, NULL);
+    indexMap(index);
+
+    index->fd = open(index->temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if(index->fd == -1) {
+        fprintf(stderr, "lsc: cannot write index '%s': %s\n", index->temp_path, strerror(errno));
+        return index;
+    }
+
+    // the header is written last, once the table is
+    index_header_t header;
+    memset(&header, 0, sizeof(index_header_t));
+
+    index->writer = outputCreate(index->fd);
+
+    if(!index->writer) {
+        indexAbandon(index, ENOMEM);
+        return index;
+    }
+
+    outputWrite(index->writer, (char*)&header, sizeof(index_header_t));
+    index->offset = sizeof(index_header_t);
+
+    return index;
+}
+
+// map the index of the last run, checking that its table and records are within the file
+static void indexMap(index_t* index) {
+    int fd = open(index->path, O_RDONLY | O_CLOEXEC);
+    struct stat file_stat;
+
+    if(fd == -1) {
+        if(errno != ENOENT) {
+            fprintf(stderr, "lsc: cannot read index '%s': %s\n", index->path, strerror(errno));
+        }
+
+        return;
+    }
+
+    if(fstat(fd, &file_stat) == -1 || (size_t)file_stat.st_size < sizeof(index_header_t)) {
+        close(fd);
+        return;
+    }
+
+    char* map = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if(map == MAP_FAILED) {
+        return;
+    }
+
+    size_t size = file_stat.st_size;
+    index_header_t* header = (index_header_t*)map;
+    bool valid = memcmp(header->magic, INDEX_MAGIC, 8) == 0 && header->table_offset % 8 == 0 &&
+        header->table_offset >= sizeof(index_header_t) && header->table_offset <= size &&
+        header->num_dirs <= (size - header->table_offset) / sizeof(index_slot_t);
+
+    index_slot_t* slots = valid ? (index_slot_t*)&map[header->table_offset] : NULL;
+
+    // every record has to fit before the table, the rest is checked as it is read
+    for(uint64_t i = 0; valid && i < header->num_dirs; i++) {
+        uint64_t offset = slots[i].offset;
+        index_dir_t* dir = (index_dir_t*)&map[offset];
+
+        valid = offset % 8 == 0 && offset >= sizeof(index_header_t) && offset <= header->table_offset &&
+            header->table_offset - offset >= sizeof(index_dir_t) &&
+            dir->length >= sizeof(index_dir_t) && dir->length <= header->table_offset - offset &&
+            dir->path_len <= dir->length - sizeof(index_dir_t);
+    }
+
+    if(!valid) {
+        fprintf(stderr, "lsc: ignoring invalid index '%s'\n", index->path);
+        munmap(map, size);
+        return;
+    }
+
+    index->map = map;
+    index->map_size = size;
+    index->slots = slots;
+    index->num_slots = header->num_dirs;
+}
+
+// look up the directory at path, which is open and was fstat-ed into dir_stat
+// returns true if the index has its entries and it hasn't changed since, cursor is then set to read them
+bool indexLookup(index_t* index, const char* path, struct stat* dir_stat, index_cursor_t* cursor) {
+    if(!index->map) {
+        return false;
+    }
+
+    size_t path_len = strlen(path);
+    uint64_t hash = pathHash(path, path_len);
+
+    // first slot with the hash
+    size_t low = 0;
+    size_t high = index->num_slots;
+
+    while(low < high) {
+        size_t middle = low + (high - low) / 2;
+
+        if(index->slots[middle].hash < hash) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+
+    for(size_t i = low; i < index->num_slots && index->slots[i].hash == hash; i++) {
+        const char* record = &index->map[index->slots[i].offset];
+        index_dir_t* dir = (index_dir_t*)record;
+
+        if(dir->path_len != path_len || memcmp(&record[sizeof(index_dir_t)], path, path_len) != 0) {
+            continue;
+        }
+
+        if(dir->dev != (uint64_t)dir_stat->st_dev || dir->ino != (uint64_t)dir_stat->st_ino ||
+           dir->mtime_sec != dir_stat->st_mtim.tv_sec || dir->mtime_nsec != dir_stat->st_mtim.tv_nsec ||
+           dir->ctime_sec != dir_stat->st_ctim.tv_sec || dir->ctime_nsec != dir_stat->st_ctim.tv_nsec) {
+            return false;
+        }
+
+        cursor->record = record;
+        cursor->position = &record[sizeof(index_dir_t) + path_len];
+        cursor->end = &record[dir->length];
+
+        return true;
+    }
+
+    return false;
+}
+
+// fill out entry with the next entry of the cursor's directory (its name points into the index)
+// returns false at the end of the directory
+bool indexNext(index_cursor_t* cursor, dir_entry_t* entry) {
+    if(cursor->end - cursor->position < ENTRY_HEADER_SIZE) {
+        return false;
+    }
+
+    uint64_t ino;
+    memcpy(&ino, cursor->position, sizeof(uint64_t));
+
+    unsigned char type = cursor->position[8];
+    size_t name_len = (unsigned char)cursor->position[9];
+    const char* name = &cursor->position[ENTRY_HEADER_SIZE];
+
+    // a zero name length is padding, and a record that doesn't add up ends here
+    if(name_len == 0 || (size_t)(cursor->end - name) <= name_len || name[name_len] != '\0') {
+        return false;
+    }
+
+    entry->ino = ino;
+    entry->type = type;
+    entry->name = (char*)name;
+    entry->name_len = name_len;
+
+    cursor->position = &name[name_len + 1];
+
+    return true;
+}
+
+// add a directory read from the index with indexLookup to the next one as it is
+void indexKeep(index_t* index, index_cursor_t* cursor) {
+    index_dir_t* dir = (index_dir_t*)cursor->record;
+
+    pthread_mutex_lock(&index->lock);
+    indexAppend(index, &cursor->record[sizeof(index_dir_t)], dir->path_len, cursor->record, dir->length);
+    index->kept++;
+    pthread_mutex_unlock(&index->lock);
+}
+
+// start the record of the directory at path, which is open and was fstat-ed into dir_stat
+// returns false if it was modified too recently to be added (see INDEX_RACY_NS)
+bool indexRecordBegin(index_t* index, index_record_t* record, const char* path, struct stat* dir_stat) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    int64_t now_ns = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+    int64_t mtime_ns = (int64_t)dir_stat->st_mtim.tv_sec * 1000000000 + dir_stat->st_mtim.tv_nsec;
+    int64_t ctime_ns = (int64_t)dir_stat->st_ctim.tv_sec * 1000000000 + dir_stat->st_ctim.tv_nsec;
+
+    record->length = 0;
+    record->failed = false;
+
+    if(now_ns - mtime_ns < INDEX_RACY_NS || now_ns - ctime_ns < INDEX_RACY_NS) {
+        pthread_mutex_lock(&index->lock);
+        index->skipped++;
+        pthread_mutex_unlock(&index->lock);
+        return false;
+    }
+
+    index_dir_t dir = {
+        .dev = dir_stat->st_dev,
+        .ino = dir_stat->st_ino,
+        .mtime_sec = dir_stat->st_mtim.tv_sec,
+        .mtime_nsec = dir_stat->st_mtim.tv_nsec,
+        .ctime_sec = dir_stat->st_ctim.tv_sec,
+        .ctime_nsec = dir_stat->st_ctim.tv_nsec,
+        .path_len = strlen(path),
+    };
+
+    recordWrite(record, &dir, sizeof(index_dir_t));
+    recordWrite(record, path, dir.path_len);
+
+    return true;
+}
+
+// add an entry read from the directory to its record
+void indexRecordEntry(index_record_t* record, dir_entry_t* entry) {
+    char header[ENTRY_HEADER_SIZE];
+    uint64_t ino = entry->ino;
+
+    memcpy(header, &ino, sizeof(uint64_t));
+    header[8] = entry->type;
+    header[9] = entry->name_len;
+
+    recordWrite(record, header, ENTRY_HEADER_SIZE);
+    recordWrite(record, entry->name, entry->name_len + 1);
+}
+
+// add a record started with indexRecordBegin, once the whole directory was read, to the next index
+// (unless it ran out of memory, the directory is then read again by the next run)
+void indexCommit(index_t* index, index_record_t* record) {
+    // padded with zeros to keep the next record aligned
+    static const char PADDING[8] = { 0 };
+    recordWrite(record, PADDING, (8 - record->length % 8) % 8);
+
+    if(record->failed) {
+        record->length = 0;
+        return;
+    }
+
+    index_dir_t* dir = (index_dir_t*)record->buffer;
+    dir->length = record->length;
+
+    pthread_mutex_lock(&index->lock);
+    indexAppend(index, &record->buffer[sizeof(index_dir_t)], dir->path_len, record->buffer, record->length);
+    index->read++;
+    pthread_mutex_unlock(&index->lock);
+
+    record->length = 0;
+}
+
+// print how many directories were read from the index (for --stats)
+void indexPrintStats(index_t* index, FILE* out) {
+    fprintf(out, "index: %llu directories from the index, %llu read and added, %llu read but modified too recently to add\n",
+        (unsigned long long)index->kept, (unsigned long long)index->read, (unsigned long long)index->skipped);
+}
+
+// write the table and header of the next index and put it in place of the last one, then free the index
+void indexClose(index_t* index) {
+    arena_t* scratch = index->fd != -1 ? arenaCreate() : NULL;
+
+    if(index->fd != -1 && (!scratch || !sortPairs(index->new_slots, index->num_new_slots, scratch))) {
+        indexAbandon(index, ENOMEM);
+    }
+
+    if(scratch) {
+        arenaFree(scratch);
+    }
+
+    if(index->fd != -1) {
+        for(size_t i = 0; i < index->num_new_slots; i++) {
+            index_slot_t slot = { index->new_slots[i].key, index->new_slots[i].index };
+            outputWrite(index->writer, (char*)&slot, sizeof(index_slot_t));
+        }
+
+        outputFree(index->writer);
+
+        index_header_t header;
+        memcpy(header.magic, INDEX_MAGIC, 8);
+        header.num_dirs = index->num_new_slots;
+        header.table_offset = index->offset;
+
+        // the writer drops what it fails to write, a short file isn't put in place
+        struct stat file_stat;
+        bool written = pwrite(index->fd, &header, sizeof(index_header_t), 0) == sizeof(index_header_t) &&
+            fstat(index->fd, &file_stat) == 0 &&
+            (uint64_t)file_stat.st_size == index->offset + index->num_new_slots * sizeof(index_slot_t);
+
+        close(index->fd);
+
+        if(!written || rename(index->temp_path, index->path) == -1) {
+            fprintf(stderr, "lsc: cannot write index '%s': %s\n", index->path, written ? strerror(errno) : "short write");
+            unlink(index->temp_path);
+        }
+    }
+
+    if(index->map) {
+        munmap(index->map, index->map_size);
+    }
+
+    pthread_mutex_destroy(&index->lock);
+    free(index->new_slots);
+    free(index->path);
+    free(index->temp_path);
+    free(index);
+}
+
+// stop writing the next index (the last one is left in place), reporting error
+static void indexAbandon(index_t* index, int error) {
+    fprintf(stderr, "lsc: cannot write index '%s': %s\n", index->temp_path, strerror(error));
+
+    if(index->writer) {
+        outputFree(index->writer);
+        index->writer = NULL;
+    }
+
+    close(index->fd);
+    unlink(index->temp_path);
+    index->fd = -1;
+}
+
+// write a record to the next index and add it to the table, under index->lock
+static void indexAppend(index_t* index, const char* path, size_t path_len, const char* record, size_t length) {
+    if(index->fd == -1) {
+        return;
+    }
+
+    if(index->num_new_slots == index->slots_capacity) {
+        size_t capacity = index->slots_capacity ? index->slots_capacity * 2 : 256;
+        sort_pair_t* new_slots = realloc(index->new_slots, sizeof(sort_pair_t) * capacity);
+
+        if(!new_slots) {
+            indexAbandon(index, ENOMEM);
+            return;
+        }
+
+        index->new_slots = new_slots;
+        index->slots_capacity = capacity;
+    }
+
+    index->new_slots[index->num_new_slots].key = pathHash(path, path_len);
+    index->new_slots[index->num_new_slots].index = index->offset;
+    index->num_new_slots++;
+
+    outputWrite(index->writer, record, length);
+    index->offset += length;
+}
+
+// 64-bit FNV-1a
+static uint64_t pathHash(const char* path, size_t length) {
+    uint64_t hash = 14695981039346656037ull;
+
+    for(size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)path[i];
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+// append to a record, growing its buffer as needed (marking it failed if it can't)
+static void recordWrite(index_record_t* record, const void* data, size_t length) {
+    if(record->failed) {
+        return;
+    }
+
+    if(record->capacity - record->length < length) {
+        size_t capacity = record->capacity ? record->capacity * 2 : 4096;
+
+        while(capacity - record->length < length) {
+            capacity *= 2;
+        }
+
+        char* buffer = realloc(record->buffer, capacity);
+
+        if(!buffer) {
+            record->failed = true;
+            return;
+        }
+
+        record->buffer = buffer;
+        record->capacity = capacity;
+    }
+
+    memcpy(&record->buffer[record->length], data, length);
+    record->length += length;
+}
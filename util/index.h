@@ -0,0 +1,41 @@
+#ifndef _INDEX_H_
+#define _INDEX_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include "dirreader.h"
+
+// a directory modified less than this long before it is read isn't added to the index: a change made within
+// the same tick of the filesystem's clock right after it was read wouldn't change its timestamps
+#define INDEX_RACY_NS (2 * 1000000000ll)
+
+typedef struct index_t index_t;
+
+// the entries of a directory read from the index, in the order they were read from the directory
+typedef struct index_cursor_t {
+    const char* record; // the directory's whole record, copied as is into the next index
+    const char* position;
+    const char* end;
+} index_cursor_t;
+
+// the record of a directory being read, built by one thread before it is added to the next index
+typedef struct index_record_t {
+    char* buffer;
+    size_t length;
+    size_t capacity;
+    bool failed; // the buffer couldn't grow, the directory isn't added
+} index_record_t;
+
+index_t* indexOpen(const char* path);
+bool indexLookup(index_t* index, const char* path, struct stat* dir_stat, index_cursor_t* cursor);
+bool indexNext(index_cursor_t* cursor, dir_entry_t* entry);
+void indexKeep(index_t* index, index_cursor_t* cursor);
+bool indexRecordBegin(index_t* index, index_record_t* record, const char* path, struct stat* dir_stat);
+void indexRecordEntry(index_record_t* record, dir_entry_t* entry);
+void indexCommit(index_t* index, index_record_t* record);
+void indexPrintStats(index_t* index, FILE* out);
+void indexClose(index_t* index);
+
+#endif
@@ -8,151 +8,899 @@
 #include <stdio.h>
 #include <string.h> // strerror
 #include <errno.h>
-#include <dirent.h>
+#include <dirent.h> // DT_DIR
+#include <fcntl.h> // open
+#include <unistd.h> // close
+#include <limits.h> // PATH_MAX
+#include <sys/stat.h> // fstat
 
 #include "listing.h"
 #include "vector.h"
 #include "entries.h"
 #include "utility.h"
+#include "arena.h"
+#include "context.h"
+#include "dirreader.h"
+#include "uring.h"
+#include "metadata.h"
+#include "output.h"
+#include "record.h"
+#include "sort.h"
+#include "spill.h"
+#include "top.h"
+#include "stats.h"
+#include "index.h"
+
+// walkTree keeps the fds of up to this many of the directories it is in open,
+// their subdirectories are opened relative to them instead of by their full path
+#define MAX_ANCESTOR_FDS 64
+
+// first number of frames on walkTree's stack, doubled when needed
+#define INITIAL_STACK_SIZE 64
+
+// a directory being walked by walkTree, it stays on the stack until its subdirectories are listed
+typedef struct dir_frame_t {
+    char* path;
+    char** subdirs;     // allocated from the walker's paths arena (after mark)
+    size_t num_subdirs;
+    size_t next;        // index of the next subdirectory to list
+    int fd;             // -1 if it was closed to stay within MAX_ANCESTOR_FDS
+    arena_mark_t mark;  // where the paths arena goes back to once the frame is done
+    off_t file_next;    // if subdirs is NULL, where the name of the next one is in the subdirectory file
+    off_t file_mark;    // where the subdirectory file goes back to once the frame is done
+} dir_frame_t;
+
+static bool processEntriesBatched(context_t* context, entry_info_t* entry_infos, vector_t* files, int dir_fd);
+static bool processEntriesByInode(context_t* context, entry_info_t* entry_infos, vector_t* files, int dir_fd);
+static int reopenDirectory(dir_frame_t* frame, int child_fd);
+static int openLongPath(char* path);
+static void listWindow(context_t* context, char* path, int dir_fd);
+static char** listVisit(void* arg, char* path, int dir_fd, int error, bool first, size_t* num_subdirs);
 
 // lists a given vector of files relative to dir_fd (-1 if relative to cwd)
-void listFiles(options_t* options, vector_t* files, int dir_fd) {
+// nothing is listed if it runs out of memory (context->error is set)
+void listFiles(context_t* context, vector_t* files, int dir_fd) {
     if(files->length == 0) {
         return;
     }
 
-    entry_info_t* entry_infos = malloc(sizeof(entry_info_t) * files->length);
-    column_widths_t* column_widths = malloc(sizeof(column_widths_t));
+    // released when the names arena is reset for the next directory
+    entry_info_t* entry_infos = arenaAlloc(context->names, sizeof(entry_info_t) * files->length);
 
-    if(!entry_infos || !column_widths) {
-        printf("malloc() failed... exiting\n");
-        exit(EXIT_FAILURE);
+    if(!entry_infos) {
+        context->error = ENOMEM;
+        return;
     }
-    
+
     // process each entry and put the results into an entry_info_t struct
-    for(size_t i = 0; i < files->length; i++) {
-        processEntry(&entry_infos[i], options, files->items[i], dir_fd);
+    processEntries(context, entry_infos, files, dir_fd);
+
+    orderEntries(context, entry_infos, files);
+
+    if(context->error != 0) {
+        return;
     }
 
-    // based upon all of the entry_info_t structs, grab the proper column widths
-    getColumnWidths(column_widths, entry_infos, files->length, options);
+    // with --top, only the first entries are listed (the errors of the rest are still reported); with -U
+    // listDirectoryContents already stopped reading once it had enough
+    if(context->options->top != 0 && !context->options->unsorted) {
+        size_t count = 0;
+
+        while(count < files->length && entry_infos[count].error != ENTRY_OK) {
+            count++;
+        }
+
+        if(files->length - count > context->options->top) {
+            files->length = count + context->options->top;
+        }
+    }
+
+    printEntries(context, entry_infos, files->length);
+}
+
+// reorder processed entries (and files, their names) that are in name order for -S / -t / -r
+// the entries that can't be listed are moved to the front, staying in name order
+// the entries are radix sorted on keys made from their size or time, ties keep their name order
+// if it runs out of memory they are left as they were and context->error is set
+void orderEntries(context_t* context, entry_info_t* entry_infos, vector_t* files) {
+    options_t* options = context->options;
+    size_t count = files->length;
+
+    if(options->unsorted || (options->sort_by == SORT_NAME && !options->reverse) || count < 2) {
+        return;
+    }
+
+    arena_mark_t mark = arenaMark(context->names);
+    sort_pair_t* pairs = arenaAlloc(context->names, sizeof(sort_pair_t) * count);
+    entry_info_t* ordered_infos = arenaAlloc(context->names, sizeof(entry_info_t) * count);
+    char** ordered_names = arenaAlloc(context->names, sizeof(char*) * count);
+    size_t num_errors = 0;
+
+    if(!pairs || !ordered_infos || !ordered_names) {
+        context->error = ENOMEM;
+        arenaRewind(context->names, mark);
+        return;
+    }
+
+    for(size_t i = 0; i < count; i++) {
+        if(entry_infos[i].error != ENTRY_OK) {
+            pairs[num_errors++].index = i;
+        }
+    }
+
+    sort_pair_t* listed = &pairs[num_errors];
+    size_t num_listed = 0;
+
+    for(size_t i = 0; i < count; i++) {
+        if(entry_infos[i].error == ENTRY_OK) {
+            listed[num_listed++].index = i;
+        }
+    }
+
+    // largest / newest first: the keys are inverted since sortPairs sorts in ascending order
+    bool sorted = true;
+
+    if(options->sort_by == SORT_SIZE) {
+        for(size_t i = 0; i < num_listed; i++) {
+            listed[i].key = UINT64_MAX - (uint64_t)entry_infos[listed[i].index].size;
+        }
+
+        sorted = sortPairs(listed, num_listed, context->names);
+    }
+    else if(options->sort_by == SORT_TIME) {
+        // nanoseconds first, then the (stable) sort by seconds keeps them in order within each second
+        for(size_t i = 0; i < num_listed; i++) {
+            listed[i].key = UINT64_MAX - entry_infos[listed[i].index].mtime_nsec;
+        }
+
+        sorted = sortPairs(listed, num_listed, context->names);
+
+        // flipping the sign bit orders the signed seconds as unsigned keys
+        for(size_t i = 0; i < num_listed; i++) {
+            listed[i].key = ~((uint64_t)entry_infos[listed[i].index].mtime ^ ((uint64_t)1 << 63));
+        }
+
+        sorted = sorted && sortPairs(listed, num_listed, context->names);
+    }
+
+    if(!sorted) {
+        context->error = ENOMEM;
+        arenaRewind(context->names, mark);
+        return;
+    }
+
+    if(options->reverse) {
+        for(size_t i = 0; i < num_listed / 2; i++) {
+            sort_pair_t swap = listed[i];
+            listed[i] = listed[num_listed - 1 - i];
+            listed[num_listed - 1 - i] = swap;
+        }
+    }
+
+    for(size_t i = 0; i < count; i++) {
+        ordered_infos[i] = entry_infos[pairs[i].index];
+        ordered_names[i] = files->items[pairs[i].index];
+    }
+
+    memcpy(entry_infos, ordered_infos, sizeof(entry_info_t) * count);
+    memcpy(files->items, ordered_names, sizeof(char*) * count);
+
+    arenaRewind(context->names, mark);
+}
+
+// print count processed entries: the errors of those that can't be listed first, then the rest in columns
+// stops early once context->error is set (e.g. the library's callback asked to)
+void printEntries(context_t* context, entry_info_t* entry_infos, size_t count) {
+    uint64_t start = statsStart(context->stats);
+    column_widths_t column_widths;
+
+    // the entries that can't be listed are reported before the rest
+    for(size_t i = 0; i < count && context->error == 0; i++) {
+        printEntryError(&entry_infos[i], context);
+    }
+
+    // based upon all of the entry_info_t structs, grab the proper column widths (records aren't lined up)
+    getColumnWidths(&column_widths, entry_infos, count, context);
 
     // print all the entries
-    for(size_t i = 0; i < files->length; i++) {
-        printEntry(column_widths, &entry_infos[i], options);
+    printEntryList(&column_widths, entry_infos, count, context);
+
+    statsStop(context->stats, STATS_FORMAT, start);
+    outputCheckpoint(context->out);
+}
+
+// call processEntry on every file (relative to dir_fd), filling entry_infos in the same order
+void processEntries(context_t* context, entry_info_t* entry_infos, vector_t* files, int dir_fd) {
+    uint64_t start = statsStart(context->stats);
+    bool processed = false;
+
+    // only names read from a directory have an inode number to go by
+    // both fall back to stat-ing the entries one by one if they have no memory for their arrays
+    if(context->options->inode_order && dir_fd != -1 && context->plan.mask != 0 && files->length > 1) {
+        processed = processEntriesByInode(context, entry_infos, files, dir_fd);
+    }
+    else if(context->uring && context->plan.mask != 0) {
+        processed = processEntriesBatched(context, entry_infos, files, dir_fd);
+    }
+
+    if(!processed) {
+        context->process_kernel->entries(entry_infos, context, files->items, files->length, dir_fd);
     }
 
-    // finished printing these files, free memory malloc-ed by this function
-    free(entry_infos);
-    free(column_widths);
+    statsStop(context->stats, STATS_STAT, start);
 }
 
-// lists the given directory (recursive with -R option)
-void listDirectory(options_t* options, char* path) {
-    DIR* directory = opendir(path);
+// same as processEntries, but the files are processed in ascending inode number (from their dirent data)
+// and the results put back in the order of files; errors are recorded in the entries, so the output
+// doesn't change, only the order in which inodes are read from the disk
+// returns false, having processed nothing, if there's no memory to put them in order
+static bool processEntriesByInode(context_t* context, entry_info_t* entry_infos, vector_t* files, int dir_fd) {
+    size_t count = files->length;
+
+    // these stay in the names arena along with the link targets processEntry allocates after them
+    arena_mark_t mark = arenaMark(context->names);
+    sort_pair_t* pairs = arenaAlloc(context->names, sizeof(sort_pair_t) * count);
+    char** names = arenaAlloc(context->names, sizeof(char*) * count);
+    entry_info_t* results = arenaAlloc(context->names, sizeof(entry_info_t) * count);
+
+    if(!pairs || !names || !results) {
+        arenaRewind(context->names, mark);
+        return false;
+    }
+
+    for(size_t i = 0; i < count; i++) {
+        pairs[i].key = dirNameOf(files->items[i])->ino;
+        pairs[i].index = i;
+    }
+
+    if(!sortPairs(pairs, count, context->names)) {
+        arenaRewind(context->names, mark);
+        return false;
+    }
+
+    for(size_t i = 0; i < count; i++) {
+        names[i] = files->items[pairs[i].index];
+    }
+
+    // processed through a view of the names in inode order (batched with --io-uring as usual)
+    vector_t by_inode = { count, count, names };
+
+    if(!context->uring || !processEntriesBatched(context, results, &by_inode, dir_fd)) {
+        context->process_kernel->entries(results, context, names, count, dir_fd);
+    }
+
+    for(size_t i = 0; i < count; i++) {
+        entry_infos[pairs[i].index] = results[i];
+    }
+
+    return true;
+}
+
+// same as calling processEntry on every file, but the statx calls are submitted to io_uring
+// in batches of URING_BATCH_SIZE and the entries processed once a batch has completed
+// returns false, having processed nothing, if there's no memory for the batches
+static bool processEntriesBatched(context_t* context, entry_info_t* entry_infos, vector_t* files, int dir_fd) {
+    size_t batch_size = files->length < URING_BATCH_SIZE ? files->length : URING_BATCH_SIZE;
+
+    // the batch arrays are given back to the arena at the end
+    arena_mark_t mark = arenaMark(context->names);
+    struct statx* results = arenaAlloc(context->names, sizeof(struct statx) * batch_size);
+    int* errors = arenaAlloc(context->names, sizeof(int) * batch_size);
+
+    // names in the current batch that need a statx and their index within the batch
+    char** names = arenaAlloc(context->names, sizeof(char*) * batch_size);
+    size_t* slots = arenaAlloc(context->names, sizeof(size_t) * batch_size);
+
+    if(!results || !errors || !names || !slots) {
+        arenaRewind(context->names, mark);
+        return false;
+    }
+
+    for(size_t start = 0; start < files->length; start += batch_size) {
+        size_t count = files->length - start < batch_size ? files->length - start : batch_size;
+        size_t num_names = 0;
+
+        for(size_t i = 0; i < count; i++) {
+            char* name = files->items[start + i];
+            unsigned char d_type = dir_fd != -1 ? dirNameOf(name)->type : DT_UNKNOWN;
+
+            if(metadataNeedsStat(&context->plan, d_type)) {
+                names[num_names] = name;
+                slots[num_names] = i;
+                num_names++;
+            }
+        }
+
+        // if the ring fails, stop using it and stat the rest synchronously
+        if(context->uring && !uringStatBatch(context->uring, dir_fd, names, num_names, context->plan.mask, results, errors)) {
+            uringFree(context->uring);
+            context->uring = NULL;
+        }
+        // the ones that failed are counted again (as failed) when processEntry retries them
+        else if(context->stats) {
+            context->stats->calls[STATS_STATX] += num_names;
+        }
+
+        // results[j] belongs to the entry at slots[j], everything else is left to processEntry
+        // entries that failed are stat-ed again by processEntry so it reports the error as usual
+        for(size_t i = 0, j = 0; i < count; i++) {
+            struct statx* prefetched = NULL;
+
+            if(j < num_names && slots[j] == i) {
+                if(context->uring && errors[j] == 0) {
+                    prefetched = &results[j];
+                }
+
+                j++;
+            }
+
+            processEntry(&entry_infos[start + i], context, files->items[start + i], dir_fd, prefetched);
+        }
+    }
+
+    arenaRewind(context->names, mark);
+    return true;
+}
 
-    // ensure opendir was successful
-    // if not, print an error and return
-    if(directory == NULL) {
-        printf("lsc: cannot open directory '%s': %s\n", path, strerror(errno));
+// print the blank line between two listings, left out of --format records (which say what directory they're in)
+void printSeparator(output_t* out, options_t* options) {
+    if(options->format == FORMAT_TEXT) {
+        outputChar(out, '\n');
+    }
+}
+
+// print why the directory at path couldn't be listed (or only in part), as a record with --format
+void printDirectoryError(context_t* context, const char* what, char* path, int error) {
+    if(context->options->format != FORMAT_TEXT) {
+        recordError(context, path, "", what, error);
         return;
     }
 
+    printError(context->out, what, path, error);
+}
+
+// print the "path:" line above the listing of a directory
+void printHeader(output_t* out, char* path) {
+    size_t path_len;
+    char path_quotes = classifyName(path, &path_len);
+
+    printWithQuotes(out, path, path_len, path_quotes);
+    outputWrite(out, ":\n", 2);
+}
+
+// open the directory name relative to at_fd (AT_FDCWD if name is a path) for listDirectoryContents
+// prints an error about path (the full path of the directory, NULL for none) and returns -1 if it can't be opened
+int openDirectory(context_t* context, int at_fd, char* name, char* path) {
+    int dir_fd;
+
+    if(at_fd == AT_FDCWD && strlen(name) >= PATH_MAX) {
+        dir_fd = openLongPath(name);
+    }
+    else {
+        dir_fd = openat(at_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    }
+
+    if(dir_fd == -1 && path != NULL) {
+        printDirectoryError(context, "cannot open directory", path, errno);
+    }
+
+    return dir_fd;
+}
+
+// lists the contents of a single directory (header and entries) at path, opened as dir_fd, to context->out
+// the caller closes dir_fd, it is only read from here
+// with -R, returns the paths of its subdirectories in the order they should be listed (and their number in
+// num_subdirs), both the array and the paths are allocated from context->paths; or WALK_SPILLED if the
+// directory was spilled and their names were written to context->subdir_file instead
+// returns NULL if there are none, or if the listing was stopped by context->error
+char** listDirectoryContents(context_t* context, char* path, int dir_fd, size_t* num_subdirs) {
+    options_t* options = context->options;
+    output_t* out = context->out;
+    uint64_t start = statsStart(context->stats);
+    size_t num_entries = 0;
+
+    *num_subdirs = 0;
+    recordDirectory(context, path);
+
     if(options->print_header) {
-        printWithQuotes(path, stringNeedsQuotes(path));
-        printf(":\n");
+        printHeader(out, path);
     }
 
     // entries in this directory, whether a subdirectory or a file
-    vector_t* entry_vector = vectorCreate();
+    vector_t* entry_vector = context->entry_vector;
+    vectorClear(entry_vector);
+    vectorClear(context->subdir_vector);
+
+    // nothing from the previous directory is needed anymore, its memory is reused for this one
+    arenaReset(context->names);
+
+    dir_reader_t reader;
+    dirReaderInit(&reader, dir_fd, context->read_buffer, options->read_buffer_size, context->stats);
+
+    // with --index, the names come from there if the directory hasn't changed since the last run, otherwise
+    // they are read as usual and recorded for the next one
+    index_cursor_t cursor;
+    bool from_index = false;
+    bool recording = false;
+    struct stat dir_stat;
+
+    if(context->index && fstat(dir_fd, &dir_stat) == 0) {
+        from_index = indexLookup(context->index, path, &dir_stat, &cursor);
+        recording = !from_index && indexRecordBegin(context->index, &context->index_record, path, &dir_stat);
+    }
 
-    // directory vector (used for -R option)
-    vector_t* dir_vector = vectorCreate();
+    // set once the directory outgrows the memory budget
+    spill_t* spill = NULL;
+    bool spill_failed = false;
+    size_t spilled_subdirs = 0;
+
+    // with --top, a sorted directory is read a window at a time and only its first entries kept
+    top_t* top = options->top != 0 && !options->unsorted ? topCreate(context) : NULL;
+
+    if(options->top != 0 && !options->unsorted && !top) {
+        context->error = ENOMEM;
+    }
 
     // loop through all entries in the directory
-    for(struct dirent* entry = readdir(directory); entry != NULL; entry = readdir(directory)) {
+    for(dir_entry_t entry; context->error == 0 && (from_index ? indexNext(&cursor, &entry) : dirReaderNext(&reader, &entry)); ) {
+        // every entry is recorded, the next run may be given other options
+        if(recording) {
+            indexRecordEntry(&context->index_record, &entry);
+        }
+
         // skip the entry if it's an empty string
-        if(entry->d_name[0] == '\0') {
+        if(entry.name[0] == '\0') {
             continue;
         }
 
         // if we're not printing all, hide hidden files (starting with '.')
-        if(!options->all && entry->d_name[0] == '.') {
+        if(!options->all && entry.name[0] == '.') {
             continue;
         }
 
-        // malloc and make a copy of the entry name
-        // freed at the bottom of this function
-        size_t entry_name_len = strlen(entry->d_name) + 1;
-        char* entry_name = malloc(sizeof(char) * entry_name_len);
+        // put a copy of this file name (and its dirent data) into the entry vector
+        char* name = dirNameCopy(context->names, &entry);
+
+        if(!name || !vectorPush(entry_vector, name)) {
+            context->error = ENOMEM;
+            break;
+        }
+
+        num_entries++;
+
+        // without sorting there is no need to wait for the rest of the directory
+        if(options->unsorted) {
+            if(entry_vector->length == STREAM_WINDOW_SIZE) {
+                listWindow(context, path, dir_fd);
+            }
+
+            // with --top, the first ones read are all that is listed (the rest of the directory isn't recorded)
+            if(num_entries == options->top) {
+                recording = false;
+                break;
+            }
+        }
+        else if(top) {
+            if(entry_vector->length == STREAM_WINDOW_SIZE) {
+                topWindow(top, context, dir_fd);
+            }
+        }
+        // over the memory budget, what was read so far is sorted and written out to disk (only in name order,
+        // which is what the runs are merged by)
+        else if(options->memory_budget != 0 && options->sort_by == SORT_NAME && !options->reverse && !spill_failed && spillNeeded(context)) {
+            if(!spill) {
+                spill = spillCreate(context, path);
+                spill_failed = spill == NULL;
+            }
+
+            if(spill) {
+                spillRun(spill, context, dir_fd);
+            }
+        }
+    }
+
+    // once the listing was stopped, the directory is left where it got to
+    bool stopped = context->error != 0;
+
+    if(reader.error != 0 && !stopped) {
+        printDirectoryError(context, "reading directory", path, reader.error);
+    }
+
+    if(from_index) {
+        indexKeep(context->index, &cursor);
+    }
+    else if(recording && reader.error == 0 && !stopped) {
+        indexCommit(context->index, &context->index_record);
+    }
+
+    if(spill) {
+        // merged back from disk, the subdirectories are collected while printing the entries
+        if(!stopped) {
+            spilled_subdirs = spillFinish(spill, context, path, dir_fd);
+        }
+
+        spillFree(spill);
+    }
+    else if(top) {
+        // the errors are sorted by name and the entries kept in order, the subdirectories collected while printing
+        if(!stopped) {
+            topFinish(top, context, path, dir_fd);
+        }
+
+        topFree(top);
+    }
+    else if(!stopped) {
+        if(!options->unsorted) {
+            uint64_t sort_start = statsStart(context->stats);
+
+            if(!sortNames(entry_vector->items, entry_vector->length, options->collate, context->names)) {
+                context->error = ENOMEM;
+            }
+
+            statsStop(context->stats, STATS_SORT, sort_start);
+        }
+
+        // print all of the files we grabbed in this directory (or the last window of them)
+        if(context->error == 0) {
+            listWindow(context, path, dir_fd);
+        }
+    }
+
+    statsDirectory(context->stats, path, num_entries, start);
+
+    // if we're recursively printing, hand back the paths of the directories in the order they were listed
+    vector_t* subdir_vector = context->subdir_vector;
+
+    if(context->error == 0 && spilled_subdirs > 0) {
+        *num_subdirs = spilled_subdirs;
+        return WALK_SPILLED;
+    }
+
+    if(context->error != 0 || subdir_vector->length == 0) {
+        return NULL;
+    }
+
+    char** subdirs = arenaAlloc(context->paths, sizeof(char*) * subdir_vector->length);
+
+    if(!subdirs) {
+        context->error = ENOMEM;
+        return NULL;
+    }
+
+    memcpy(subdirs, subdir_vector->items, sizeof(char*) * subdir_vector->length);
+    *num_subdirs = subdir_vector->length;
+
+    return subdirs;
+}
+
+// list the entries in context->entry_vector, and with -R add the paths of the directories among them to
+// context->subdir_vector; the names (and the memory used to list them) are released afterwards
+// with -U this is called for every STREAM_WINDOW_SIZE entries of a directory, the column widths only
+// cover the entries of that window
+static void listWindow(context_t* context, char* path, int dir_fd) {
+    vector_t* entry_vector = context->entry_vector;
+
+    listFiles(context, entry_vector, dir_fd);
+
+    if(context->options->recursive) {
+        for(size_t i = 0; i < entry_vector->length && context->error == 0; i++) {
+            char* name = entry_vector->items[i];
+
+            if(dirNameOf(name)->type == DT_DIR && strcmp(name, ".") != 0 && strcmp(name, "..") != 0) {
+                char* subdir = joinPath(context->paths, path, name);
 
-        if(entry_name == NULL) {
-            printf("malloc() failed... exiting\n");
-            exit(EXIT_FAILURE);
+                if(!subdir || !vectorPush(context->subdir_vector, subdir)) {
+                    context->error = ENOMEM;
+                }
+            }
         }
+    }
+
+    vectorClear(entry_vector);
+    arenaReset(context->names);
+}
 
-        // put this file name into the entry vector
-        strncpy(entry_name, entry->d_name, entry_name_len);
-        vectorPush(entry_vector, entry_name);
-        
-        // if we're recursively printing and this is a directory, also put it into the dir vector
-        if(options->recursive && entry->d_type == DT_DIR && strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
-            vectorPush(dir_vector, entry_name);
+// lists the given directory (recursive with -R option)
+// stops as soon as context->error is set, e.g. when out of memory
+void listDirectory(context_t* context, char* path) {
+    options_t* options = context->options;
+    subdir_file_t* subdir_file = NULL;
+
+    // the subdirectories of directories too large for the memory budget are kept on disk with them
+    if(options->recursive && options->memory_budget != 0) {
+        subdir_file = subdirFileCreate(options);
+
+        if(!subdir_file) {
+            context->error = ENOMEM;
+            return;
         }
     }
 
-    // sort both vectors
-    vectorSort(entry_vector);
-    vectorSort(dir_vector);
+    context->subdir_file = subdir_file;
+
+    if(!walkTree(context->paths, subdir_file, path, listVisit, context)) {
+        context->error = ENOMEM;
+    }
+
+    context->subdir_file = NULL;
 
-    int dir_fd = dirfd(directory);
+    if(subdir_file) {
+        subdirFileFree(subdir_file);
+    }
+}
+
+// walkTree callback for listDirectory: print the directory at path straight to context->out
+static char** listVisit(void* arg, char* path, int dir_fd, int error, bool first, size_t* num_subdirs) {
+    context_t* context = arg;
+    char** subdirs = NULL;
+
+    *num_subdirs = 0;
+
+    if(!first) {
+        printSeparator(context->out, context->options);
+    }
 
     if(dir_fd == -1) {
-        printf("dirfd() failed with error: %s\n", strerror(errno));
-        exit(EXIT_FAILURE);
+        printDirectoryError(context, "cannot open directory", path, error);
+    }
+    else {
+        subdirs = listDirectoryContents(context, path, dir_fd, num_subdirs);
+    }
+
+    return context->error == 0 ? subdirs : WALK_STOP;
+}
+
+// walk the tree at path depth first, calling visit for every directory in the order they are listed
+// visit gets the directory opened as dir_fd (-1 and its errno in error if it couldn't be), which it must not
+// close, and returns the paths of its subdirectories to walk next, allocated from paths after the walker's mark
+// (or WALK_STOP to end the walk there, or WALK_SPILLED if it wrote their names to subdir_file, which is NULL
+// for walks whose visit never does)
+// the walker keeps an explicit stack of the directories it is in, each holding the paths of its subdirectories
+// still to be visited; a directory is only kept open (to open its subdirectories relative to it) while on the
+// stack and only the MAX_ANCESTOR_FDS closest to the top are
+// returns false if it ran out of memory for its stack, the walk ends there
+bool walkTree(arena_t* paths, subdir_file_t* subdir_file, char* path, walk_visit_t visit, void* arg) {
+    size_t capacity = INITIAL_STACK_SIZE;
+    dir_frame_t* stack = malloc(sizeof(dir_frame_t) * capacity);
+
+    if(!stack) {
+        return false;
+    }
+
+    // where paths goes back to if the walk ends early
+    arena_mark_t start = arenaMark(paths);
+    bool completed = true;
+
+    // frames with an open fd, always the top open_fds of the stack
+    size_t depth = 0;
+    size_t open_fds = 0;
+
+    char* next_path = path;
+    char* next_name = path;
+    int at_fd = AT_FDCWD;
+    bool first = true;
+
+    while(true) {
+        // visit the next directory, it goes on the stack if it has subdirectories of its own
+        if(next_path != NULL) {
+            arena_mark_t mark = arenaMark(paths);
+            off_t file_mark = subdir_file ? subdir_file->length : 0;
+            int dir_fd = openat(at_fd, next_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            size_t num_subdirs = 0;
+            char** subdirs = visit(arg, next_path, dir_fd, dir_fd == -1 ? errno : 0, first, &num_subdirs);
+
+            first = false;
+
+            if(subdirs == WALK_STOP) {
+                if(dir_fd != -1) {
+                    close(dir_fd);
+                }
+
+                break;
+            }
+
+            if(num_subdirs == 0) {
+                if(dir_fd != -1) {
+                    close(dir_fd);
+                }
+
+                arenaRewind(paths, mark);
+            }
+            else {
+                if(depth == capacity) {
+                    dir_frame_t* grown = realloc(stack, sizeof(dir_frame_t) * capacity * 2);
+
+                    if(!grown) {
+                        if(dir_fd != -1) {
+                            close(dir_fd);
+                        }
+
+                        completed = false;
+                        break;
+                    }
+
+                    stack = grown;
+                    capacity *= 2;
+                }
+
+                // make room for this fd by closing the one furthest from the top
+                if(open_fds == MAX_ANCESTOR_FDS) {
+                    dir_frame_t* oldest = &stack[depth - open_fds];
+
+                    close(oldest->fd);
+                    oldest->fd = -1;
+                    open_fds--;
+                }
+
+                // spilled names start where the file was before the visit
+                if(subdirs == WALK_SPILLED) {
+                    subdirs = NULL;
+                }
+
+                stack[depth++] = (dir_frame_t){ next_path, subdirs, num_subdirs, 0, dir_fd, mark, file_mark, file_mark };
+                open_fds++;
+            }
+        }
+
+        if(depth == 0) {
+            break;
+        }
+
+        dir_frame_t* top = &stack[depth - 1];
+
+        // all subdirectories visited, go back up to the parent
+        if(top->next == top->num_subdirs) {
+            depth--;
+
+            if(depth > 0 && stack[depth - 1].fd == -1) {
+                stack[depth - 1].fd = reopenDirectory(&stack[depth - 1], top->fd);
+
+                if(stack[depth - 1].fd != -1) {
+                    open_fds++;
+                }
+            }
+
+            if(top->fd != -1) {
+                close(top->fd);
+                open_fds--;
+            }
+
+            arenaRewind(paths, top->mark);
+
+            if(!top->subdirs) {
+                subdirFileRewind(subdir_file, top->file_mark);
+            }
+
+            next_path = NULL;
+            continue;
+        }
+
+        // subdirectories are opened by name relative to the parent, or by their path if it was closed
+        // the path of a spilled one is made in place of the last one's, which is done with
+        if(top->subdirs) {
+            next_path = top->subdirs[top->next++];
+        }
+        else {
+            char name[NAME_MAX + 1];
+
+            // a name that can't be read back ends the list
+            if(!subdirFileRead(subdir_file, &top->file_next, name)) {
+                top->next = top->num_subdirs;
+                next_path = NULL;
+                continue;
+            }
+
+            arenaRewind(paths, top->mark);
+            next_path = joinPath(paths, top->path, name);
+
+            if(!next_path) {
+                completed = false;
+                break;
+            }
+
+            top->next++;
+        }
+
+        next_name = top->fd != -1 ? strrchr(next_path, '/') + 1 : next_path;
+        at_fd = top->fd != -1 ? top->fd : AT_FDCWD;
+    }
+
+    // only left with directories on the stack if it ended early
+    for(size_t i = 0; i < depth; i++) {
+        if(stack[i].fd != -1) {
+            close(stack[i].fd);
+        }
+    }
+
+    arenaRewind(paths, start);
+    free(stack);
+
+    return completed;
+}
+
+// open the directory of frame again after its fd was closed, from its path if that is short enough for
+// the kernel, otherwise as the parent of child_fd (the subdirectory of frame we are coming back from)
+// returns -1 if it can't be opened, its subdirectories are then opened by their full path
+static int reopenDirectory(dir_frame_t* frame, int child_fd) {
+    if(strlen(frame->path) < PATH_MAX || child_fd == -1) {
+        return open(frame->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
     }
 
-    // print all of the files we grabbed in this directory
-    listFiles(options, entry_vector, dir_fd);
+    return openat(child_fd, "..", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+// open a directory whose path is longer than the kernel accepts (PATH_MAX), by walking down to it in
+// pieces that are short enough, each opened relative to the one before
+static int openLongPath(char* path) {
+    size_t length = strlen(path);
+    size_t start = 0;
+    int at_fd = AT_FDCWD;
+    char piece[PATH_MAX];
+
+    while(start < length) {
+        size_t end = length;
+
+        // cut the piece at the last '/' that keeps it short enough
+        if(end - start >= PATH_MAX) {
+            end = start + PATH_MAX - 1;
+
+            while(end > start && path[end] != '/') {
+                end--;
+            }
+        }
+
+        int dir_fd = -1;
+        int error = ENAMETOOLONG;
 
-    // if we're recursively printing, we might have some directories in dir_vector to list
-    for(size_t i = 0; i < dir_vector->length; i++) {
-        printf("\n");
+        // a single name too long for PATH_MAX can't be opened
+        if(end > start) {
+            memcpy(piece, &path[start], end - start);
+            piece[end - start] = '\0';
 
-        int path_length = strlen(path);
+            dir_fd = openat(at_fd, piece, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            error = errno;
+        }
+
+        if(at_fd != AT_FDCWD) {
+            close(at_fd);
+        }
 
-        // ls ignores extra slashes at the end of the directory, so cut them off
-        while(path_length > 0 && path[path_length - 1] == '/') {
-            path_length--;
+        if(dir_fd == -1) {
+            errno = error;
+            return -1;
         }
 
-        // create a string for the current path + '/' + the name of the directory in dir_vector
-        // +2: 1 for '/', 1 for '\0'
-        size_t new_path_len = path_length + strlen(dir_vector->items[i]) + 2;
-        char* new_path = malloc(sizeof(char) * new_path_len);
+        at_fd = dir_fd;
+        start = end;
 
-        if(new_path == NULL) {
-            printf("malloc() failed... exiting\n");
-            exit(EXIT_FAILURE);
+        while(start < length && path[start] == '/') {
+            start++;
         }
+    }
 
-        snprintf(new_path, new_path_len, "%.*s/%s", path_length, path, dir_vector->items[i]);
+    return at_fd;
+}
 
-        // recursively list the directory
-        // base case: no more directories
-        listDirectory(options, new_path);
+// create a string for the given path + '/' + name, allocated from arena (NULL if out of memory)
+char* joinPath(arena_t* arena, char* path, char* name) {
+    int path_length = strlen(path);
 
-        free(new_path);
+    // ls ignores extra slashes at the end of the directory, so cut them off
+    while(path_length > 0 && path[path_length - 1] == '/') {
+        path_length--;
     }
 
-    // items inside dir_vector are the same as those in entry_vector, only free once
-    for(size_t i = 0; i < entry_vector->length; i++) {
-        free(entry_vector->items[i]);
+    // +2: 1 for '/', 1 for '\0'
+    size_t name_length = strlen(name);
+    char* new_path = arenaAlloc(arena, path_length + name_length + 2);
+
+    if(!new_path) {
+        return NULL;
     }
 
-    // free malloc-ed memory :)
-    vectorFree(entry_vector);
-    vectorFree(dir_vector);
+    memcpy(new_path, path, path_length);
+    new_path[path_length] = '/';
+    memcpy(&new_path[path_length + 1], name, name_length + 1);
 
-    closedir(directory);
-}
\ No newline at end of file
+    return new_path;
+}
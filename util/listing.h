@@ -4,8 +4,38 @@
 #include <stdbool.h>
 #include "../lsc.h"
 #include "vector.h"
+#include "context.h"
+#include "arena.h"
+#include "entries.h"
+#include "output.h"
 
-void listFiles(options_t* options, vector_t* files, int dir_fd);
-void listDirectory(options_t* options, char* path);
+// with -U, entries are read, stat-ed and printed this many at a time
+#define STREAM_WINDOW_SIZE 4096
+
+void listFiles(context_t* context, vector_t* files, int dir_fd);
+void orderEntries(context_t* context, entry_info_t* entry_infos, vector_t* files);
+void processEntries(context_t* context, entry_info_t* entry_infos, vector_t* files, int dir_fd);
+void printEntries(context_t* context, entry_info_t* entry_infos, size_t count);
+void printSeparator(output_t* out, options_t* options);
+void printDirectoryError(context_t* context, const char* what, char* path, int error);
+void printHeader(output_t* out, char* path);
+int openDirectory(context_t* context, int at_fd, char* name, char* path);
+char** listDirectoryContents(context_t* context, char* path, int dir_fd, size_t* num_subdirs);
+void listDirectory(context_t* context, char* path);
+
+// called by walkTree for every directory, see walkTree
+typedef char** (*walk_visit_t)(void* arg, char* path, int dir_fd, int error, bool first, size_t* num_subdirs);
+
+// returned by a walk_visit_t to end the walk early
+#define WALK_STOP ((char**)-1)
+
+// returned by a walk_visit_t (and listDirectoryContents) whose num_subdirs subdirectories were written to the
+// subdirectory file instead, by name at its end
+#define WALK_SPILLED ((char**)-2)
+
+struct subdir_file_t;
+
+bool walkTree(arena_t* paths, struct subdir_file_t* subdir_file, char* path, walk_visit_t visit, void* arg);
+char* joinPath(arena_t* arena, char* path, char* name);
 
 #endif
\ No newline at end of file
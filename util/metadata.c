@@ -0,0 +1,61 @@
+// _GNU_SOURCE needed for statx
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdbool.h>
+#include <dirent.h> // DT_*
+#include <sys/stat.h>
+
+#include "../lsc.h"
+#include "metadata.h"
+
+// work out the minimal statx mask for the given options
+void metadataPlan(metadata_plan_t* plan, options_t* options) {
+    plan->mask = 0;
+
+    if(options->index) {
+        plan->mask |= STATX_INO;
+    }
+
+    if(options->long_list) {
+        plan->mask |= METADATA_LONG_MASK;
+    }
+
+    if(options->format != FORMAT_TEXT) {
+        plan->mask |= METADATA_RECORD_MASK;
+    }
+
+    if(options->du) {
+        plan->mask |= METADATA_DU_MASK;
+    }
+
+    // the sort keys of -S and -t (unless -U leaves the entries unsorted)
+    if(!options->unsorted && options->sort_by == SORT_SIZE) {
+        plan->mask |= STATX_SIZE;
+    }
+
+    if(!options->unsorted && options->sort_by == SORT_TIME) {
+        plan->mask |= STATX_MTIME;
+    }
+
+    plan->read_links = options->long_list || options->format != FORMAT_TEXT;
+
+    // -i on its own only needs the inode number, which readdir already gave us
+    plan->dirent_sufficient = plan->mask == STATX_INO;
+}
+
+// whether an entry of the given type (DT_UNKNOWN for paths not read from a directory) has to be stat-ed
+bool metadataNeedsStat(metadata_plan_t* plan, unsigned char d_type) {
+    if(plan->mask == 0) {
+        return false;
+    }
+
+    // the d_ino of a mount point is the inode underneath it rather than the mounted root,
+    // so directories are still stat-ed to print the same number as stat would
+    if(plan->dirent_sufficient) {
+        return d_type == DT_UNKNOWN || d_type == DT_DIR;
+    }
+
+    return true;
+}
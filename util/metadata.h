@@ -0,0 +1,27 @@
+#ifndef _METADATA_H_
+#define _METADATA_H_
+
+#include <stdbool.h>
+#include <sys/stat.h>
+#include "../lsc.h"
+
+// statx fields printed by -l
+#define METADATA_LONG_MASK (STATX_TYPE | STATX_MODE | STATX_NLINK | STATX_UID | STATX_GID | STATX_SIZE | STATX_MTIME)
+
+// statx fields of the records of --format=nul / json
+#define METADATA_RECORD_MASK (METADATA_LONG_MASK | STATX_INO)
+
+// statx fields added up by --du (the inode number and link count to count hard links once)
+#define METADATA_DU_MASK (STATX_TYPE | STATX_MODE | STATX_NLINK | STATX_INO | STATX_SIZE | STATX_BLOCKS)
+
+// which metadata the active options need and how to get it, worked out once per run
+typedef struct metadata_plan_t {
+    unsigned int mask;     // STATX_* fields to request, 0 if nothing needs a stat
+    bool dirent_sufficient; // the fields are all available from readdir, only stat entries it can't vouch for
+    bool read_links;        // the targets of symbolic links are printed
+} metadata_plan_t;
+
+void metadataPlan(metadata_plan_t* plan, options_t* options);
+bool metadataNeedsStat(metadata_plan_t* plan, unsigned char d_type);
+
+#endif
@@ -0,0 +1,241 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h> // memcpy / strlen
+#include <errno.h>
+#include <unistd.h> // write / isatty
+#include <sys/uio.h> // writev
+
+#include "output.h"
+
+// initial capacity of an in-memory output
+static const size_t MEMORY_INITIAL_CAPACITY = 4096;
+
+// longest run of spaces written at once by outputPadded
+#define PADDING_SIZE 64
+static const char PADDING[PADDING_SIZE + 1] = "                                                                ";
+
+static void writeAll(output_t* out, struct iovec* iov, int iovcnt);
+
+// creates an output writing to fd, or kept in memory if fd is -1
+// returns NULL if out of memory
+output_t* outputCreate(int fd) {
+    return outputCreateSized(fd, fd == -1 ? MEMORY_INITIAL_CAPACITY : OUTPUT_BUFFER_SIZE);
+}
+
+// outputCreate with a buffer of capacity bytes (the initial capacity of a memory output)
+output_t* outputCreateSized(int fd, size_t capacity) {
+    output_t* out = malloc(sizeof(output_t));
+
+    if(!out) {
+        return NULL;
+    }
+
+    out->fd = fd;
+    out->length = 0;
+    out->capacity = capacity;
+    out->interactive = fd != -1 && isatty(fd);
+    out->stats = NULL;
+    out->error = 0;
+    out->buffer = malloc(out->capacity);
+
+    if(!out->buffer) {
+        free(out);
+        return NULL;
+    }
+
+    return out;
+}
+
+// append length bytes of str
+void outputWrite(output_t* out, const char* str, size_t length) {
+    if(out->capacity - out->length >= length) {
+        memcpy(&out->buffer[out->length], str, length);
+        out->length += length;
+        return;
+    }
+
+    // doesn't fit, memory outputs grow (from nothing if outputTake couldn't give them a new buffer)
+    if(out->fd == -1) {
+        size_t capacity = out->capacity != 0 ? out->capacity * 2 : MEMORY_INITIAL_CAPACITY;
+
+        while(capacity - out->length < length) {
+            capacity *= 2;
+        }
+
+        char* buffer = realloc(out->buffer, capacity);
+
+        if(!buffer) {
+            out->error = ENOMEM;
+            return;
+        }
+
+        out->buffer = buffer;
+        out->capacity = capacity;
+        memcpy(&out->buffer[out->length], str, length);
+        out->length += length;
+        return;
+    }
+
+    // otherwise write out what we have, along with str directly if it's bigger than the buffer
+    if(length >= out->capacity) {
+        struct iovec iov[2] = {
+            { out->buffer, out->length },
+            { (void*)str, length },
+        };
+
+        writeAll(out, iov, 2);
+        out->length = 0;
+        return;
+    }
+
+    outputFlush(out);
+    memcpy(out->buffer, str, length);
+    out->length = length;
+}
+
+// append a null terminated string
+void outputString(output_t* out, const char* str) {
+    outputWrite(out, str, strlen(str));
+}
+
+// append a single character
+void outputChar(output_t* out, char c) {
+    if(out->length == out->capacity) {
+        outputWrite(out, &c, 1);
+        return;
+    }
+
+    out->buffer[out->length++] = c;
+}
+
+// append str padded with spaces to width, on the right if left_align otherwise on the left
+// (equivalent to printf "%-*s" / "%*s")
+void outputPadded(output_t* out, const char* str, size_t length, unsigned width, bool left_align) {
+    size_t padding = length < width ? width - length : 0;
+
+    if(left_align) {
+        outputWrite(out, str, length);
+    }
+
+    for(; padding > PADDING_SIZE; padding -= PADDING_SIZE) {
+        outputWrite(out, PADDING, PADDING_SIZE);
+    }
+
+    outputWrite(out, PADDING, padding);
+
+    if(!left_align) {
+        outputWrite(out, str, length);
+    }
+}
+
+// append value in decimal, right aligned to width (equivalent to printf "%*lu")
+void outputUnsigned(output_t* out, uint64_t value, unsigned width) {
+    char buffer[20];
+    size_t length = formatUnsigned(buffer, value);
+
+    outputPadded(out, buffer, length, width, false);
+}
+
+// called once a listing is complete; terminals see it straight away, otherwise it waits for the buffer to fill
+void outputCheckpoint(output_t* out) {
+    if(out->interactive) {
+        outputFlush(out);
+    }
+}
+
+// write out everything buffered (nothing to do for memory outputs)
+void outputFlush(output_t* out) {
+    if(out->fd == -1 || out->length == 0) {
+        return;
+    }
+
+    struct iovec iov = { out->buffer, out->length };
+
+    writeAll(out, &iov, 1);
+    out->length = 0;
+}
+
+// hand the contents of a memory output to the caller (who has to free them) and empty it
+// if a new buffer can't be allocated the output is left without one, the next write tries again
+char* outputTake(output_t* out, size_t* length) {
+    char* buffer = out->buffer;
+    *length = out->length;
+
+    out->capacity = MEMORY_INITIAL_CAPACITY;
+    out->length = 0;
+    out->buffer = malloc(out->capacity);
+
+    if(!out->buffer) {
+        out->capacity = 0;
+    }
+
+    return buffer;
+}
+
+// flush and free the output (the fd is not closed)
+void outputFree(output_t* out) {
+    outputFlush(out);
+    free(out->buffer);
+    free(out);
+}
+
+// writev to out's fd until everything is written, retrying partial writes
+// a write error (e.g. a closed pipe) is kept in out->error, like stdio the output is dropped from there on
+static void writeAll(output_t* out, struct iovec* iov, int iovcnt) {
+    if(out->error != 0) {
+        return;
+    }
+
+    uint64_t start = statsStart(out->stats);
+
+    while(iovcnt > 0) {
+        ssize_t written = writev(out->fd, iov, iovcnt);
+
+        if(written == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
+
+            out->error = errno;
+            break;
+        }
+
+        // skip past whatever was written
+        while(iovcnt > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+
+        if(iovcnt > 0) {
+            iov->iov_base = (char*)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+
+    statsStop(out->stats, STATS_WRITE, start);
+}
+
+// number of decimal digits of value
+unsigned digitCount(uint64_t value) {
+    unsigned digits = 1;
+
+    for(; value >= 10; value /= 10) {
+        digits++;
+    }
+
+    return digits;
+}
+
+// write the decimal digits of value to buffer (not nul terminated), returns how many were written
+size_t formatUnsigned(char* buffer, uint64_t value) {
+    size_t length = digitCount(value);
+
+    for(size_t i = length; i > 0; i--) {
+        buffer[i - 1] = '0' + value % 10;
+        value /= 10;
+    }
+
+    return length;
+}
@@ -0,0 +1,41 @@
+#ifndef _OUTPUT_H_
+#define _OUTPUT_H_
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "stats.h"
+
+// size of the buffer of an output writing to a file descriptor
+#define OUTPUT_BUFFER_SIZE (256 * 1024)
+
+// buffered writer used for all listing output instead of stdio
+// with fd == -1 everything is kept in memory (buffer grows as needed) until taken with outputTake
+typedef struct output_t {
+    int fd;
+    char* buffer;
+    size_t length;
+    size_t capacity;
+    bool interactive; // fd is a terminal, flushed at every checkpoint so output appears as it is produced
+    stats_t* stats;   // where writes are timed with --stats, NULL otherwise
+    int error;        // ENOMEM once a memory output couldn't grow (what didn't fit is dropped), the errno of
+                      // the first failed write to fd (nothing more is written), 0 otherwise
+} output_t;
+
+output_t* outputCreate(int fd);
+output_t* outputCreateSized(int fd, size_t capacity);
+void outputWrite(output_t* out, const char* str, size_t length);
+void outputString(output_t* out, const char* str);
+void outputChar(output_t* out, char c);
+void outputPadded(output_t* out, const char* str, size_t length, unsigned width, bool left_align);
+void outputUnsigned(output_t* out, uint64_t value, unsigned width);
+void outputCheckpoint(output_t* out);
+void outputFlush(output_t* out);
+char* outputTake(output_t* out, size_t* length);
+void outputFree(output_t* out);
+
+unsigned digitCount(uint64_t value);
+size_t formatUnsigned(char* buffer, uint64_t value);
+
+#endif
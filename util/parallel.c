@@ -0,0 +1,369 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h> // strdup
+#include <pthread.h>
+#include <fcntl.h> // AT_FDCWD
+#include <unistd.h> // close
+
+#include "../lsc.h"
+#include "parallel.h"
+#include "listing.h"
+#include "context.h"
+#include "vector.h"
+#include "workpool.h"
+#include "output.h"
+#include "arena.h"
+
+// bytes of finished listings the workers may hold before they stop taking new directories, until the
+// printer catches up
+#define OUTPUT_BUDGET (1024 * 1024)
+
+// first number of frames on printTree's stack, doubled when needed
+#define INITIAL_STACK_SIZE 64
+
+// one directory of the tree; filled in by a worker, printed and freed by the main thread
+typedef struct dir_node_t {
+    char* path;
+    struct traversal_t* traversal;
+
+    // what listDirectoryContents printed for this directory
+    char* output;
+    size_t output_len;
+
+    // subdirectories in the order they are printed, set before done
+    struct dir_node_t** children;
+    size_t num_children;
+
+    // protected by traversal->done_lock
+    bool queued;  // not taken by a worker yet (or waiting in listNode), which frees the node if it is printed
+    bool claimed; // being listed, by a worker or by the printer
+    bool printed; // printed and freed but for the node itself, left to the queued listNode
+    bool done;
+} dir_node_t;
+
+typedef struct traversal_t {
+    workpool_t* pool;
+    context_t** contexts; // one per worker
+
+    pthread_mutex_t done_lock;
+    pthread_cond_t done_cond;  // a node is done
+    pthread_cond_t space_cond; // printed output made room in the budget, or the printer is waiting on a new node
+
+    size_t buffered;     // bytes of output of done nodes not printed yet
+    dir_node_t* waiting; // the node the printer waits for, it is listed even over the budget
+} traversal_t;
+
+// a directory being printed by printTree, it stays on the stack until its children are printed
+typedef struct node_frame_t {
+    dir_node_t* node;
+    size_t next; // index of the next child to print
+} node_frame_t;
+
+static dir_node_t* nodeCreate(traversal_t* traversal, char* path);
+static void listNode(void* arg, size_t worker);
+static void expandNode(traversal_t* traversal, dir_node_t* node, context_t* context, size_t worker);
+static void printTree(traversal_t* traversal, dir_node_t* root, context_t* context);
+static void printNode(traversal_t* traversal, dir_node_t* node, context_t* context);
+static void nodeFree(traversal_t* traversal, dir_node_t* node);
+
+// lists the given directory recursively using options->threads worker threads
+// worker threads read, stat and format directories in any order, the calling thread prints them
+// in the same order (and with the same output) as listDirectory; the workers stay at most about
+// OUTPUT_BUDGET bytes of output ahead of it
+void listDirectoryParallel(context_t* context, char* path) {
+    options_t* options = context->options;
+    traversal_t traversal;
+
+    pthread_mutex_init(&traversal.done_lock, NULL);
+    pthread_cond_init(&traversal.done_cond, NULL);
+    pthread_cond_init(&traversal.space_cond, NULL);
+    traversal.buffered = 0;
+    traversal.waiting = NULL;
+
+    traversal.contexts = malloc(sizeof(context_t*) * options->threads);
+
+    if(!traversal.contexts) {
+        printf("malloc() failed...exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for(size_t i = 0; i < options->threads; i++) {
+        traversal.contexts[i] = contextFork(context);
+
+        if(!traversal.contexts[i]) {
+            printf("malloc() failed...exiting\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    traversal.pool = workpoolCreate(options->threads);
+
+    // path belongs to the caller, the node frees its own copy
+    char* root_path = strdup(path);
+
+    if(!root_path) {
+        printf("malloc() failed...exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    dir_node_t* root = nodeCreate(&traversal, root_path);
+
+    workpoolSubmit(traversal.pool, 0, listNode, root);
+    printTree(&traversal, root, context);
+
+    workpoolFree(traversal.pool);
+
+    for(size_t i = 0; i < options->threads; i++) {
+        if(context->stats) {
+            statsAdd(context->stats, traversal.contexts[i]->stats);
+        }
+
+        arenaAddStats(context->names, traversal.contexts[i]->names);
+        arenaAddStats(context->paths, traversal.contexts[i]->paths);
+        contextFree(traversal.contexts[i]);
+    }
+
+    free(traversal.contexts);
+    pthread_mutex_destroy(&traversal.done_lock);
+    pthread_cond_destroy(&traversal.done_cond);
+    pthread_cond_destroy(&traversal.space_cond);
+}
+
+// create a node for path, which must be malloc-ed and is freed with the node
+static dir_node_t* nodeCreate(traversal_t* traversal, char* path) {
+    dir_node_t* node = malloc(sizeof(dir_node_t));
+
+    if(!node) {
+        printf("malloc() failed...exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    node->path = path;
+    node->traversal = traversal;
+    node->output = NULL;
+    node->output_len = 0;
+    node->children = NULL;
+    node->num_children = 0;
+    node->queued = true;
+    node->claimed = false;
+    node->printed = false;
+    node->done = false;
+
+    return node;
+}
+
+// worker task: list one directory into memory and queue up its subdirectories
+// while the printer is more than OUTPUT_BUDGET behind, the worker waits here (unless it holds the node the
+// printer waits for) and the printer may take the node over
+static void listNode(void* arg, size_t worker) {
+    dir_node_t* node = arg;
+    traversal_t* traversal = node->traversal;
+    context_t* context = traversal->contexts[worker];
+
+    pthread_mutex_lock(&traversal->done_lock);
+
+    while(!node->claimed && traversal->buffered > OUTPUT_BUDGET && traversal->waiting != node) {
+        pthread_cond_wait(&traversal->space_cond, &traversal->done_lock);
+    }
+
+    // the printer listed it itself, and frees it if it isn't done with it yet
+    if(node->claimed) {
+        bool printed = node->printed;
+        node->queued = false;
+        pthread_mutex_unlock(&traversal->done_lock);
+
+        if(printed) {
+            free(node);
+        }
+
+        return;
+    }
+
+    node->claimed = true;
+    node->queued = false;
+    pthread_mutex_unlock(&traversal->done_lock);
+
+    // the worker's context prints into memory, which the node takes over
+    expandNode(traversal, node, context, worker);
+
+    // output that didn't fit in memory can't be printed in its place
+    if(context->out->error != 0) {
+        printf("malloc() failed...exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    node->output = outputTake(context->out, &node->output_len);
+
+    pthread_mutex_lock(&traversal->done_lock);
+    node->done = true;
+    traversal->buffered += node->output_len;
+    pthread_cond_broadcast(&traversal->done_cond);
+    pthread_mutex_unlock(&traversal->done_lock);
+}
+
+// list the node's directory to context->out and create its children, queued on the deque of worker
+static void expandNode(traversal_t* traversal, dir_node_t* node, context_t* context, size_t worker) {
+    arena_mark_t mark = arenaMark(context->paths);
+    size_t num_subdirs = 0;
+    char** subdirs = NULL;
+    int dir_fd = openDirectory(context, AT_FDCWD, node->path, node->path);
+
+    if(dir_fd != -1) {
+        subdirs = listDirectoryContents(context, node->path, dir_fd, &num_subdirs);
+        close(dir_fd);
+    }
+
+    // a listing cut short can't be printed in its place
+    if(context->error != 0) {
+        printf("malloc() failed...exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if(num_subdirs > 0) {
+        node->children = malloc(sizeof(dir_node_t*) * num_subdirs);
+
+        if(!node->children) {
+            printf("malloc() failed...exiting\n");
+            exit(EXIT_FAILURE);
+        }
+
+        node->num_children = num_subdirs;
+
+        // the children outlive the context's arena, so they get their own copy of the path
+        for(size_t i = 0; i < num_subdirs; i++) {
+            char* path = strdup(subdirs[i]);
+
+            if(!path) {
+                printf("malloc() failed...exiting\n");
+                exit(EXIT_FAILURE);
+            }
+
+            node->children[i] = nodeCreate(traversal, path);
+        }
+
+        // pushed last to first so this worker carries on with the first child (the next one printed),
+        // while idle workers steal from the other end
+        for(size_t i = num_subdirs; i > 0; i--) {
+            workpoolSubmit(traversal->pool, worker, listNode, node->children[i - 1]);
+        }
+    }
+
+    arenaRewind(context->paths, mark);
+}
+
+// print the tree at root depth first to context->out as its nodes are listed, freeing them along the way
+// like walkTree, the directories being printed are kept on an explicit stack
+static void printTree(traversal_t* traversal, dir_node_t* root, context_t* context) {
+    size_t capacity = INITIAL_STACK_SIZE;
+    size_t depth = 0;
+    node_frame_t* stack = malloc(sizeof(node_frame_t) * capacity);
+
+    if(!stack) {
+        printf("malloc() failed...exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    printNode(traversal, root, context);
+    stack[depth++] = (node_frame_t){ root, 0 };
+
+    while(depth > 0) {
+        node_frame_t* frame = &stack[depth - 1];
+
+        if(frame->next == frame->node->num_children) {
+            nodeFree(traversal, frame->node);
+            depth--;
+            continue;
+        }
+
+        dir_node_t* child = frame->node->children[frame->next++];
+
+        printSeparator(context->out, context->options);
+        printNode(traversal, child, context);
+
+        if(depth == capacity) {
+            capacity *= 2;
+            node_frame_t* grown = realloc(stack, sizeof(node_frame_t) * capacity);
+
+            if(!grown) {
+                printf("malloc() failed...exiting\n");
+                exit(EXIT_FAILURE);
+            }
+
+            stack = grown;
+        }
+
+        stack[depth++] = (node_frame_t){ child, 0 };
+    }
+
+    free(stack);
+}
+
+// print one node to context->out once it is listed
+// if the workers are over the budget and nobody has started on it, it is listed here, straight to context->out
+static void printNode(traversal_t* traversal, dir_node_t* node, context_t* context) {
+    output_t* out = context->out;
+    bool list_here = false;
+
+    pthread_mutex_lock(&traversal->done_lock);
+
+    // a worker holding this node can go ahead
+    traversal->waiting = node;
+    pthread_cond_broadcast(&traversal->space_cond);
+
+    while(!node->done) {
+        // the workers may all be waiting on other nodes while this one is still queued
+        if(!node->claimed && traversal->buffered > OUTPUT_BUDGET) {
+            node->claimed = true;
+            list_here = true;
+            break;
+        }
+
+        pthread_cond_wait(&traversal->done_cond, &traversal->done_lock);
+    }
+
+    traversal->waiting = NULL;
+    pthread_mutex_unlock(&traversal->done_lock);
+
+    if(list_here) {
+        expandNode(traversal, node, context, 0);
+        outputCheckpoint(out);
+        return;
+    }
+
+    outputWrite(out, node->output, node->output_len);
+    outputCheckpoint(out);
+    free(node->output);
+    node->output = NULL;
+
+    pthread_mutex_lock(&traversal->done_lock);
+    traversal->buffered -= node->output_len;
+
+    // waiting workers are woken once there is room for a few directories, not after every one
+    if(traversal->buffered <= OUTPUT_BUDGET / 2) {
+        pthread_cond_broadcast(&traversal->space_cond);
+    }
+
+    pthread_mutex_unlock(&traversal->done_lock);
+}
+
+// free a printed node and its list of children, the node itself is left to listNode if it is still queued
+static void nodeFree(traversal_t* traversal, dir_node_t* node) {
+    free(node->children);
+    free(node->path);
+
+    pthread_mutex_lock(&traversal->done_lock);
+    bool queued = node->queued;
+    node->printed = true;
+
+    // a worker may be waiting on it
+    if(queued) {
+        pthread_cond_broadcast(&traversal->space_cond);
+    }
+
+    pthread_mutex_unlock(&traversal->done_lock);
+
+    if(!queued) {
+        free(node);
+    }
+}
@@ -0,0 +1,8 @@
+#ifndef _PARALLEL_H_
+#define _PARALLEL_H_
+
+#include "context.h"
+
+void listDirectoryParallel(context_t* context, char* path);
+
+#endif
@@ -0,0 +1,551 @@
+// _DEFAULT_SOURCE needed for DT_DIR
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h> // strcmp / memcpy
+#include <errno.h>
+#include <dirent.h> // DT_DIR
+#include <fcntl.h> // open
+#include <unistd.h> // close
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+
+#include "../lsc.h"
+#include "pipeline.h"
+#include "listing.h"
+#include "record.h"
+#include "context.h"
+#include "entries.h"
+#include "utility.h"
+#include "dirreader.h"
+#include "queue.h"
+#include "vector.h"
+#include "output.h"
+#include "arena.h"
+#include "sort.h"
+#include "stats.h"
+
+// entries of a listing handed to a metadata worker at once
+#define PIPELINE_BATCH_SIZE 256
+
+// listings the reader may have read ahead of the one being printed
+#define PIPELINE_DEPTH 64
+
+// batches waiting for a metadata worker
+#define PIPELINE_QUEUE_SIZE 1024
+
+// one listing of a directory (all of it, or a window of it with -U): read and sorted by the reader thread,
+// its entries processed in batches by the metadata workers, then printed by the formatter
+typedef struct part_t {
+    arena_t* arena; // holds the part, its path, names and entries
+    char* path;
+    bool first;     // first part of its directory, printed after the separator and the header
+    bool separator; // first part of a directory other than the first one listed, preceded by a blank line
+    bool last;      // last part of its directory, closes dir_fd once printed
+    int dir_fd;     // a copy of the walker's, -1 if the directory couldn't be opened
+    int open_error;
+    int read_error; // printed before the entries of the last part
+    uint64_t started;   // when the reader opened the directory, for --stats
+    size_t dir_entries; // entries in the whole directory, set in the last part
+
+    char** names;
+    entry_info_t* entry_infos;
+    size_t count;
+
+    struct batch_t* batches;
+    size_t num_batches;
+    atomic_size_t batches_left;
+    sem_t done; // posted when the last batch has been processed
+} part_t;
+
+// a range of the entries of a part for a metadata worker
+typedef struct batch_t {
+    part_t* part;
+    size_t start;
+    size_t count;
+    arena_t* arena; // for what processEntry allocates (link targets), kept until the part is printed
+} batch_t;
+
+typedef struct pipeline_t {
+    context_t* context;  // the caller's, used by the formatter
+    context_t** workers; // one per metadata worker
+    size_t num_workers;
+    pthread_t reader;
+    pthread_t* threads;
+
+    queue_t* parts;   // reader to formatter, in the order they are printed
+    queue_t* batches; // reader to metadata workers
+
+    // only used by the reader thread
+    stats_t* stats; // the reader's --stats counters, NULL if disabled
+    char* root;
+    char* read_buffer;
+    arena_t* paths;    // paths of the subdirectories still to be read, used as a stack by walkTree
+    vector_t* names;   // names of the part being read
+    vector_t* subdirs; // paths of the subdirectories of the directory being read
+
+    // arenas of printed parts and batches, reused for new ones
+    pthread_mutex_t pool_lock;
+    arena_t** pool;
+    size_t pool_length;
+    size_t pool_capacity;
+} pipeline_t;
+
+// passed to each metadata worker so it knows which context is its own
+typedef struct worker_arg_t {
+    pipeline_t* pipeline;
+    size_t worker;
+} worker_arg_t;
+
+static void* readerMain(void* arg);
+static char** readVisit(void* arg, char* path, int dir_fd, int error, bool first, size_t* num_subdirs);
+static part_t* partCreate(pipeline_t* pipeline, char* path, int dir_fd);
+static void partSubmit(pipeline_t* pipeline, part_t* part);
+static void* workerMain(void* arg);
+static void printPart(pipeline_t* pipeline, part_t* part);
+static arena_t* poolGet(pipeline_t* pipeline);
+static void poolPut(pipeline_t* pipeline, arena_t* arena);
+
+// lists the given directory (recursive with -R option) in three stages running at the same time:
+// a reader thread reads (and sorts) the directories in the order they are printed, metadata workers
+// (options->threads of them) stat their entries in batches, and the calling thread prints them
+// the reader stays up to PIPELINE_DEPTH listings ahead, so the next directories are read while the
+// current one is stat-ed and printed; the output is the same as listDirectory
+void listDirectoryPipelined(context_t* context, char* path) {
+    options_t* options = context->options;
+    pipeline_t pipeline;
+
+    pipeline.context = context;
+    pipeline.num_workers = options->threads;
+    pipeline.workers = malloc(sizeof(context_t*) * pipeline.num_workers);
+    pipeline.threads = malloc(sizeof(pthread_t) * pipeline.num_workers);
+    pipeline.read_buffer = malloc(options->read_buffer_size);
+
+    if(!pipeline.workers || !pipeline.threads || !pipeline.read_buffer) {
+        printf("malloc() failed...exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    pipeline.parts = queueCreate(PIPELINE_DEPTH);
+    pipeline.batches = queueCreate(PIPELINE_QUEUE_SIZE);
+    pipeline.root = path;
+    pipeline.paths = arenaCreate();
+    pipeline.names = vectorCreate();
+    pipeline.subdirs = vectorCreate();
+    pipeline.stats = context->stats ? statsCreate() : NULL;
+
+    if(!pipeline.paths || !pipeline.names || !pipeline.subdirs || (context->stats && !pipeline.stats)) {
+        printf("malloc() failed...exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_mutex_init(&pipeline.pool_lock, NULL);
+    pipeline.pool = NULL;
+    pipeline.pool_length = 0;
+    pipeline.pool_capacity = 0;
+
+    for(size_t i = 0; i < pipeline.num_workers; i++) {
+        worker_arg_t* arg = malloc(sizeof(worker_arg_t));
+
+        if(!arg) {
+            printf("malloc() failed...exiting\n");
+            exit(EXIT_FAILURE);
+        }
+
+        arg->pipeline = &pipeline;
+        arg->worker = i;
+
+        pipeline.workers[i] = contextFork(context);
+
+        if(!pipeline.workers[i]) {
+            printf("malloc() failed...exiting\n");
+            exit(EXIT_FAILURE);
+        }
+
+        if(pthread_create(&pipeline.threads[i], NULL, workerMain, arg) != 0) {
+            printf("pthread_create() failed...exiting\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if(pthread_create(&pipeline.reader, NULL, readerMain, &pipeline) != 0) {
+        printf("pthread_create() failed...exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // the reader ends the parts with NULL
+    for(part_t* part = queuePop(pipeline.parts); part != NULL; part = queuePop(pipeline.parts)) {
+        printPart(&pipeline, part);
+    }
+
+    pthread_join(pipeline.reader, NULL);
+
+    for(size_t i = 0; i < pipeline.num_workers; i++) {
+        pthread_join(pipeline.threads[i], NULL);
+
+        if(context->stats) {
+            statsAdd(context->stats, pipeline.workers[i]->stats);
+        }
+
+        contextFree(pipeline.workers[i]);
+    }
+
+    for(size_t i = 0; i < pipeline.pool_length; i++) {
+        arenaAddStats(context->names, pipeline.pool[i]);
+        arenaFree(pipeline.pool[i]);
+    }
+
+    if(pipeline.stats) {
+        statsAdd(context->stats, pipeline.stats);
+        statsFree(pipeline.stats);
+    }
+
+    arenaAddStats(context->paths, pipeline.paths);
+    arenaFree(pipeline.paths);
+    vectorFree(pipeline.names);
+    vectorFree(pipeline.subdirs);
+    queueFree(pipeline.parts);
+    queueFree(pipeline.batches);
+    pthread_mutex_destroy(&pipeline.pool_lock);
+    free(pipeline.pool);
+    free(pipeline.read_buffer);
+    free(pipeline.threads);
+    free(pipeline.workers);
+}
+
+// reader thread: walk the tree in the order it is printed (the same walk as listDirectory), handing every
+// directory read to the formatter and its entries to the metadata workers
+static void* readerMain(void* arg) {
+    pipeline_t* pipeline = arg;
+
+    if(!walkTree(pipeline->paths, NULL, pipeline->root, readVisit, pipeline)) {
+        printf("malloc() failed...exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // no more parts, and no more batches for any of the workers
+    queuePush(pipeline->parts, NULL);
+
+    for(size_t i = 0; i < pipeline->num_workers; i++) {
+        queuePush(pipeline->batches, NULL);
+    }
+
+    return NULL;
+}
+
+// walkTree callback for the reader: read the directory at path into one part (or one per window with -U)
+// and submit them; the parts get their own copy of dir_fd, the walker closes its one when it is done with it
+static char** readVisit(void* arg, char* path, int dir_fd, int error, bool first, size_t* num_subdirs) {
+    pipeline_t* pipeline = arg;
+    options_t* options = pipeline->context->options;
+    uint64_t started = statsStart(pipeline->stats);
+    size_t num_entries = 0;
+
+    *num_subdirs = 0;
+    vectorClear(pipeline->subdirs);
+
+    int part_fd = dir_fd == -1 ? -1 : fcntl(dir_fd, F_DUPFD_CLOEXEC, 0);
+    part_t* part = partCreate(pipeline, path, part_fd);
+
+    part->first = true;
+    part->separator = !first;
+    part->started = started;
+
+    // the formatter prints the error in its place
+    if(part_fd == -1) {
+        part->open_error = dir_fd == -1 ? error : errno;
+        part->last = true;
+        partSubmit(pipeline, part);
+        return NULL;
+    }
+
+    dir_reader_t reader;
+    dirReaderInit(&reader, dir_fd, pipeline->read_buffer, options->read_buffer_size, pipeline->stats);
+
+    for(dir_entry_t entry; dirReaderNext(&reader, &entry); ) {
+        // skip empty names, and hidden files unless we're printing all
+        if(entry.name[0] == '\0' || (!options->all && entry.name[0] == '.')) {
+            continue;
+        }
+
+        char* name = dirNameCopy(part->arena, &entry);
+
+        if(!name || !vectorPush(pipeline->names, name)) {
+            printf("malloc() failed...exiting\n");
+            exit(EXIT_FAILURE);
+        }
+
+        num_entries++;
+
+        // without sorting, the windows are handed on as they are read
+        if(options->unsorted && pipeline->names->length == STREAM_WINDOW_SIZE) {
+            partSubmit(pipeline, part);
+            part = partCreate(pipeline, path, part_fd);
+            part->started = started;
+        }
+    }
+
+    if(!options->unsorted) {
+        uint64_t sort_start = statsStart(pipeline->stats);
+
+        if(!sortNames(pipeline->names->items, pipeline->names->length, options->collate, part->arena)) {
+            printf("malloc() failed...exiting\n");
+            exit(EXIT_FAILURE);
+        }
+
+        statsStop(pipeline->stats, STATS_SORT, sort_start);
+    }
+
+    part->read_error = reader.error;
+    part->dir_entries = num_entries;
+    part->last = true;
+    partSubmit(pipeline, part);
+
+    *num_subdirs = pipeline->subdirs->length;
+
+    if(*num_subdirs == 0) {
+        return NULL;
+    }
+
+    char** subdirs = arenaAlloc(pipeline->paths, sizeof(char*) * *num_subdirs);
+
+    if(!subdirs) {
+        printf("malloc() failed...exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    memcpy(subdirs, pipeline->subdirs->items, sizeof(char*) * *num_subdirs);
+
+    return subdirs;
+}
+
+// start a part of the directory at path, its names are collected in pipeline->names
+static part_t* partCreate(pipeline_t* pipeline, char* path, int dir_fd) {
+    arena_t* arena = poolGet(pipeline);
+    part_t* part = arenaAlloc(arena, sizeof(part_t));
+
+    if(!part) {
+        printf("malloc() failed...exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    part->arena = arena;
+    part->path = arenaCopy(arena, path, strlen(path));
+
+    if(!part->path) {
+        printf("malloc() failed...exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    part->first = false;
+    part->separator = false;
+    part->last = false;
+    part->dir_fd = dir_fd;
+    part->open_error = 0;
+    part->read_error = 0;
+    part->started = 0;
+    part->dir_entries = 0;
+    part->names = NULL;
+    part->entry_infos = NULL;
+    part->count = 0;
+    part->batches = NULL;
+    part->num_batches = 0;
+
+    return part;
+}
+
+// hand the part (with the names in pipeline->names) to the formatter, and its batches to the workers
+// with -R, the paths of its subdirectories are added to pipeline->subdirs
+// the part belongs to the formatter from here on, it may be printed and reused before this returns
+static void partSubmit(pipeline_t* pipeline, part_t* part) {
+    vector_t* names = pipeline->names;
+    size_t count = names->length;
+    size_t num_batches = (count + PIPELINE_BATCH_SIZE - 1) / PIPELINE_BATCH_SIZE;
+
+    part->count = count;
+    part->names = arenaAlloc(part->arena, sizeof(char*) * count);
+    part->entry_infos = arenaAlloc(part->arena, sizeof(entry_info_t) * count);
+
+    if((!part->names || !part->entry_infos) && count > 0) {
+        printf("malloc() failed...exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    memcpy(part->names, names->items, sizeof(char*) * count);
+
+    if(pipeline->context->options->recursive) {
+        for(size_t i = 0; i < count; i++) {
+            char* name = part->names[i];
+
+            if(dirNameOf(name)->type == DT_DIR && strcmp(name, ".") != 0 && strcmp(name, "..") != 0) {
+                char* subdir = joinPath(pipeline->paths, part->path, name);
+
+                if(!subdir || !vectorPush(pipeline->subdirs, subdir)) {
+                    printf("malloc() failed...exiting\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+        }
+    }
+
+    vectorClear(names);
+
+    batch_t* batches = arenaAlloc(part->arena, sizeof(batch_t) * num_batches);
+
+    if(!batches && num_batches > 0) {
+        printf("malloc() failed...exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for(size_t i = 0; i < num_batches; i++) {
+        batches[i].part = part;
+        batches[i].start = i * PIPELINE_BATCH_SIZE;
+        batches[i].count = count - batches[i].start < PIPELINE_BATCH_SIZE ? count - batches[i].start : PIPELINE_BATCH_SIZE;
+        batches[i].arena = poolGet(pipeline);
+    }
+
+    part->batches = batches;
+    part->num_batches = num_batches;
+    atomic_init(&part->batches_left, num_batches);
+    sem_init(&part->done, 0, 0);
+
+    queuePush(pipeline->parts, part);
+
+    for(size_t i = 0; i < num_batches; i++) {
+        queuePush(pipeline->batches, &batches[i]);
+    }
+}
+
+// metadata worker thread: process batches until the reader sends NULL
+static void* workerMain(void* arg) {
+    worker_arg_t* worker_arg = arg;
+    pipeline_t* pipeline = worker_arg->pipeline;
+    context_t* context = pipeline->workers[worker_arg->worker];
+
+    free(worker_arg);
+
+    for(batch_t* batch = queuePop(pipeline->batches); batch != NULL; batch = queuePop(pipeline->batches)) {
+        part_t* part = batch->part;
+
+        // link targets go to the batch's arena, which lives until the part is printed
+        arena_t* names = context->names;
+        context->names = batch->arena;
+
+        vector_t files = { batch->count, batch->count, &part->names[batch->start] };
+        processEntries(context, &part->entry_infos[batch->start], &files, part->dir_fd);
+
+        context->names = names;
+
+        if(context->error != 0) {
+            printf("malloc() failed...exiting\n");
+            exit(EXIT_FAILURE);
+        }
+
+        if(atomic_fetch_sub(&part->batches_left, 1) == 1) {
+            sem_post(&part->done);
+        }
+    }
+
+    return NULL;
+}
+
+// formatter: wait for the part to be processed and print it like listDirectory, then reuse its memory
+static void printPart(pipeline_t* pipeline, part_t* part) {
+    context_t* context = pipeline->context;
+    output_t* out = context->out;
+
+    if(part->first) {
+        if(part->separator) {
+            printSeparator(out, context->options);
+        }
+
+        if(part->dir_fd == -1) {
+            printDirectoryError(context, "cannot open directory", part->path, part->open_error);
+        }
+        else if(context->options->print_header) {
+            printHeader(out, part->path);
+        }
+    }
+
+    if(part->num_batches > 0) {
+        while(sem_wait(&part->done) == -1 && errno == EINTR) {
+        }
+    }
+
+    if(part->read_error != 0) {
+        printDirectoryError(context, "reading directory", part->path, part->read_error);
+    }
+
+    recordDirectory(context, part->path);
+
+    printEntries(context, part->entry_infos, part->count);
+
+    if(context->error != 0) {
+        printf("malloc() failed...exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // the latency of a directory runs from the reader opening it to its last entry being printed
+    if(part->last && part->dir_fd != -1) {
+        statsDirectory(context->stats, part->path, part->dir_entries, part->started);
+        close(part->dir_fd);
+    }
+
+    sem_destroy(&part->done);
+
+    for(size_t i = 0; i < part->num_batches; i++) {
+        poolPut(pipeline, part->batches[i].arena);
+    }
+
+    poolPut(pipeline, part->arena);
+}
+
+// an empty arena, reused from a printed part if there is one
+static arena_t* poolGet(pipeline_t* pipeline) {
+    arena_t* arena = NULL;
+
+    pthread_mutex_lock(&pipeline->pool_lock);
+
+    if(pipeline->pool_length > 0) {
+        arena = pipeline->pool[--pipeline->pool_length];
+    }
+
+    pthread_mutex_unlock(&pipeline->pool_lock);
+
+    if(!arena) {
+        arena = arenaCreate();
+    }
+
+    if(!arena) {
+        printf("malloc() failed...exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return arena;
+}
+
+// give back an arena that is no longer used
+static void poolPut(pipeline_t* pipeline, arena_t* arena) {
+    arenaReset(arena);
+
+    pthread_mutex_lock(&pipeline->pool_lock);
+
+    if(pipeline->pool_length == pipeline->pool_capacity) {
+        pipeline->pool_capacity = pipeline->pool_capacity ? pipeline->pool_capacity * 2 : 64;
+        pipeline->pool = realloc(pipeline->pool, sizeof(arena_t*) * pipeline->pool_capacity);
+
+        if(!pipeline->pool) {
+            printf("realloc() failed...exiting\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    pipeline->pool[pipeline->pool_length++] = arena;
+
+    pthread_mutex_unlock(&pipeline->pool_lock);
+}
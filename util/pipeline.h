@@ -0,0 +1,8 @@
+#ifndef _PIPELINE_H_
+#define _PIPELINE_H_
+
+#include "context.h"
+
+void listDirectoryPipelined(context_t* context, char* path);
+
+#endif
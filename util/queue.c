@@ -0,0 +1,130 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdatomic.h>
+#include <semaphore.h>
+#include <errno.h>
+#include <sched.h> // sched_yield
+
+#include "queue.h"
+
+static void waitFor(sem_t* sem);
+
+// create an empty queue holding up to capacity items (rounded up to a power of 2)
+queue_t* queueCreate(size_t capacity) {
+    queue_t* queue = aligned_alloc(64, (sizeof(queue_t) + 63) / 64 * 64);
+
+    if(!queue) {
+        printf("malloc() failed...exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t size = 1;
+
+    while(size < capacity) {
+        size *= 2;
+    }
+
+    queue->cells = malloc(sizeof(queue_cell_t) * size);
+
+    if(!queue->cells) {
+        printf("malloc() failed...exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // cell i is first written at position i
+    for(size_t i = 0; i < size; i++) {
+        atomic_init(&queue->cells[i].sequence, i);
+    }
+
+    queue->mask = size - 1;
+    atomic_init(&queue->push_position, 0);
+    atomic_init(&queue->pop_position, 0);
+    sem_init(&queue->slots, 0, size);
+    sem_init(&queue->items, 0, 0);
+
+    return queue;
+}
+
+// add item to the queue, waiting while it is full
+void queuePush(queue_t* queue, void* item) {
+    waitFor(&queue->slots);
+
+    size_t position = atomic_load_explicit(&queue->push_position, memory_order_relaxed);
+
+    while(true) {
+        queue_cell_t* cell = &queue->cells[position & queue->mask];
+        intptr_t difference = (intptr_t)atomic_load_explicit(&cell->sequence, memory_order_acquire) - (intptr_t)position;
+
+        // the cell is free for this position, try to claim it
+        if(difference == 0) {
+            if(atomic_compare_exchange_weak_explicit(&queue->push_position, &position, position + 1, memory_order_relaxed, memory_order_relaxed)) {
+                cell->item = item;
+                atomic_store_explicit(&cell->sequence, position + 1, memory_order_release);
+                break;
+            }
+        }
+        // a slot is ours (slots), but the consumer of this cell hasn't finished with it yet
+        else if(difference < 0) {
+            sched_yield();
+            position = atomic_load_explicit(&queue->push_position, memory_order_relaxed);
+        }
+        // another producer got there first
+        else {
+            position = atomic_load_explicit(&queue->push_position, memory_order_relaxed);
+        }
+    }
+
+    sem_post(&queue->items);
+}
+
+// remove the oldest item from the queue, waiting while it is empty
+void* queuePop(queue_t* queue) {
+    waitFor(&queue->items);
+
+    size_t position = atomic_load_explicit(&queue->pop_position, memory_order_relaxed);
+    void* item;
+
+    while(true) {
+        queue_cell_t* cell = &queue->cells[position & queue->mask];
+        intptr_t difference = (intptr_t)atomic_load_explicit(&cell->sequence, memory_order_acquire) - (intptr_t)(position + 1);
+
+        // the cell holds the item for this position, try to claim it
+        if(difference == 0) {
+            if(atomic_compare_exchange_weak_explicit(&queue->pop_position, &position, position + 1, memory_order_relaxed, memory_order_relaxed)) {
+                item = cell->item;
+                // free for the producer one lap later
+                atomic_store_explicit(&cell->sequence, position + queue->mask + 1, memory_order_release);
+                break;
+            }
+        }
+        // an item is ours (items), but its producer hasn't finished writing it yet
+        else if(difference < 0) {
+            sched_yield();
+            position = atomic_load_explicit(&queue->pop_position, memory_order_relaxed);
+        }
+        // another consumer got there first
+        else {
+            position = atomic_load_explicit(&queue->pop_position, memory_order_relaxed);
+        }
+    }
+
+    sem_post(&queue->slots);
+
+    return item;
+}
+
+// free the queue, the items left in it are not freed
+void queueFree(queue_t* queue) {
+    sem_destroy(&queue->slots);
+    sem_destroy(&queue->items);
+    free(queue->cells);
+    free(queue);
+}
+
+// sem_wait, retried if interrupted by a signal
+static void waitFor(sem_t* sem) {
+    while(sem_wait(sem) == -1 && errno == EINTR) {
+    }
+}
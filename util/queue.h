@@ -0,0 +1,34 @@
+#ifndef _QUEUE_H_
+#define _QUEUE_H_
+
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <semaphore.h>
+
+// one slot of a queue; sequence tells whether it is ready to be written or read for a given position
+typedef struct queue_cell_t {
+    atomic_size_t sequence;
+    void* item;
+} queue_cell_t;
+
+// bounded multi-producer multi-consumer queue of pointers (Vyukov's array queue)
+// pushes and pops claim a position with a compare and swap, no lock is taken; the semaphores only
+// put a thread to sleep while the queue is full (slots) or empty (items)
+typedef struct queue_t {
+    queue_cell_t* cells;
+    size_t mask; // capacity - 1, the capacity is a power of 2
+
+    // on separate cache lines, producers and consumers don't share them
+    _Alignas(64) atomic_size_t push_position;
+    _Alignas(64) atomic_size_t pop_position;
+
+    sem_t slots;
+    sem_t items;
+} queue_t;
+
+queue_t* queueCreate(size_t capacity);
+void queuePush(queue_t* queue, void* item);
+void* queuePop(queue_t* queue);
+void queueFree(queue_t* queue);
+
+#endif
@@ -0,0 +1,283 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h> // strlen / strerror
+#include <errno.h>
+
+#include "../lsc.h"
+#include "../liblsc.h"
+#include "record.h"
+#include "entries.h"
+#include "context.h"
+#include "output.h"
+
+// --format=nul / json: every entry is written as soon as it is printed, straight from the numbers processEntry
+// stored (nothing is padded, looked up or formatted as a date) and with names written as they are, except for
+// the escapes JSON needs; the directory, the same for all the entries of a listing, is only written out (and
+// escaped) once per listing, every record then starts with a copy of it
+// the library's FORMAT_ENTRIES goes through here too, its records are handed to context->emit as they are
+
+// bytes written as they are in a JSON string, all others are escaped (or start a UTF-8 sequence)
+static const char JSON_PLAIN[256] = {
+    [0x20 ... 0x7f] = 1,
+    ['"'] = 0, ['\\'] = 0,
+};
+
+static void writeUnsigned(output_t* out, uint64_t value);
+static void writeSigned(output_t* out, int64_t value);
+static void writeJsonString(output_t* out, const char* str, size_t length);
+static size_t utf8Length(const unsigned char* str, size_t length);
+static void emitRecord(context_t* context, lsc_entry_t* entry);
+
+// set the directory whose entries are printed next (NULL for the paths given, their records have an empty one)
+void recordDirectory(context_t* context, char* path) {
+    output_t* prefix = context->record_prefix;
+    const char* dir = path ? path : "";
+
+    context->listing_path = path;
+
+    if(!prefix) {
+        return;
+    }
+
+    prefix->length = 0;
+
+    if(context->options->format == FORMAT_NUL) {
+        outputWrite(prefix, dir, strlen(dir) + 1);
+    }
+    else {
+        outputWrite(prefix, "{\"dir\":", 7);
+        writeJsonString(prefix, dir, strlen(dir));
+        outputWrite(prefix, ",\"name\":", 8);
+    }
+
+    // a prefix cut short would be copied into every record
+    if(prefix->error != 0) {
+        context->error = prefix->error;
+    }
+}
+
+// write an entry that could be listed as a record of the format in the options, in the directory last given
+// to recordDirectory
+void recordEntry(context_t* context, entry_info_t* entry_info) {
+    output_t* out = context->out;
+    int64_t mtime_ns = entry_info->mtime * 1000000000 + entry_info->mtime_nsec;
+
+    if(context->options->format == FORMAT_ENTRIES) {
+        lsc_entry_t entry = {
+            .dir = context->listing_path ? context->listing_path : "",
+            .name = entry_info->name,
+            .ino = entry_info->ino,
+            .mode = entry_info->mode,
+            .nlink = entry_info->nlinks,
+            .uid = entry_info->uid,
+            .gid = entry_info->gid,
+            .size = entry_info->size,
+            .mtime_ns = mtime_ns,
+            .target = entry_info->path,
+        };
+
+        emitRecord(context, &entry);
+        return;
+    }
+
+    outputWrite(out, context->record_prefix->buffer, context->record_prefix->length);
+
+    if(context->options->format == FORMAT_NUL) {
+        outputWrite(out, entry_info->name, entry_info->name_len + 1);
+        writeUnsigned(out, entry_info->ino);
+        outputChar(out, '\0');
+        writeUnsigned(out, entry_info->mode);
+        outputChar(out, '\0');
+        writeUnsigned(out, entry_info->nlinks);
+        outputChar(out, '\0');
+        writeUnsigned(out, entry_info->uid);
+        outputChar(out, '\0');
+        writeUnsigned(out, entry_info->gid);
+        outputChar(out, '\0');
+        writeSigned(out, entry_info->size);
+        outputChar(out, '\0');
+        writeSigned(out, mtime_ns);
+        outputChar(out, '\0');
+
+        if(entry_info->path) {
+            outputString(out, entry_info->path);
+        }
+
+        // the end of the target, then an empty error
+        outputWrite(out, "\0", 2);
+        return;
+    }
+
+    writeJsonString(out, entry_info->name, entry_info->name_len);
+    outputWrite(out, ",\"ino\":", 7);
+    writeUnsigned(out, entry_info->ino);
+    outputWrite(out, ",\"mode\":", 8);
+    writeUnsigned(out, entry_info->mode);
+    outputWrite(out, ",\"nlink\":", 9);
+    writeUnsigned(out, entry_info->nlinks);
+    outputWrite(out, ",\"uid\":", 7);
+    writeUnsigned(out, entry_info->uid);
+    outputWrite(out, ",\"gid\":", 7);
+    writeUnsigned(out, entry_info->gid);
+    outputWrite(out, ",\"size\":", 8);
+    writeSigned(out, entry_info->size);
+    outputWrite(out, ",\"mtime_ns\":", 12);
+    writeSigned(out, mtime_ns);
+
+    if(entry_info->path) {
+        outputWrite(out, ",\"target\":", 10);
+        writeJsonString(out, entry_info->path, strlen(entry_info->path));
+    }
+
+    outputWrite(out, "}\n", 2);
+}
+
+// write a record for name in dir (name is "" for the directory itself) that can't be listed, what went wrong
+// is what, followed by the message for errno error
+void recordError(context_t* context, const char* dir, const char* name, const char* what, int error) {
+    output_t* out = context->out;
+    const char* message = strerror(error);
+
+    if(context->options->format == FORMAT_ENTRIES) {
+        lsc_entry_t entry = { .dir = dir, .name = name, .what = what, .error = error };
+
+        emitRecord(context, &entry);
+        return;
+    }
+
+    if(context->options->format == FORMAT_NUL) {
+        outputWrite(out, dir, strlen(dir) + 1);
+        outputWrite(out, name, strlen(name) + 1);
+
+        // none of the metadata (nor a target)
+        for(int i = 0; i < RECORD_NUL_FIELDS - 3; i++) {
+            outputChar(out, '\0');
+        }
+
+        outputString(out, what);
+        outputWrite(out, ": ", 2);
+        outputWrite(out, message, strlen(message) + 1);
+        return;
+    }
+
+    outputWrite(out, "{\"dir\":", 7);
+    writeJsonString(out, dir, strlen(dir));
+    outputWrite(out, ",\"name\":", 8);
+    writeJsonString(out, name, strlen(name));
+    outputWrite(out, ",\"error\":\"", 10);
+    outputString(out, what);
+    outputWrite(out, ": ", 2);
+    outputString(out, message);
+    outputWrite(out, "\"}\n", 3);
+}
+
+// hand a record to the library's callback, the listing stops if it returns false
+static void emitRecord(context_t* context, lsc_entry_t* entry) {
+    if(!context->emit(context->emit_arg, entry)) {
+        context->error = ECANCELED;
+    }
+}
+
+static void writeUnsigned(output_t* out, uint64_t value) {
+    char buffer[20];
+    outputWrite(out, buffer, formatUnsigned(buffer, value));
+}
+
+static void writeSigned(output_t* out, int64_t value) {
+    if(value < 0) {
+        outputChar(out, '-');
+        writeUnsigned(out, -(uint64_t)value);
+        return;
+    }
+
+    writeUnsigned(out, value);
+}
+
+// str as a JSON string: runs of characters that need no escape are written as they are, so a plain name is a
+// single write; bytes that aren't valid UTF-8 (names are just bytes) are replaced by U+FFFD
+static void writeJsonString(output_t* out, const char* str, size_t length) {
+    const unsigned char* bytes = (const unsigned char*)str;
+    size_t start = 0;
+    size_t i = 0;
+
+    outputChar(out, '"');
+
+    while(i < length) {
+        unsigned char c = bytes[i];
+
+        if(JSON_PLAIN[c]) {
+            i++;
+            continue;
+        }
+
+        if(c >= 0x80) {
+            size_t sequence = utf8Length(&bytes[i], length - i);
+
+            if(sequence != 0) {
+                i += sequence;
+                continue;
+            }
+        }
+
+        outputWrite(out, &str[start], i - start);
+
+        switch(c) {
+            case '"': outputWrite(out, "\\\"", 2); break;
+            case '\\': outputWrite(out, "\\\\", 2); break;
+            case '\n': outputWrite(out, "\\n", 2); break;
+            case '\t': outputWrite(out, "\\t", 2); break;
+            case '\r': outputWrite(out, "\\r", 2); break;
+            default:
+                if(c < 0x20) {
+                    char escape[6] = { '\\', 'u', '0', '0', "0123456789abcdef"[c >> 4], "0123456789abcdef"[c & 0xf] };
+                    outputWrite(out, escape, 6);
+                }
+                else {
+                    outputWrite(out, "\\ufffd", 6);
+                }
+        }
+
+        start = ++i;
+    }
+
+    outputWrite(out, &str[start], i - start);
+    outputChar(out, '"');
+}
+
+// the length of the UTF-8 sequence str starts with (of the length bytes left), 0 if it isn't a valid one
+static size_t utf8Length(const unsigned char* str, size_t length) {
+    unsigned char c = str[0];
+    size_t sequence;
+    unsigned char low = 0x80;
+    unsigned char high = 0xbf;
+
+    if(c >= 0xc2 && c <= 0xdf) {
+        sequence = 2;
+    }
+    else if(c >= 0xe0 && c <= 0xef) {
+        sequence = 3;
+        low = c == 0xe0 ? 0xa0 : 0x80; // overlong
+        high = c == 0xed ? 0x9f : 0xbf; // surrogates
+    }
+    else if(c >= 0xf0 && c <= 0xf4) {
+        sequence = 4;
+        low = c == 0xf0 ? 0x90 : 0x80; // overlong
+        high = c == 0xf4 ? 0x8f : 0xbf; // past U+10FFFF
+    }
+    else {
+        return 0;
+    }
+
+    if(length < sequence || str[1] < low || str[1] > high) {
+        return 0;
+    }
+
+    for(size_t i = 2; i < sequence; i++) {
+        if(str[i] < 0x80 || str[i] > 0xbf) {
+            return 0;
+        }
+    }
+
+    return sequence;
+}
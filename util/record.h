@@ -0,0 +1,16 @@
+#ifndef _RECORD_H_
+#define _RECORD_H_
+
+#include "../lsc.h"
+#include "entries.h"
+#include "context.h"
+
+// fields of a --format=nul record, each followed by a nul:
+// dir, name, ino, mode, nlink, uid, gid, size, mtime_ns, target, error
+#define RECORD_NUL_FIELDS 11
+
+void recordDirectory(context_t* context, char* path);
+void recordEntry(context_t* context, entry_info_t* entry_info);
+void recordError(context_t* context, const char* dir, const char* name, const char* what, int error);
+
+#endif
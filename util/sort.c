@@ -0,0 +1,304 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h> // strcmp / strxfrm
+#include <locale.h>
+
+#include "sort.h"
+#include "arena.h"
+
+// ranges this small are finished with an insertion sort
+#define INSERTION_THRESHOLD 16
+
+// one name to sort; prefix holds the 8 bytes of key at the current depth packed big endian
+// (zero padded past the end), so comparing prefixes as integers orders keys like strcmp
+typedef struct sort_key_t {
+    uint64_t prefix;
+    const char* key; // the name itself, or its strxfrm key when collating
+    char* name;
+} sort_key_t;
+
+static const char* collationKey(arena_t* arena, const char* name);
+static uint64_t loadPrefix(const char* key, size_t depth);
+static void multikeySort(sort_key_t* keys, size_t count, size_t depth);
+static void insertionSort(sort_key_t* keys, size_t count, size_t depth);
+static void breakTies(sort_key_t* keys, size_t count);
+
+// whether names should be collated, i.e. LC_COLLATE (set from the environment) is not the C locale
+bool sortUsesLocale() {
+    const char* collate = setlocale(LC_COLLATE, NULL);
+
+    return collate != NULL && strcmp(collate, "C") != 0 && strcmp(collate, "POSIX") != 0;
+}
+
+// sort names in place, by bytes like strcmp, or with collate in the order strcoll gives for LC_COLLATE
+// (names that collate equal are ordered by bytes); the keys are built once per name, so a
+// comparison never has to collate, and are kept in arena until the sort is done
+// returns false if arena ran out of memory for them, names are then left as they were
+bool sortNames(char** names, size_t count, bool collate, arena_t* arena) {
+    if(count < 2) {
+        return true;
+    }
+
+    arena_mark_t mark = arenaMark(arena);
+    sort_key_t* keys = arenaAlloc(arena, sizeof(sort_key_t) * count);
+
+    if(!keys) {
+        return false;
+    }
+
+    for(size_t i = 0; i < count; i++) {
+        keys[i].name = names[i];
+        keys[i].key = collate ? collationKey(arena, names[i]) : names[i];
+
+        if(!keys[i].key) {
+            arenaRewind(arena, mark);
+            return false;
+        }
+
+        keys[i].prefix = loadPrefix(keys[i].key, 0);
+    }
+
+    multikeySort(keys, count, 0);
+
+    if(collate) {
+        breakTies(keys, count);
+    }
+
+    for(size_t i = 0; i < count; i++) {
+        names[i] = keys[i].name;
+    }
+
+    arenaRewind(arena, mark);
+    return true;
+}
+
+// compare two names in the order sortNames puts them in (negative if a comes first, like strcmp)
+int sortCompare(const char* a, const char* b, bool collate) {
+    if(collate) {
+        int order = strcoll(a, b);
+
+        if(order != 0) {
+            return order;
+        }
+    }
+
+    return strcmp(a, b);
+}
+
+// sort pairs by ascending key, pairs with the same key keep their order
+// LSD radix sort a byte at a time, bytes that are the same in every key are skipped (e.g. the high bytes
+// of inode numbers); the second buffer comes from arena and is given back before returning
+// returns false if arena ran out of memory for it, pairs are then left as they were
+bool sortPairs(sort_pair_t* pairs, size_t count, arena_t* arena) {
+    if(count < 2) {
+        return true;
+    }
+
+    arena_mark_t mark = arenaMark(arena);
+    sort_pair_t* buffer = arenaAlloc(arena, sizeof(sort_pair_t) * count);
+    size_t* counts = buffer ? arenaAlloc(arena, sizeof(size_t) * 8 * 256) : NULL;
+
+    if(!counts) {
+        arenaRewind(arena, mark);
+        return false;
+    }
+
+    // the histograms of all 8 bytes in one pass
+    memset(counts, 0, sizeof(size_t) * 8 * 256);
+
+    for(size_t i = 0; i < count; i++) {
+        for(int byte = 0; byte < 8; byte++) {
+            counts[byte * 256 + ((pairs[i].key >> (byte * 8)) & 0xff)]++;
+        }
+    }
+
+    sort_pair_t* from = pairs;
+    sort_pair_t* to = buffer;
+
+    for(int byte = 0; byte < 8; byte++) {
+        size_t* histogram = &counts[byte * 256];
+
+        // every key has the same value for this byte, nothing to do
+        if(histogram[(pairs[0].key >> (byte * 8)) & 0xff] == count) {
+            continue;
+        }
+
+        // turn the counts into where each value starts
+        size_t offset = 0;
+
+        for(int value = 0; value < 256; value++) {
+            size_t value_count = histogram[value];
+            histogram[value] = offset;
+            offset += value_count;
+        }
+
+        for(size_t i = 0; i < count; i++) {
+            to[histogram[(from[i].key >> (byte * 8)) & 0xff]++] = from[i];
+        }
+
+        sort_pair_t* tmp = from;
+        from = to;
+        to = tmp;
+    }
+
+    if(from != pairs) {
+        memcpy(pairs, from, sizeof(sort_pair_t) * count);
+    }
+
+    arenaRewind(arena, mark);
+    return true;
+}
+
+// strxfrm of name allocated from arena, strcmp on two of them gives the same order as strcoll on the names
+// NULL if out of memory
+static const char* collationKey(arena_t* arena, const char* name) {
+    // big enough for most keys, otherwise strxfrm tells us how much it needs and is called again
+    size_t size = strlen(name) * 4 + 16;
+    char* key = arenaAlloc(arena, size);
+
+    if(!key) {
+        return NULL;
+    }
+
+    size_t length = strxfrm(key, name, size);
+
+    if(length < size) {
+        arenaTrim(arena, key, size, length + 1);
+        return key;
+    }
+
+    arenaTrim(arena, key, size, 0);
+    key = arenaAlloc(arena, length + 1);
+
+    if(!key) {
+        return NULL;
+    }
+
+    strxfrm(key, name, length + 1);
+
+    return key;
+}
+
+// the 8 bytes of key starting at depth, key must not end before depth
+static uint64_t loadPrefix(const char* key, size_t depth) {
+    const unsigned char* str = (const unsigned char*)key + depth;
+    uint64_t prefix = 0;
+
+    for(int i = 0; i < 8; i++) {
+        prefix <<= 8;
+
+        if(*str != '\0') {
+            prefix |= *str++;
+        }
+    }
+
+    return prefix;
+}
+
+// multikey quicksort: a 3-way partition on the prefixes at depth, the keys equal to the pivot
+// are then sorted on their next 8 bytes (unless they ended, then they are all the same)
+// the two smaller ranges are sorted recursively and the largest in the loop, so the stack stays shallow
+static void multikeySort(sort_key_t* keys, size_t count, size_t depth) {
+    while(count > INSERTION_THRESHOLD) {
+        // median of three as the pivot
+        uint64_t a = keys[0].prefix;
+        uint64_t b = keys[count / 2].prefix;
+        uint64_t c = keys[count - 1].prefix;
+        uint64_t pivot = a < b ? (b < c ? b : (a < c ? c : a)) : (a < c ? a : (b < c ? c : b));
+
+        // [0, less) < pivot, [less, greater) == pivot, [greater, count) > pivot
+        size_t less = 0;
+        size_t greater = count;
+
+        for(size_t i = 0; i < greater; ) {
+            sort_key_t tmp = keys[i];
+
+            if(tmp.prefix < pivot) {
+                keys[i++] = keys[less];
+                keys[less++] = tmp;
+            }
+            else if(tmp.prefix > pivot) {
+                keys[i] = keys[--greater];
+                keys[greater] = tmp;
+            }
+            else {
+                i++;
+            }
+        }
+
+        // a zero last byte means the keys ended within this prefix
+        bool ended = (pivot & 0xff) == 0;
+
+        sort_key_t* ranges[3] = { keys, &keys[less], &keys[greater] };
+        size_t counts[3] = { less, ended ? 0 : greater - less, count - greater };
+        size_t depths[3] = { depth, depth + 8, depth };
+
+        for(size_t i = 0; i < counts[1]; i++) {
+            ranges[1][i].prefix = loadPrefix(ranges[1][i].key, depth + 8);
+        }
+
+        int largest = counts[0] >= counts[1] ? (counts[0] >= counts[2] ? 0 : 2) : (counts[1] >= counts[2] ? 1 : 2);
+
+        for(int i = 0; i < 3; i++) {
+            if(i != largest) {
+                multikeySort(ranges[i], counts[i], depths[i]);
+            }
+        }
+
+        keys = ranges[largest];
+        count = counts[largest];
+        depth = depths[largest];
+    }
+
+    insertionSort(keys, count, depth);
+}
+
+// sort a small range whose keys are equal before depth
+static void insertionSort(sort_key_t* keys, size_t count, size_t depth) {
+    for(size_t i = 1; i < count; i++) {
+        sort_key_t tmp = keys[i];
+        size_t j = i;
+
+        for(; j > 0; j--) {
+            sort_key_t* prev = &keys[j - 1];
+
+            if(prev->prefix < tmp.prefix) {
+                break;
+            }
+
+            // same prefix, compare the rest of the keys unless they ended
+            if(prev->prefix == tmp.prefix && ((tmp.prefix & 0xff) == 0 || strcmp(prev->key + depth + 8, tmp.key + depth + 8) <= 0)) {
+                break;
+            }
+
+            keys[j] = *prev;
+        }
+
+        keys[j] = tmp;
+    }
+}
+
+// order runs of equal collation keys by the bytes of their names
+static void breakTies(sort_key_t* keys, size_t count) {
+    for(size_t start = 0; start < count; ) {
+        size_t end = start + 1;
+
+        while(end < count && strcmp(keys[start].key, keys[end].key) == 0) {
+            end++;
+        }
+
+        for(size_t i = start + 1; i < end; i++) {
+            sort_key_t tmp = keys[i];
+            size_t j = i;
+
+            for(; j > start && strcmp(keys[j - 1].name, tmp.name) > 0; j--) {
+                keys[j] = keys[j - 1];
+            }
+
+            keys[j] = tmp;
+        }
+
+        start = end;
+    }
+}
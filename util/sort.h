@@ -0,0 +1,20 @@
+#ifndef _SORT_H_
+#define _SORT_H_
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "arena.h"
+
+// an index into some array and the key it is sorted by with sortPairs
+typedef struct sort_pair_t {
+    uint64_t key;
+    size_t index;
+} sort_pair_t;
+
+bool sortUsesLocale();
+bool sortNames(char** names, size_t count, bool collate, arena_t* arena);
+int sortCompare(const char* a, const char* b, bool collate);
+bool sortPairs(sort_pair_t* pairs, size_t count, arena_t* arena);
+
+#endif
@@ -0,0 +1,697 @@
+// _DEFAULT_SOURCE needed for DT_DIR
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h> // memcpy / memmove / strcmp / strcoll
+#include <limits.h> // NAME_MAX
+#include <errno.h>
+#include <dirent.h> // DT_DIR
+#include <fcntl.h> // open
+#include <unistd.h> // pread / close
+
+#include "../lsc.h"
+#include "spill.h"
+#include "context.h"
+#include "listing.h"
+#include "entries.h"
+#include "utility.h"
+#include "dirreader.h"
+#include "output.h"
+#include "arena.h"
+#include "sort.h"
+#include "stats.h"
+
+// each run read back while merging gets a buffer of at most / at least (it must hold the largest record)
+#define SPILL_BUFFER_MAX (256 * 1024)
+#define SPILL_BUFFER_MIN (16 * 1024)
+
+// how --memory-budget is split: half for the names read before they are spilled (see spillNeeded), a quarter
+// for the runs read back while merging, and an eighth each for the buffers of the spill and subdirectory files
+#define SPILL_MERGE_SHARE 4
+#define SPILL_WRITER_SHARE 8
+
+// what a name costs in memory on top of its copy in the names arena: its pointer in the entry vector,
+// its entry_info_t and its key while sorting
+#define SPILL_ENTRY_SIZE (sizeof(char*) + sizeof(entry_info_t) + 3 * sizeof(void*))
+
+// a sorted run of entries in the spill file, between offsets start and end
+typedef struct spill_run_t {
+    off_t start;
+    off_t end;
+} spill_run_t;
+
+// header written to the spill file for each entry, followed by its name and link target (nul terminated)
+typedef struct spill_record_t {
+    entry_info_t info; // name and path are only valid in memory, they are pointed at the copies read back
+    uint32_t name_len;
+    uint32_t path_len;
+    unsigned char type; // dirent type of the entry, for -R
+    bool has_path;
+} spill_record_t;
+
+// a sorted directory too large for the memory budget: the entries are sorted and stat-ed a run at a time,
+// the runs written to a temporary file, and merged back when the whole directory has been read
+struct spill_t {
+    int fd;
+    output_t* writer;   // appends to fd
+    off_t length;       // bytes written through writer
+    spill_run_t* runs;
+    size_t num_runs;
+    size_t capacity;
+    column_widths_t widths; // of all the entries spilled
+    size_t num_errors;      // entries that couldn't be listed
+    int error;              // errno of the first failed write to fd, nothing more is spilled once it is set
+    off_t subdir_bytes;     // written to context->subdir_file for this directory
+    bool subdirs_in_memory; // the subdirectory file couldn't be created, they go to context->subdir_vector
+};
+
+// reads one run back through a buffer, record (name, path) is the entry it is at
+typedef struct run_reader_t {
+    off_t offset; // next byte of the run to read
+    off_t end;
+    char* buffer;
+    size_t size;
+    size_t position; // of the next record in buffer
+    size_t length;   // valid bytes in buffer
+    spill_record_t record;
+    char* name;
+    char* path;
+} run_reader_t;
+
+// what a merge does with the entries, in order
+typedef enum merge_target_t {
+    MERGE_TO_RUN,    // written to a new run
+    MERGE_ERRORS,    // the errors of those that can't be listed printed
+    MERGE_ENTRIES    // the others printed, and the subdirectories collected
+} merge_target_t;
+
+static int openTemporary();
+static bool subdirFileAdd(subdir_file_t* file, char* name);
+static void writeRecord(spill_t* spill, entry_info_t* entry_info, unsigned char type, bool read_links);
+static bool addRun(spill_t* spill, off_t start, off_t end);
+static int mergeRuns(spill_t* spill, context_t* context, spill_run_t* runs, size_t num_runs, size_t buffer_size, merge_target_t target, char* path, size_t* num_subdirs);
+static int readerFill(int fd, run_reader_t* reader, size_t size);
+static int readerNext(int fd, run_reader_t* reader);
+static bool readerBefore(run_reader_t* a, run_reader_t* b, bool collate);
+static void mergeWidths(column_widths_t* widths, column_widths_t* other);
+
+// whether the directory being read (its names in context->names and context->entry_vector) has grown
+// past half of --memory-budget; the rest of the budget is left for link targets and merging
+bool spillNeeded(context_t* context) {
+    size_t size = context->names->used + context->entry_vector->length * SPILL_ENTRY_SIZE;
+
+    // strxfrm keys are a few times longer than the names
+    if(context->options->collate) {
+        size += context->names->used * 4;
+    }
+
+    return size > context->options->memory_budget / 2;
+}
+
+// start spilling the directory at path to an (already unlinked) temporary file in $TMPDIR or /tmp
+// prints an error and returns NULL if the file can't be created, the directory is then listed in memory
+// (also returns NULL if out of memory, with context->error set)
+spill_t* spillCreate(context_t* context, char* path) {
+    int fd = openTemporary();
+
+    if(fd == -1) {
+        printDirectoryError(context, "cannot create temporary file to sort", path, errno);
+        return NULL;
+    }
+
+    spill_t* spill = malloc(sizeof(spill_t));
+    output_t* writer = spill ? outputCreateSized(fd, context->options->memory_budget / SPILL_WRITER_SHARE) : NULL;
+
+    if(!writer) {
+        free(spill);
+        close(fd);
+        context->error = ENOMEM;
+        return NULL;
+    }
+
+    spill->fd = fd;
+    spill->writer = writer;
+    spill->length = 0;
+    spill->runs = NULL;
+    spill->num_runs = 0;
+    spill->capacity = 0;
+    spill->num_errors = 0;
+    spill->error = 0;
+    spill->subdir_bytes = 0;
+    spill->subdirs_in_memory = false;
+    memset(&spill->widths, 0, sizeof(column_widths_t));
+
+    return spill;
+}
+
+// sort, stat and write the entries in context->entry_vector to the spill file as a new run,
+// then release them (the vector is emptied and context->names reset); sets context->error if out of memory
+// once the file couldn't be written (spill->error), the entries are only released
+void spillRun(spill_t* spill, context_t* context, int dir_fd) {
+    vector_t* entry_vector = context->entry_vector;
+
+    if(entry_vector->length == 0) {
+        return;
+    }
+
+    // the directory can't be listed anymore, what is left of it is read to no end
+    if(spill->error != 0) {
+        vectorClear(entry_vector);
+        arenaReset(context->names);
+        return;
+    }
+
+    uint64_t sort_start = statsStart(context->stats);
+    bool sorted = sortNames(entry_vector->items, entry_vector->length, context->options->collate, context->names);
+
+    statsStop(context->stats, STATS_SORT, sort_start);
+
+    entry_info_t* entry_infos = sorted ? arenaAlloc(context->names, sizeof(entry_info_t) * entry_vector->length) : NULL;
+
+    if(!entry_infos) {
+        context->error = ENOMEM;
+        return;
+    }
+
+    processEntries(context, entry_infos, entry_vector, dir_fd);
+
+    // the columns have to be as wide as the widest entry of any run
+    uint64_t format_start = statsStart(context->stats);
+    column_widths_t widths;
+
+    if(context->options->format == FORMAT_TEXT) {
+        getColumnWidths(&widths, entry_infos, entry_vector->length, context);
+        mergeWidths(&spill->widths, &widths);
+    }
+    statsStop(context->stats, STATS_FORMAT, format_start);
+
+    off_t start = spill->length;
+
+    for(size_t i = 0; i < entry_vector->length; i++) {
+        writeRecord(spill, &entry_infos[i], dirNameOf(entry_vector->items[i])->type, context->plan.read_links);
+        spill->num_errors += entry_infos[i].error != ENTRY_OK;
+    }
+
+    // the run is only kept once it is all in the file, a failed write leaves the offsets past it unknown
+    outputFlush(spill->writer);
+
+    if(spill->writer->error != 0) {
+        spill->error = spill->writer->error;
+    }
+    else if(!addRun(spill, start, spill->length)) {
+        context->error = ENOMEM;
+    }
+
+    vectorClear(entry_vector);
+    arenaReset(context->names);
+}
+
+// spill what is left of the directory at path, then merge the runs to print the errors and the entries
+// (the same output as listing it in memory) and with -R collect its subdirectories in context->subdir_vector,
+// or write their names to context->subdir_file if there is one
+// returns the number of names written to context->subdir_file
+// stops once context->error is set (e.g. out of memory)
+size_t spillFinish(spill_t* spill, context_t* context, char* path, int dir_fd) {
+    size_t budget = context->options->memory_budget / SPILL_MERGE_SHARE;
+    size_t num_subdirs = 0;
+
+    spillRun(spill, context, dir_fd);
+
+    if(context->error != 0) {
+        return 0;
+    }
+
+    // as many runs are merged at once as there are buffers of at least SPILL_BUFFER_MIN in the budget,
+    // if there are more, groups of them are merged into longer runs first
+    size_t fan_in = budget / SPILL_BUFFER_MIN;
+    int error = 0;
+
+    if(fan_in < 2) {
+        fan_in = 2;
+    }
+
+    while(spill->num_runs > fan_in && error == 0 && spill->error == 0) {
+        off_t start = spill->length;
+
+        error = mergeRuns(spill, context, spill->runs, fan_in, budget / fan_in, MERGE_TO_RUN, path, NULL);
+        outputFlush(spill->writer);
+
+        if(spill->writer->error != 0) {
+            spill->error = spill->writer->error;
+            break;
+        }
+
+        // the merged runs are replaced by the new one at the end
+        memmove(spill->runs, &spill->runs[fan_in], sizeof(spill_run_t) * (spill->num_runs - fan_in));
+        spill->num_runs -= fan_in;
+
+        // there is room for it, fan_in runs were just removed
+        addRun(spill, start, spill->length);
+    }
+
+    // the entries that didn't make it to the file can't be listed, nor can the directory
+    if(spill->error != 0) {
+        printDirectoryError(context, "cannot write temporary file to sort", path, spill->error);
+        outputCheckpoint(context->out);
+        return 0;
+    }
+
+    size_t buffer_size = spill->num_runs > 0 ? budget / spill->num_runs : 0;
+
+    if(buffer_size > SPILL_BUFFER_MAX) {
+        buffer_size = SPILL_BUFFER_MAX;
+    }
+
+    if(buffer_size < SPILL_BUFFER_MIN) {
+        buffer_size = SPILL_BUFFER_MIN;
+    }
+
+    // like listFiles, the entries that can't be listed are reported first
+    if(spill->num_errors > 0 && error == 0) {
+        error = mergeRuns(spill, context, spill->runs, spill->num_runs, buffer_size, MERGE_ERRORS, path, NULL);
+    }
+
+    if(error == 0) {
+        error = mergeRuns(spill, context, spill->runs, spill->num_runs, buffer_size, MERGE_ENTRIES, path, &num_subdirs);
+    }
+
+    // running out of memory isn't about the file, the listing just stops
+    if(error != 0 && context->error == 0) {
+        printDirectoryError(context, "cannot read temporary file to sort", path, error);
+    }
+
+    // the subdirectories are only walked if all of their names made it to the file
+    subdir_file_t* file = context->subdir_file;
+
+    if(num_subdirs > 0) {
+        outputFlush(file->writer);
+
+        if(file->writer->error != 0 || error != 0 || context->error != 0) {
+            if(file->writer->error != 0 && context->error == 0) {
+                printDirectoryError(context, "cannot write temporary file to sort", path, file->writer->error);
+            }
+
+            subdirFileRewind(file, file->length - spill->subdir_bytes);
+            num_subdirs = 0;
+        }
+    }
+
+    outputCheckpoint(context->out);
+    return num_subdirs;
+}
+
+// free the spill and remove its temporary file
+void spillFree(spill_t* spill) {
+    outputFree(spill->writer);
+    close(spill->fd);
+    free(spill->runs);
+    free(spill);
+}
+
+// create a subdirectory file for listDirectory, its temporary file is only created once a name is written to it
+// returns NULL if out of memory
+subdir_file_t* subdirFileCreate(options_t* options) {
+    subdir_file_t* file = malloc(sizeof(subdir_file_t));
+
+    if(!file) {
+        return NULL;
+    }
+
+    file->fd = -1;
+    file->writer = NULL;
+    file->buffer_size = options->memory_budget / SPILL_WRITER_SHARE;
+    file->length = 0;
+
+    return file;
+}
+
+// read the name at offset (written by subdirFileAdd, and flushed since) into name, which has room for
+// NAME_MAX + 1 bytes, and move offset past it; returns false if it couldn't be read
+bool subdirFileRead(subdir_file_t* file, off_t* offset, char* name) {
+    ssize_t bytes_read;
+
+    do {
+        bytes_read = pread(file->fd, name, NAME_MAX + 1, *offset);
+    } while(bytes_read == -1 && errno == EINTR);
+
+    char* end = bytes_read > 0 ? memchr(name, '\0', bytes_read) : NULL;
+
+    if(!end) {
+        return false;
+    }
+
+    *offset += end - name + 1;
+    return true;
+}
+
+// drop the names written after mark (the file's length at the time), the writer must have been flushed
+void subdirFileRewind(subdir_file_t* file, off_t mark) {
+    if(file->fd == -1 || file->length == mark) {
+        return;
+    }
+
+    // the space past mark is reused by the next names
+    lseek(file->fd, mark, SEEK_SET);
+    file->writer->error = 0;
+    file->length = mark;
+}
+
+// free the file and remove its temporary file
+void subdirFileFree(subdir_file_t* file) {
+    if(file->writer) {
+        outputFree(file->writer);
+    }
+
+    if(file->fd != -1) {
+        close(file->fd);
+    }
+
+    free(file);
+}
+
+// create an (already unlinked) temporary file in $TMPDIR or /tmp, returns -1 (with errno set) if it can't be
+static int openTemporary() {
+    const char* tmpdir = getenv("TMPDIR");
+
+    if(tmpdir == NULL || tmpdir[0] == '\0') {
+        tmpdir = "/tmp";
+    }
+
+    return open(tmpdir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+}
+
+// append a name (with its nul) to the file, creating it first if needed; returns false if it couldn't be
+// created (a failed write is only seen in file->writer->error once it is flushed)
+static bool subdirFileAdd(subdir_file_t* file, char* name) {
+    if(file->fd == -1) {
+        file->fd = openTemporary();
+
+        if(file->fd == -1) {
+            return false;
+        }
+    }
+
+    if(!file->writer) {
+        file->writer = outputCreateSized(file->fd, file->buffer_size);
+
+        if(!file->writer) {
+            return false;
+        }
+    }
+
+    size_t length = strlen(name) + 1;
+
+    outputWrite(file->writer, name, length);
+    file->length += length;
+
+    return true;
+}
+
+// append the entry to the spill file, its link target is only used (and valid) with read_links (see metadata_plan_t)
+static void writeRecord(spill_t* spill, entry_info_t* entry_info, unsigned char type, bool read_links) {
+    spill_record_t record;
+
+    memset(&record, 0, sizeof(spill_record_t));
+    record.info = *entry_info;
+    record.name_len = entry_info->name_len;
+    record.type = type;
+    record.has_path = read_links && entry_info->error == ENTRY_OK && entry_info->path != NULL;
+    record.path_len = record.has_path ? strlen(entry_info->path) : 0;
+
+    outputWrite(spill->writer, (char*)&record, sizeof(spill_record_t));
+    outputWrite(spill->writer, entry_info->name, record.name_len + 1);
+    spill->length += sizeof(spill_record_t) + record.name_len + 1;
+
+    if(record.has_path) {
+        outputWrite(spill->writer, entry_info->path, record.path_len + 1);
+        spill->length += record.path_len + 1;
+    }
+}
+
+// add a run to the end of the spill's list, returns false if out of memory
+static bool addRun(spill_t* spill, off_t start, off_t end) {
+    if(spill->num_runs == spill->capacity) {
+        size_t capacity = spill->capacity ? spill->capacity * 2 : 16;
+        spill_run_t* runs = realloc(spill->runs, sizeof(spill_run_t) * capacity);
+
+        if(!runs) {
+            return false;
+        }
+
+        spill->runs = runs;
+        spill->capacity = capacity;
+    }
+
+    spill->runs[spill->num_runs].start = start;
+    spill->runs[spill->num_runs].end = end;
+    spill->num_runs++;
+
+    return true;
+}
+
+// k-way merge of the runs with a heap of their readers, each reading through a buffer of buffer_size bytes
+// path is the directory being listed, returns 0 or the errno of a failed read of the spill file
+// (ENOMEM with context->error set if out of memory, the merge stops once it is set)
+// with MERGE_ENTRIES, num_subdirs is set to the number of subdirectory names written to context->subdir_file
+static int mergeRuns(spill_t* spill, context_t* context, spill_run_t* runs, size_t num_runs, size_t buffer_size, merge_target_t target, char* path, size_t* num_subdirs) {
+    options_t* options = context->options;
+    run_reader_t* readers = calloc(num_runs, sizeof(run_reader_t));
+    run_reader_t** heap = malloc(sizeof(run_reader_t*) * num_runs);
+    size_t heap_size = 0;
+    int error = 0;
+
+    if(!readers || !heap) {
+        free(readers);
+        free(heap);
+        context->error = ENOMEM;
+        return ENOMEM;
+    }
+
+    for(size_t i = 0; i < num_runs && error == 0; i++) {
+        run_reader_t* reader = &readers[i];
+
+        reader->offset = runs[i].start;
+        reader->end = runs[i].end;
+        reader->buffer = malloc(buffer_size);
+        reader->size = buffer_size;
+        reader->position = 0;
+        reader->length = 0;
+
+        if(!reader->buffer) {
+            context->error = ENOMEM;
+            error = ENOMEM;
+            break;
+        }
+
+        int result = readerNext(spill->fd, reader);
+
+        if(result < 0) {
+            error = -result;
+            continue;
+        }
+
+        if(result == 0) {
+            continue;
+        }
+
+        // sift the new reader up to its place in the heap
+        size_t child = heap_size++;
+
+        for(; child > 0 && readerBefore(reader, heap[(child - 1) / 2], options->collate); child = (child - 1) / 2) {
+            heap[child] = heap[(child - 1) / 2];
+        }
+
+        heap[child] = reader;
+    }
+
+    while(heap_size > 0 && error == 0 && context->error == 0) {
+        run_reader_t* reader = heap[0];
+        entry_info_t entry_info = reader->record.info;
+
+        entry_info.name = reader->name;
+        entry_info.path = reader->record.has_path ? reader->path : NULL;
+
+        // timed entry by entry, the merge reads runs back from disk in between
+        uint64_t format_start = statsStart(context->stats);
+
+        switch(target) {
+            case MERGE_TO_RUN:
+                writeRecord(spill, &entry_info, reader->record.type, true);
+                break;
+            case MERGE_ERRORS:
+                printEntryError(&entry_info, context);
+                break;
+            case MERGE_ENTRIES:
+                printEntry(&spill->widths, &entry_info, context);
+
+                if(options->recursive && reader->record.type == DT_DIR && strcmp(reader->name, ".") != 0 && strcmp(reader->name, "..") != 0) {
+                    // as many as there are entries, so they are kept out of memory too when walkTree can read them back
+                    if(context->subdir_file && !spill->subdirs_in_memory) {
+                        off_t length = context->subdir_file->length;
+
+                        if(subdirFileAdd(context->subdir_file, reader->name)) {
+                            spill->subdir_bytes += context->subdir_file->length - length;
+                            (*num_subdirs)++;
+                            break;
+                        }
+
+                        // only the first name can fail (the file is created then), they are all kept in memory instead
+                        spill->subdirs_in_memory = true;
+                    }
+
+                    char* subdir = joinPath(context->paths, path, reader->name);
+
+                    if(!subdir || !vectorPush(context->subdir_vector, subdir)) {
+                        context->error = ENOMEM;
+                    }
+                }
+
+                break;
+        }
+
+        if(target != MERGE_TO_RUN) {
+            statsStop(context->stats, STATS_FORMAT, format_start);
+        }
+
+        int result = readerNext(spill->fd, reader);
+
+        // the run is done (or failed), the last reader of the heap takes its place
+        if(result <= 0) {
+            error = -result;
+            reader = heap[--heap_size];
+        }
+
+        // sift the reader at the top down to its place
+        size_t parent = 0;
+
+        while(heap_size > 0) {
+            size_t child = parent * 2 + 1;
+
+            if(child >= heap_size) {
+                break;
+            }
+
+            if(child + 1 < heap_size && readerBefore(heap[child + 1], heap[child], options->collate)) {
+                child++;
+            }
+
+            if(!readerBefore(heap[child], reader, options->collate)) {
+                break;
+            }
+
+            heap[parent] = heap[child];
+            parent = child;
+        }
+
+        if(heap_size > 0) {
+            heap[parent] = reader;
+        }
+    }
+
+    for(size_t i = 0; i < num_runs; i++) {
+        free(readers[i].buffer);
+    }
+
+    free(readers);
+    free(heap);
+
+    return error;
+}
+
+// make sure reader's buffer holds size bytes from position on, reading more of the run if needed
+// returns 0 or -errno (-EIO if the run ends too early)
+static int readerFill(int fd, run_reader_t* reader, size_t size) {
+    if(reader->length - reader->position >= size) {
+        return 0;
+    }
+
+    if(size > reader->size) {
+        return -EIO;
+    }
+
+    // keep what is left at the front of the buffer and fill the rest
+    memmove(reader->buffer, &reader->buffer[reader->position], reader->length - reader->position);
+    reader->length -= reader->position;
+    reader->position = 0;
+
+    while(reader->length < size) {
+        size_t wanted = reader->size - reader->length;
+
+        if((off_t)wanted > reader->end - reader->offset) {
+            wanted = reader->end - reader->offset;
+        }
+
+        ssize_t bytes_read = wanted > 0 ? pread(fd, &reader->buffer[reader->length], wanted, reader->offset) : 0;
+
+        if(bytes_read == -1 && errno == EINTR) {
+            continue;
+        }
+
+        if(bytes_read == -1) {
+            return -errno;
+        }
+
+        if(bytes_read == 0) {
+            return -EIO;
+        }
+
+        reader->length += bytes_read;
+        reader->offset += bytes_read;
+    }
+
+    return 0;
+}
+
+// move reader to the next record of its run
+// returns 1 if there is one, 0 at the end of the run or -errno if it couldn't be read
+static int readerNext(int fd, run_reader_t* reader) {
+    if(reader->position == reader->length && reader->offset == reader->end) {
+        return 0;
+    }
+
+    int result = readerFill(fd, reader, sizeof(spill_record_t));
+
+    if(result != 0) {
+        return result;
+    }
+
+    memcpy(&reader->record, &reader->buffer[reader->position], sizeof(spill_record_t));
+
+    size_t size = sizeof(spill_record_t) + reader->record.name_len + 1;
+
+    if(reader->record.has_path) {
+        size += reader->record.path_len + 1;
+    }
+
+    result = readerFill(fd, reader, size);
+
+    if(result != 0) {
+        return result;
+    }
+
+    reader->name = &reader->buffer[reader->position + sizeof(spill_record_t)];
+    reader->path = reader->name + reader->record.name_len + 1;
+    reader->position += size;
+
+    return 1;
+}
+
+// whether the entry of reader a comes before that of b, in the same order as sortNames
+static bool readerBefore(run_reader_t* a, run_reader_t* b, bool collate) {
+    return sortCompare(a->name, b->name, collate) < 0;
+}
+
+// widen widths to fit the columns of other too
+static void mergeWidths(column_widths_t* widths, column_widths_t* other) {
+    widths->ino = widths->ino > other->ino ? widths->ino : other->ino;
+    widths->nlinks = widths->nlinks > other->nlinks ? widths->nlinks : other->nlinks;
+    widths->user = widths->user > other->user ? widths->user : other->user;
+    widths->group = widths->group > other->group ? widths->group : other->group;
+    widths->size = widths->size > other->size ? widths->size : other->size;
+    widths->name_needs_space = widths->name_needs_space || other->name_needs_space;
+}
@@ -0,0 +1,33 @@
+#ifndef _SPILL_H_
+#define _SPILL_H_
+
+#include <stdbool.h>
+#include "../lsc.h"
+#include "context.h"
+
+// smallest --memory-budget accepted
+#define SPILL_BUDGET_MIN (256 * 1024)
+
+typedef struct spill_t spill_t;
+
+// the names of the subdirectories of spilled directories, appended to a temporary file and read back by
+// walkTree; used as a stack, a directory's names are dropped once its subdirectories have been walked
+typedef struct subdir_file_t {
+    int fd;            // -1 until the first name is written
+    output_t* writer;  // appends to fd
+    size_t buffer_size; // of writer
+    off_t length;      // bytes written through writer
+} subdir_file_t;
+
+bool spillNeeded(context_t* context);
+spill_t* spillCreate(context_t* context, char* path);
+void spillRun(spill_t* spill, context_t* context, int dir_fd);
+size_t spillFinish(spill_t* spill, context_t* context, char* path, int dir_fd);
+void spillFree(spill_t* spill);
+
+subdir_file_t* subdirFileCreate(options_t* options);
+bool subdirFileRead(subdir_file_t* file, off_t* offset, char* name);
+void subdirFileRewind(subdir_file_t* file, off_t mark);
+void subdirFileFree(subdir_file_t* file);
+
+#endif
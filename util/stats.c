@@ -0,0 +1,137 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h> // strdup
+
+#include "stats.h"
+
+static const char* PHASE_NAMES[STATS_PHASES] = { "read", "stat", "sort", "format", "id lookups", "write" };
+static const char* CALL_NAMES[STATS_CALLS] = { "getdents64", "statx", "readlink" };
+
+// creates zeroed counters, the total time is counted from here; NULL if out of memory
+stats_t* statsCreate() {
+    stats_t* stats = calloc(1, sizeof(stats_t));
+
+    if(!stats) {
+        return NULL;
+    }
+
+    stats->started = statsNow();
+
+    return stats;
+}
+
+// count a directory of entries entries listed at path, which took since start (from statsStart)
+void statsDirectory(stats_t* stats, const char* path, size_t entries, uint64_t start) {
+    if(!stats) {
+        return;
+    }
+
+    uint64_t micros = (statsNow() - start) / 1000;
+    size_t bucket = 0;
+
+    while(bucket < STATS_LATENCY_BUCKETS - 1 && micros >= ((uint64_t)1 << bucket)) {
+        bucket++;
+    }
+
+    stats->latency[bucket]++;
+    stats->directories++;
+    stats->entries += entries;
+
+    // without the memory for its path, the largest directory so far is kept
+    if(entries > stats->largest_entries || !stats->largest_path) {
+        char* largest_path = strdup(path);
+
+        if(largest_path) {
+            free(stats->largest_path);
+            stats->largest_entries = entries;
+            stats->largest_path = largest_path;
+        }
+    }
+}
+
+// fold the counters of another context's stats into these (e.g. of a thread that is done)
+void statsAdd(stats_t* stats, stats_t* other) {
+    for(size_t i = 0; i < STATS_PHASES; i++) {
+        stats->phase_ns[i] += other->phase_ns[i];
+    }
+
+    for(size_t i = 0; i < STATS_CALLS; i++) {
+        stats->calls[i] += other->calls[i];
+        stats->errors[i] += other->errors[i];
+    }
+
+    for(size_t i = 0; i < STATS_LATENCY_BUCKETS; i++) {
+        stats->latency[i] += other->latency[i];
+    }
+
+    stats->directories += other->directories;
+    stats->entries += other->entries;
+    stats->id_memo_hits += other->id_memo_hits;
+
+    if(other->largest_path && (other->largest_entries > stats->largest_entries || !stats->largest_path)) {
+        free(stats->largest_path);
+
+        stats->largest_entries = other->largest_entries;
+        stats->largest_path = other->largest_path;
+        other->largest_path = NULL;
+    }
+}
+
+// print the timings, counts and latency histogram
+void statsPrint(stats_t* stats, FILE* out) {
+    fprintf(out, "time: %.3f ms total\n", (statsNow() - stats->started) / 1e6);
+
+    fprintf(out, "phases:");
+
+    for(size_t i = 0; i < STATS_PHASES; i++) {
+        fprintf(out, "%s %s %.3f ms", i ? "," : "", PHASE_NAMES[i], stats->phase_ns[i] / 1e6);
+    }
+
+    fprintf(out, "\nsystem calls:");
+
+    for(size_t i = 0; i < STATS_CALLS; i++) {
+        fprintf(out, "%s %llu %s (%llu failed)", i ? "," : "", (unsigned long long)stats->calls[i], CALL_NAMES[i],
+            (unsigned long long)stats->errors[i]);
+    }
+
+    fprintf(out, "\ndirectories: %llu, entries: %llu", (unsigned long long)stats->directories, (unsigned long long)stats->entries);
+
+    if(stats->largest_path) {
+        fprintf(out, ", largest: %s (%llu entries)", stats->largest_path, (unsigned long long)stats->largest_entries);
+    }
+
+    fprintf(out, "\n");
+
+    if(stats->directories == 0) {
+        return;
+    }
+
+    // only the buckets between the first and last used one
+    size_t first = 0;
+    size_t last = STATS_LATENCY_BUCKETS - 1;
+
+    while(stats->latency[first] == 0) {
+        first++;
+    }
+
+    while(stats->latency[last] == 0) {
+        last--;
+    }
+
+    fprintf(out, "directory latency:\n");
+
+    for(size_t i = first; i <= last; i++) {
+        // the last bucket has no upper bound, it holds everything from where the one before it ends
+        if(i == STATS_LATENCY_BUCKETS - 1) {
+            fprintf(out, " >= %10llu us: %llu\n", (unsigned long long)1 << (i - 1), (unsigned long long)stats->latency[i]);
+        }
+        else {
+            fprintf(out, "  < %10llu us: %llu\n", (unsigned long long)1 << i, (unsigned long long)stats->latency[i]);
+        }
+    }
+}
+
+void statsFree(stats_t* stats) {
+    free(stats->largest_path);
+    free(stats);
+}
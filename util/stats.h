@@ -0,0 +1,85 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+// directories are counted by how long they took to list, bucket i holding those under 2^i microseconds
+#define STATS_LATENCY_BUCKETS 32
+
+// where the time goes, each phase timed where it happens (summed over threads)
+typedef enum stats_phase_t {
+    STATS_READ,   // getdents64
+    STATS_STAT,   // statx and readlink of the entries
+    STATS_SORT,   // sorting names
+    STATS_FORMAT, // column widths and entries formatted into the output buffer
+    STATS_IDS,    // user / group names looked up while formatting (part of STATS_FORMAT)
+    STATS_WRITE,  // output written to stdout (part of STATS_FORMAT when the buffer fills up while formatting)
+    STATS_PHASES
+} stats_phase_t;
+
+// system calls counted along with their failures
+typedef enum stats_call_t {
+    STATS_GETDENTS,
+    STATS_STATX,
+    STATS_READLINK,
+    STATS_CALLS
+} stats_call_t;
+
+// counters for --stats; a context only has one when it's enabled, otherwise its stats pointer is NULL and
+// the helpers below cost a single branch
+// not thread safe, every context has its own and they are added up with statsAdd once the threads are done
+typedef struct stats_t {
+    uint64_t started; // when the run started, for the total time
+    uint64_t phase_ns[STATS_PHASES];
+    uint64_t calls[STATS_CALLS];
+    uint64_t errors[STATS_CALLS];
+
+    uint64_t directories;
+    uint64_t entries;
+    uint64_t largest_entries;
+    char* largest_path; // malloc-ed copy, NULL until a directory has been listed
+
+    uint64_t latency[STATS_LATENCY_BUCKETS];
+
+    uint64_t id_memo_hits; // user / group names answered by a context's id_memo_t, without the id cache
+} stats_t;
+
+stats_t* statsCreate();
+void statsDirectory(stats_t* stats, const char* path, size_t entries, uint64_t start);
+void statsAdd(stats_t* stats, stats_t* other);
+void statsPrint(stats_t* stats, FILE* out);
+void statsFree(stats_t* stats);
+
+// current monotonic time in nanoseconds
+static inline uint64_t statsNow() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// start timing something, the clock is only read if stats are enabled
+static inline uint64_t statsStart(stats_t* stats) {
+    return stats ? statsNow() : 0;
+}
+
+// add the time since start (from statsStart) to phase
+static inline void statsStop(stats_t* stats, stats_phase_t phase, uint64_t start) {
+    if(stats) {
+        stats->phase_ns[phase] += statsNow() - start;
+    }
+}
+
+// count a system call, and whether it failed
+static inline void statsCall(stats_t* stats, stats_call_t call, bool failed) {
+    if(stats) {
+        stats->calls[call]++;
+        stats->errors[call] += failed;
+    }
+}
+
+#endif
@@ -0,0 +1,94 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h> // memset / memcpy
+#include <time.h>
+
+#include "timefmt.h"
+#include "entries.h"
+
+static const time_t SECONDS_PER_DAY = 24 * 60 * 60;
+
+// the format of the time column, always MAX_STR_TIME - 1 characters for years 1000 to 9999
+static const char* TIME_FORMAT = "%b %e %Y %H:%M";
+
+// length of "mmm dd yyyy " (the part of TIME_FORMAT that is cached)
+#define DATE_LENGTH 12
+
+static size_t formatUncached(time_t time, char* buffer);
+static bool findDay(time_t time, time_day_t* day);
+
+// empty the cache; the timezone is read (tzset) here once, instead of being checked for every time
+void timefmtInit(time_cache_t* cache) {
+    tzset();
+    memset(cache, 0, sizeof(time_cache_t));
+}
+
+// write time in the local timezone as TIME_FORMAT to buffer (MAX_STR_TIME bytes), returns its length
+size_t timefmtFormat(time_cache_t* cache, time_t time, char* buffer) {
+    // bucket by UTC day, a local day may end up in two buckets
+    time_t bucket = time / SECONDS_PER_DAY - (time % SECONDS_PER_DAY < 0);
+    time_day_t* day = &cache->days[(size_t)bucket % TIMEFMT_CACHE_SIZE];
+
+    if(time < day->start || time >= day->end) {
+        // days with a change of UTC offset (or out of the fixed width years) are never cached
+        if(!findDay(time, day)) {
+            day->start = day->end = 0;
+            return formatUncached(time, buffer);
+        }
+    }
+
+    time_t seconds = time - day->start;
+    int hour = seconds / 3600;
+    int minute = seconds / 60 % 60;
+
+    memcpy(buffer, day->date, DATE_LENGTH);
+    buffer[DATE_LENGTH] = '0' + hour / 10;
+    buffer[DATE_LENGTH + 1] = '0' + hour % 10;
+    buffer[DATE_LENGTH + 2] = ':';
+    buffer[DATE_LENGTH + 3] = '0' + minute / 10;
+    buffer[DATE_LENGTH + 4] = '0' + minute % 10;
+    buffer[DATE_LENGTH + 5] = '\0';
+
+    return DATE_LENGTH + 5;
+}
+
+// the original way, used for whatever isn't cached
+static size_t formatUncached(time_t time, char* buffer) {
+    struct tm local;
+    localtime_r(&time, &local);
+
+    return strftime(buffer, MAX_STR_TIME, TIME_FORMAT, &local);
+}
+
+// fill day with the local day time falls on, returns false if the day can't be cached: its UTC offset
+// changes during it (so it isn't 24 hours long, or a time of day doesn't follow from the seconds since
+// midnight) or its date isn't DATE_LENGTH characters
+static bool findDay(time_t time, time_day_t* day) {
+    struct tm local, first, last;
+    localtime_r(&time, &local);
+
+    // (a leap second doesn't fit in a day either)
+    if(local.tm_year + 1900 < 1000 || local.tm_year + 1900 > 9999 || local.tm_sec > 59) {
+        return false;
+    }
+
+    time_t start = time - (local.tm_hour * 3600 + local.tm_min * 60 + local.tm_sec);
+    time_t end = start + SECONDS_PER_DAY;
+
+    localtime_r(&start, &first);
+    end--;
+    localtime_r(&end, &last);
+
+    if(first.tm_gmtoff != local.tm_gmtoff || last.tm_gmtoff != local.tm_gmtoff || first.tm_yday != local.tm_yday || last.tm_yday != local.tm_yday) {
+        return false;
+    }
+
+    if(strftime(day->date, sizeof(day->date), "%b %e %Y ", &local) != DATE_LENGTH) {
+        return false;
+    }
+
+    day->start = start;
+    day->end = start + SECONDS_PER_DAY;
+
+    return true;
+}
@@ -0,0 +1,27 @@
+#ifndef _TIMEFMT_H_
+#define _TIMEFMT_H_
+
+#include <stdlib.h>
+#include <time.h>
+
+// number of days remembered by a time cache
+#define TIMEFMT_CACHE_SIZE 16
+
+// "mmm dd yyyy " of a day, and the range of times that fall on it
+typedef struct time_day_t {
+    time_t start;
+    time_t end; // start + 1 day, empty if start == end
+    char date[16];
+} time_day_t;
+
+// formats modification times for -l; the files of a directory tend to share a few days, so the date of
+// each day is only worked out once and the time of day is added to it
+// not thread safe, every context has its own
+typedef struct time_cache_t {
+    time_day_t days[TIMEFMT_CACHE_SIZE];
+} time_cache_t;
+
+void timefmtInit(time_cache_t* cache);
+size_t timefmtFormat(time_cache_t* cache, time_t time, char* buffer);
+
+#endif
@@ -0,0 +1,297 @@
+// _DEFAULT_SOURCE needed for DT_DIR
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h> // memcpy / strcmp / strlen
+#include <errno.h>
+#include <stddef.h> // offsetof
+#include <dirent.h> // DT_DIR
+
+#include "../lsc.h"
+#include "top.h"
+#include "context.h"
+#include "listing.h"
+#include "entries.h"
+#include "dirreader.h"
+#include "vector.h"
+#include "arena.h"
+#include "sort.h"
+
+// an entry kept past the window it was read in, with its own copy of its name and link target
+typedef struct top_entry_t {
+    entry_info_t info;  // name and path point into data
+    unsigned char type; // dirent type of the entry, for -R
+    char data[];        // name, then link target (both nul terminated)
+} top_entry_t;
+
+// --top=N for a sorted directory: the entries are read and stat-ed a window at a time, and only the N
+// listed first are kept, in a heap with the one listed last at the root; memory grows with N and the
+// entries that can't be listed rather than with the directory
+struct top_t {
+    top_entry_t** heap;
+    size_t length;
+    size_t capacity;
+
+    // entries that can't be listed, their errors are all printed (in name order) before the listing
+    char** errors; // names of the entries, see entryOf
+    size_t num_errors;
+    size_t errors_capacity;
+};
+
+static top_entry_t* entryCopy(entry_info_t* entry_info, unsigned char type, bool read_links);
+static top_entry_t* entryOf(char* name);
+static bool heapPush(top_t* top, top_entry_t* entry, options_t* options);
+static void heapSiftDown(top_entry_t** heap, size_t length, size_t parent, options_t* options);
+static bool listedAfter(entry_info_t* a, entry_info_t* b, options_t* options);
+
+// returns NULL if out of memory
+top_t* topCreate(context_t* context) {
+    return calloc(1, sizeof(top_t));
+}
+
+// stat the entries in context->entry_vector and keep those that make the top so far, then release them
+// (the vector is emptied and context->names reset); sets context->error if out of memory
+void topWindow(top_t* top, context_t* context, int dir_fd) {
+    options_t* options = context->options;
+    vector_t* entry_vector = context->entry_vector;
+    size_t count = entry_vector->length;
+
+    if(count == 0) {
+        return;
+    }
+
+    entry_info_t* entry_infos = arenaAlloc(context->names, sizeof(entry_info_t) * count);
+
+    if(!entry_infos) {
+        context->error = ENOMEM;
+        return;
+    }
+
+    processEntries(context, entry_infos, entry_vector, dir_fd);
+
+    for(size_t i = 0; i < count && context->error == 0; i++) {
+        entry_info_t* entry_info = &entry_infos[i];
+        unsigned char type = dirNameOf(entry_vector->items[i])->type;
+        top_entry_t* entry;
+
+        if(entry_info->error != ENTRY_OK) {
+            if(top->num_errors == top->errors_capacity) {
+                size_t capacity = top->errors_capacity ? top->errors_capacity * 2 : 16;
+                char** errors = realloc(top->errors, sizeof(char*) * capacity);
+
+                if(!errors) {
+                    context->error = ENOMEM;
+                    break;
+                }
+
+                top->errors = errors;
+                top->errors_capacity = capacity;
+            }
+
+            entry = entryCopy(entry_info, type, context->plan.read_links);
+
+            if(!entry) {
+                context->error = ENOMEM;
+                break;
+            }
+
+            top->errors[top->num_errors++] = entry->data;
+            continue;
+        }
+
+        // once full, an entry only gets in by pushing out the one listed last
+        if(top->length < options->top) {
+            entry = entryCopy(entry_info, type, context->plan.read_links);
+
+            if(!entry || !heapPush(top, entry, options)) {
+                free(entry);
+                context->error = ENOMEM;
+            }
+        }
+        else if(listedAfter(&top->heap[0]->info, entry_info, options)) {
+            entry = entryCopy(entry_info, type, context->plan.read_links);
+
+            if(!entry) {
+                context->error = ENOMEM;
+                break;
+            }
+
+            free(top->heap[0]);
+            top->heap[0] = entry;
+            heapSiftDown(top->heap, top->length, 0, options);
+        }
+    }
+
+    vectorClear(entry_vector);
+    arenaReset(context->names);
+}
+
+// keep what is left of the directory at path, then print the errors and the entries that were kept, and with
+// -R add the paths of the directories among them to context->subdir_vector (in the order they are listed)
+// sets context->error if out of memory, whatever wasn't listed is freed by topFree
+void topFinish(top_t* top, context_t* context, char* path, int dir_fd) {
+    options_t* options = context->options;
+
+    topWindow(top, context, dir_fd);
+
+    if(context->error != 0) {
+        return;
+    }
+
+    if(!sortNames(top->errors, top->num_errors, options->collate, context->names)) {
+        context->error = ENOMEM;
+        return;
+    }
+
+    size_t count = top->num_errors + top->length;
+    top_entry_t** listed = arenaAlloc(context->names, sizeof(top_entry_t*) * count);
+    entry_info_t* entry_infos = arenaAlloc(context->names, sizeof(entry_info_t) * count);
+
+    if(!listed || !entry_infos) {
+        context->error = ENOMEM;
+        return;
+    }
+
+    // the heap is taken apart from the root, the entry listed last first
+    for(size_t i = 0; i < top->num_errors; i++) {
+        listed[i] = entryOf(top->errors[i]);
+    }
+
+    for(size_t i = count; top->length > 0; ) {
+        listed[--i] = top->heap[0];
+        top->heap[0] = top->heap[--top->length];
+        heapSiftDown(top->heap, top->length, 0, options);
+    }
+
+    for(size_t i = 0; i < count; i++) {
+        entry_infos[i] = listed[i]->info;
+    }
+
+    printEntries(context, entry_infos, count);
+
+    for(size_t i = 0; i < count; i++) {
+        char* name = listed[i]->info.name;
+
+        if(options->recursive && context->error == 0 && listed[i]->type == DT_DIR && strcmp(name, ".") != 0 && strcmp(name, "..") != 0) {
+            char* subdir = joinPath(context->paths, path, name);
+
+            if(!subdir || !vectorPush(context->subdir_vector, subdir)) {
+                context->error = ENOMEM;
+            }
+        }
+
+        free(listed[i]);
+    }
+
+    top->num_errors = 0;
+    arenaReset(context->names);
+}
+
+void topFree(top_t* top) {
+    for(size_t i = 0; i < top->length; i++) {
+        free(top->heap[i]);
+    }
+
+    for(size_t i = 0; i < top->num_errors; i++) {
+        free(entryOf(top->errors[i]));
+    }
+
+    free(top->heap);
+    free(top->errors);
+    free(top);
+}
+
+// copy an entry out of the names arena, its link target is only used (and valid) with read_links (see metadata_plan_t)
+// returns NULL if out of memory
+static top_entry_t* entryCopy(entry_info_t* entry_info, unsigned char type, bool read_links) {
+    bool has_path = read_links && entry_info->error == ENTRY_OK && entry_info->path != NULL;
+    size_t path_len = has_path ? strlen(entry_info->path) + 1 : 0;
+    top_entry_t* entry = malloc(sizeof(top_entry_t) + entry_info->name_len + 1 + path_len);
+
+    if(!entry) {
+        return NULL;
+    }
+
+    entry->info = *entry_info;
+    entry->type = type;
+
+    memcpy(entry->data, entry_info->name, entry_info->name_len + 1);
+    entry->info.name = entry->data;
+    entry->info.path = NULL;
+
+    if(has_path) {
+        entry->info.path = &entry->data[entry_info->name_len + 1];
+        memcpy(entry->info.path, entry_info->path, path_len);
+    }
+
+    return entry;
+}
+
+// the entry a name returned by entryCopy belongs to
+static top_entry_t* entryOf(char* name) {
+    return (top_entry_t*)(name - offsetof(top_entry_t, data));
+}
+
+// returns false if the heap couldn't grow, entry isn't added
+static bool heapPush(top_t* top, top_entry_t* entry, options_t* options) {
+    if(top->length == top->capacity) {
+        size_t capacity = top->capacity ? top->capacity * 2 : 16;
+
+        if(capacity > options->top) {
+            capacity = options->top;
+        }
+
+        top_entry_t** heap = realloc(top->heap, sizeof(top_entry_t*) * capacity);
+
+        if(!heap) {
+            return false;
+        }
+
+        top->heap = heap;
+        top->capacity = capacity;
+    }
+
+    // sift up to its place, the parents of the new entry are listed after it
+    size_t child = top->length++;
+
+    for(; child > 0 && listedAfter(&entry->info, &top->heap[(child - 1) / 2]->info, options); child = (child - 1) / 2) {
+        top->heap[child] = top->heap[(child - 1) / 2];
+    }
+
+    top->heap[child] = entry;
+    return true;
+}
+
+static void heapSiftDown(top_entry_t** heap, size_t length, size_t parent, options_t* options) {
+    top_entry_t* entry = heap[parent];
+
+    while(true) {
+        size_t child = 2 * parent + 1;
+
+        if(child >= length) {
+            break;
+        }
+
+        if(child + 1 < length && listedAfter(&heap[child + 1]->info, &heap[child]->info, options)) {
+            child++;
+        }
+
+        if(!listedAfter(&heap[child]->info, &entry->info, options)) {
+            break;
+        }
+
+        heap[parent] = heap[child];
+        parent = child;
+    }
+
+    heap[parent] = entry;
+}
+
+// whether a is listed after b
+static bool listedAfter(entry_info_t* a, entry_info_t* b, options_t* options) {
+    return entryCompare(options, a, b) > 0;
+}
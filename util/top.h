@@ -0,0 +1,14 @@
+#ifndef _TOP_H_
+#define _TOP_H_
+
+#include "../lsc.h"
+#include "context.h"
+
+typedef struct top_t top_t;
+
+top_t* topCreate(context_t* context);
+void topWindow(top_t* top, context_t* context, int dir_fd);
+void topFinish(top_t* top, context_t* context, char* path, int dir_fd);
+void topFree(top_t* top);
+
+#endif
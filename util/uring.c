@@ -0,0 +1,261 @@
+// _GNU_SOURCE needed for struct statx
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h> // memset
+#include <errno.h>
+#include <fcntl.h> // AT_FDCWD, AT_SYMLINK_NOFOLLOW
+#include <unistd.h> // syscall, close
+#include <sys/mman.h>
+#include <sys/stat.h> // statx
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+// io_uring is only used when the kernel headers know about it, otherwise uringCreate always fails
+// and the caller keeps using the synchronous path
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+
+#include <linux/io_uring.h>
+
+// an io_uring instance with its submission and completion rings mapped
+struct uring_t {
+    int fd;
+    unsigned entries;
+
+    // submission ring
+    void* sq_ring;
+    size_t sq_ring_size;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    struct io_uring_sqe* sqes;
+    size_t sqes_size;
+
+    // completion ring
+    void* cq_ring;
+    size_t cq_ring_size;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+};
+
+static bool statxSupported(int fd);
+static void uringDrain(uring_t* uring, size_t in_flight);
+
+// set up a ring for batched statx, returns NULL if io_uring or IORING_OP_STATX is unavailable (or out of memory)
+uring_t* uringCreate() {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    int fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+
+    if(fd == -1) {
+        return NULL;
+    }
+
+    if(!statxSupported(fd)) {
+        close(fd);
+        return NULL;
+    }
+
+    uring_t* uring = malloc(sizeof(uring_t));
+
+    if(!uring) {
+        close(fd);
+        return NULL;
+    }
+
+    uring->fd = fd;
+    uring->entries = params.sq_entries < URING_ENTRIES ? params.sq_entries : URING_ENTRIES;
+
+    uring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    uring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    uring->sq_ring = mmap(NULL, uring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    uring->cq_ring = mmap(NULL, uring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    uring->sqes = mmap(NULL, uring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+
+    if(uring->sq_ring == MAP_FAILED || uring->cq_ring == MAP_FAILED || uring->sqes == MAP_FAILED) {
+        if(uring->sq_ring != MAP_FAILED) {
+            munmap(uring->sq_ring, uring->sq_ring_size);
+        }
+
+        if(uring->cq_ring != MAP_FAILED) {
+            munmap(uring->cq_ring, uring->cq_ring_size);
+        }
+
+        if(uring->sqes != MAP_FAILED) {
+            munmap(uring->sqes, uring->sqes_size);
+        }
+
+        close(fd);
+        free(uring);
+        return NULL;
+    }
+
+    char* sq = uring->sq_ring;
+    uring->sq_head = (unsigned*)(sq + params.sq_off.head);
+    uring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    uring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    uring->sq_array = (unsigned*)(sq + params.sq_off.array);
+
+    char* cq = uring->cq_ring;
+    uring->cq_head = (unsigned*)(cq + params.cq_off.head);
+    uring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    uring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    uring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    return uring;
+}
+
+// statx (without following symlinks) count names relative to dir_fd (-1 if relative to cwd) asking for the
+// fields in mask, keeping up to uring->entries in flight
+// errors[i] is 0 and results[i] filled if names[i] was stat-ed, otherwise errors[i] is the errno
+// returns false if the ring itself failed, in which case the caller should stat synchronously (nothing in flight
+// writes to results anymore by then)
+bool uringStatBatch(uring_t* uring, int dir_fd, char** names, size_t count, unsigned int mask, struct statx* results, int* errors) {
+    int at_fd = dir_fd == -1 ? AT_FDCWD : dir_fd;
+
+    size_t submitted = 0;
+    size_t completed = 0;
+
+    // queued in the ring but not yet accepted by the kernel
+    unsigned to_submit = 0;
+
+    while(completed < count) {
+        // queue requests until the ring is full, the user data of a request is the index of its name
+        unsigned tail = *uring->sq_tail;
+
+        while(submitted < count && submitted - completed < uring->entries) {
+            unsigned index = tail & *uring->sq_mask;
+            struct io_uring_sqe* sqe = &uring->sqes[index];
+
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = IORING_OP_STATX;
+            sqe->fd = at_fd;
+            sqe->addr = (uintptr_t)names[submitted];
+            sqe->len = mask;
+            sqe->off = (uintptr_t)&results[submitted];
+            sqe->statx_flags = AT_SYMLINK_NOFOLLOW;
+            sqe->user_data = submitted;
+
+            uring->sq_array[index] = index;
+
+            tail++;
+            to_submit++;
+            submitted++;
+        }
+
+        __atomic_store_n(uring->sq_tail, tail, __ATOMIC_RELEASE);
+
+        // submit and wait for at least one completion
+        int enter_res;
+
+        do {
+            enter_res = syscall(__NR_io_uring_enter, uring->fd, to_submit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        } while(enter_res == -1 && errno == EINTR);
+
+        // the requests the kernel already took still write to results, wait for them before giving up
+        if(enter_res == -1) {
+            uringDrain(uring, submitted - completed - to_submit);
+            return false;
+        }
+
+        to_submit -= enter_res;
+
+        // reap everything that has completed
+        unsigned head = *uring->cq_head;
+        unsigned cq_tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+
+        for(; head != cq_tail; head++) {
+            struct io_uring_cqe* cqe = &uring->cqes[head & *uring->cq_mask];
+            errors[cqe->user_data] = cqe->res < 0 ? -cqe->res : 0;
+            completed++;
+        }
+
+        __atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    return true;
+}
+
+// wait for in_flight requests to complete and reap them, dropping their results
+// the ones never taken by the kernel are left in the submission ring, they don't run once it is freed
+static void uringDrain(uring_t* uring, size_t in_flight) {
+    while(in_flight > 0) {
+        int enter_res = syscall(__NR_io_uring_enter, uring->fd, 0, in_flight, IORING_ENTER_GETEVENTS, NULL, 0);
+
+        // only a ring that can't be waited on at all (which the first io_uring_enter would have hit) stops this
+        if(enter_res == -1 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            return;
+        }
+
+        unsigned head = *uring->cq_head;
+        unsigned cq_tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+
+        for(; head != cq_tail && in_flight > 0; head++) {
+            in_flight--;
+        }
+
+        __atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+    }
+}
+
+// unmap the rings and close the io_uring instance
+void uringFree(uring_t* uring) {
+    munmap(uring->sq_ring, uring->sq_ring_size);
+    munmap(uring->cq_ring, uring->cq_ring_size);
+    munmap(uring->sqes, uring->sqes_size);
+    close(uring->fd);
+    free(uring);
+}
+
+// ask the kernel whether IORING_OP_STATX is implemented (5.6+), taken as not if there's no memory to ask
+static bool statxSupported(int fd) {
+    size_t probe_size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe* probe = calloc(1, probe_size);
+
+    if(!probe) {
+        return false;
+    }
+
+    bool supported = false;
+
+    if(syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) == 0) {
+        supported = probe->last_op >= IORING_OP_STATX && (probe->ops[IORING_OP_STATX].flags & IO_URING_OP_SUPPORTED);
+    }
+
+    free(probe);
+    return supported;
+}
+
+#else
+
+// built without io_uring support
+uring_t* uringCreate() {
+    return NULL;
+}
+
+bool uringStatBatch(uring_t* uring, int dir_fd, char** names, size_t count, unsigned int mask, struct statx* results, int* errors) {
+    return false;
+}
+
+void uringFree(uring_t* uring) {
+}
+
+#endif
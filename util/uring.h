@@ -0,0 +1,20 @@
+#ifndef _URING_H_
+#define _URING_H_
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+// number of submission queue entries, also the number of stats in flight at once
+#define URING_ENTRIES 256
+
+// number of entries stat-ed per batch by listFiles before they are processed
+#define URING_BATCH_SIZE 4096
+
+typedef struct uring_t uring_t;
+
+uring_t* uringCreate();
+bool uringStatBatch(uring_t* uring, int dir_fd, char** names, size_t count, unsigned int mask, struct statx* results, int* errors);
+void uringFree(uring_t* uring);
+
+#endif
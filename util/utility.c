@@ -1,46 +1,35 @@
 #include <stdlib.h>
 #include <stdio.h>
-#include <string.h> // memset / strlen
+#include <string.h> // memset / strlen / strerror
+#include <stdint.h>
 #include <errno.h>
 #include <sys/stat.h> // constants for mode
 
 #include "../lsc.h"
 #include "utility.h"
 #include "entries.h"
-
-// return the maximum of a, b (used in getColumnWidths)
-static unsigned max(unsigned a, unsigned b) {
-    return a > b ? a : b;
-}
-
-// get the column widths based upon the max length of the data in each column
-void getColumnWidths(column_widths_t* column_widths, entry_info_t* entry_infos, size_t num_entries, options_t* options) {
-    // zero out the lengths initially
-    memset(column_widths, 0, sizeof(column_widths_t));
-
-    for(size_t i = 0; i < num_entries; i++) {
-        if(entry_infos[i].error) {
-            continue;
-        }
-
-        if(options->index) {
-            column_widths->ino = max(column_widths->ino, strlen(entry_infos[i].ino));
-        }
-
-        if(options->long_list) {
-            column_widths->nlinks = max(column_widths->nlinks, strlen(entry_infos[i].nlinks));
-            column_widths->user = max(column_widths->user, strlen(entry_infos[i].user));
-            column_widths->group = max(column_widths->group, strlen(entry_infos[i].group));
-            column_widths->size = max(column_widths->size, strlen(entry_infos[i].size));
-        }
-
-        // if we're printing with the -l option, line up file names if one has quotes
-        if(options->long_list && !column_widths->name_needs_space) {
-            // haven't found a name needing a quote yet, check this one
-            column_widths->name_needs_space = entry_infos[i].name_quotes ? true : false;
-        }
-    }
-}
+#include "output.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define CLASSIFY_BLOCK_SIZE 32
+static uint32_t classifyBlock(const unsigned char* block);
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define CLASSIFY_BLOCK_SIZE 16
+static uint32_t classifyBlock(const unsigned char* block);
+#endif
+
+// how a name containing each byte has to be quoted: in double quotes if it has a ', otherwise in single
+// quotes if it has any of the other special characters
+static const char NAME_CLASSES[256] = {
+    ['\''] = QUOTE_DOUBLE,
+    [' '] = QUOTE_SINGLE, ['`'] = QUOTE_SINGLE, ['!'] = QUOTE_SINGLE, ['$'] = QUOTE_SINGLE,
+    ['^'] = QUOTE_SINGLE, ['&'] = QUOTE_SINGLE, ['*'] = QUOTE_SINGLE, ['('] = QUOTE_SINGLE,
+    [')'] = QUOTE_SINGLE, ['['] = QUOTE_SINGLE, ['"'] = QUOTE_SINGLE, ['?'] = QUOTE_SINGLE,
+    [';'] = QUOTE_SINGLE, ['|'] = QUOTE_SINGLE, ['<'] = QUOTE_SINGLE, ['>'] = QUOTE_SINGLE,
+    ['='] = QUOTE_SINGLE,
+};
 
 // get a mode string based upon the mode_t value
 void getModeString(char* buffer, mode_t mode) {
@@ -106,8 +95,8 @@ void getModeString(char* buffer, mode_t mode) {
     buffer[10] = '\0';
 }
 
-// get human readable size (in bytes, KB, MB or GB)
-void getNiceSize(char* buffer, size_t size) {
+// get human readable size (in bytes, KB, MB or GB), returns the length of the string put in buffer
+size_t getNiceSize(char* buffer, size_t size) {
     const int DIVISOR = 1024;
 
     char symbol = 'B';
@@ -130,39 +119,133 @@ void getNiceSize(char* buffer, size_t size) {
         floatsize /= DIVISOR;
     }
 
-    snprintf(buffer, MAX_STR_SIZE, "%.*f%c", decimals, floatsize, symbol);
-}
+    // same digits as printf "%.*f": a float times 10 is exact in a double, so the
+    // rounding is done on the exact value (ties to even)
+    double scaled = decimals ? (double)floatsize * 10 : (double)floatsize;
+    uint64_t rounded = (uint64_t)scaled;
+    double fraction = scaled - rounded;
+
+    if(fraction > 0.5 || (fraction == 0.5 && (rounded & 1))) {
+        rounded++;
+    }
 
-char stringNeedsQuotes(char* name) {
-    // check for the prescence of special characters requiring quotes
-    const char* chars_need_double = "'";
-    const char* chars_need_single = " `!$^&*()[\"?;|<>=";
+    size_t length = formatUnsigned(buffer, decimals ? rounded / 10 : rounded);
 
-    for(int i = 0; i < strlen(chars_need_double); i++) {
-        if(strchr(name, chars_need_double[i]) != NULL) {
-            return QUOTE_DOUBLE;
+    if(decimals) {
+        buffer[length++] = '.';
+        buffer[length++] = '0' + rounded % 10;
+    }
+
+    buffer[length++] = symbol;
+    buffer[length] = '\0';
+
+    return length;
+}
+
+// find out how a name has to be quoted (QUOTE_NONE, QUOTE_SINGLE or QUOTE_DOUBLE) and its length in one pass
+// the vector paths look at a whole block at a time, only blocks holding a byte that may need quotes (or
+// the end of the name) are looked at byte by byte; the loads are aligned so they never cross into the
+// next page, but may read past the end of the name within the block (hence not sanitized)
+__attribute__((no_sanitize("address", "thread")))
+char classifyName(const char* name, size_t* length) {
+    const unsigned char* str = (const unsigned char*)name;
+    char quotes = QUOTE_NONE;
+
+#if defined(__AVX2__) || defined(__SSE2__)
+    const unsigned char* block = (const unsigned char*)((uintptr_t)str & ~(uintptr_t)(CLASSIFY_BLOCK_SIZE - 1));
+    unsigned skip = str - block;
+
+    for(;; block += CLASSIFY_BLOCK_SIZE, skip = 0) {
+        // bytes before the start of the name are masked off
+        uint32_t mask = classifyBlock(block) >> skip << skip;
+
+        for(; mask != 0; mask &= mask - 1) {
+            unsigned i = __builtin_ctz(mask);
+
+            if(block[i] == '\0') {
+                *length = &block[i] - str;
+                return quotes;
+            }
+
+            if(NAME_CLASSES[block[i]] > quotes) {
+                quotes = NAME_CLASSES[block[i]];
+            }
         }
     }
+#else
+    size_t i = 0;
 
-    for(int i = 0; i < strlen(chars_need_single); i++) {
-        if(strchr(name, chars_need_single[i]) != NULL) {
-            return QUOTE_SINGLE;
+    for(; str[i] != '\0'; i++) {
+        if(NAME_CLASSES[str[i]] > quotes) {
+            quotes = NAME_CLASSES[str[i]];
         }
     }
 
-    return QUOTE_NONE;
+    *length = i;
+    return quotes;
+#endif
+}
+
+#if defined(__AVX2__)
+// bit i is set if byte i of the (aligned) block may need quotes or is '\0': bytes 0x20-0x2a and 0x3b-0x3f
+// (signed compares, so bytes >= 0x80 are never in range), and each of '\0', '[', '^', '`' and '|'
+__attribute__((no_sanitize("address", "thread")))
+static uint32_t classifyBlock(const unsigned char* block) {
+    __m256i bytes = _mm256_load_si256((const __m256i*)block);
+
+    __m256i low = _mm256_and_si256(_mm256_cmpgt_epi8(bytes, _mm256_set1_epi8(0x1f)), _mm256_cmpgt_epi8(_mm256_set1_epi8(0x2b), bytes));
+    __m256i high = _mm256_and_si256(_mm256_cmpgt_epi8(bytes, _mm256_set1_epi8(0x3a)), _mm256_cmpgt_epi8(_mm256_set1_epi8(0x40), bytes));
+    __m256i others = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_setzero_si256()), _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('['))),
+        _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('^')), _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('`'))),
+            _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('|'))));
+
+    return _mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(low, high), others));
 }
+#elif defined(__SSE2__)
+// same as the AVX2 version, 16 bytes at a time
+__attribute__((no_sanitize("address", "thread")))
+static uint32_t classifyBlock(const unsigned char* block) {
+    __m128i bytes = _mm_load_si128((const __m128i*)block);
+
+    __m128i low = _mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8(0x1f)), _mm_cmplt_epi8(bytes, _mm_set1_epi8(0x2b)));
+    __m128i high = _mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8(0x3a)), _mm_cmplt_epi8(bytes, _mm_set1_epi8(0x40)));
+    __m128i others = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_setzero_si128()), _mm_cmpeq_epi8(bytes, _mm_set1_epi8('['))),
+        _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('^')), _mm_cmpeq_epi8(bytes, _mm_set1_epi8('`'))),
+            _mm_cmpeq_epi8(bytes, _mm_set1_epi8('|'))));
+
+    return _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(low, high), others));
+}
+#endif
 
-void printWithQuotes(char* str, char needs_quotes) {
+void printWithQuotes(output_t* out, const char* str, size_t length, char needs_quotes) {
     switch(needs_quotes) {
         case QUOTE_NONE:
-            printf("%s", str);
+            outputWrite(out, str, length);
             return;
         case QUOTE_SINGLE:
-            printf("'%s'", str);
+            outputChar(out, '\'');
+            outputWrite(out, str, length);
+            outputChar(out, '\'');
             return;
         case QUOTE_DOUBLE:
-            printf("\"%s\"", str);
+            outputChar(out, '"');
+            outputWrite(out, str, length);
+            outputChar(out, '"');
             return;
     }
+}
+
+// print an error about name in the same format as ls: lsc: <what> '<name>': <strerror(error)>
+void printError(output_t* out, const char* what, const char* name, int error) {
+    outputString(out, "lsc: ");
+    outputString(out, what);
+    outputWrite(out, " '", 2);
+    outputString(out, name);
+    outputWrite(out, "': ", 3);
+    outputString(out, strerror(error));
+    outputChar(out, '\n');
 }
\ No newline at end of file
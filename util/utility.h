@@ -3,12 +3,14 @@
 
 #include "../lsc.h"
 #include "entries.h"
+#include "context.h"
+#include "output.h"
 
-void getColumnWidths(column_widths_t* column_widths, entry_info_t* entry_infos, size_t num_entries, options_t* options);
 void getModeString(char* buffer, mode_t mode);
-void getNiceSize(char* buffer, size_t size);
+size_t getNiceSize(char* buffer, size_t size);
 
-char stringNeedsQuotes(char* name);
-void printWithQuotes(char* str, char needs_quotes);
+char classifyName(const char* name, size_t* length);
+void printWithQuotes(output_t* out, const char* str, size_t length, char needs_quotes);
+void printError(output_t* out, const char* what, const char* name, int error);
 
 #endif
\ No newline at end of file
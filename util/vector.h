@@ -2,6 +2,7 @@
 #define _VECTOR_H_
 
 #include <stdlib.h>
+#include <stdbool.h>
 
 typedef struct vector_t {
     size_t length;
@@ -10,8 +11,8 @@ typedef struct vector_t {
 } vector_t;
 
 vector_t* vectorCreate();
-void vectorPush(vector_t* vector, char* item);
-void vectorSort(vector_t* vector);
+bool vectorPush(vector_t* vector, char* item);
+void vectorClear(vector_t* vector);
 void vectorFree(vector_t* vector);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,969 @@
+// _DEFAULT_SOURCE needed for DT_DIR / IFTODT
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h> // memcpy / memmove / strcmp / strlen / strerror
+#include <stddef.h> // offsetof
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>   // clock_gettime
+#include <fcntl.h>  // AT_FDCWD / AT_SYMLINK_NOFOLLOW
+#include <unistd.h> // close / read
+#include <poll.h>
+#include <dirent.h> // DT_DIR / IFTODT
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#include "../lsc.h"
+#include "watch.h"
+#include "listing.h"
+#include "entries.h"
+#include "context.h"
+#include "dirreader.h"
+#include "output.h"
+#include "utility.h"
+#include "vector.h"
+#include "arena.h"
+#include "sort.h"
+
+// what changes to the entries of a directory are watched for, anything that can change a line of its listing
+#define WATCH_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | IN_MODIFY | IN_CLOSE_WRITE | IN_ONLYDIR)
+
+// the variable width columns of column_widths_t, see columnOf
+#define WATCH_COLUMNS 5
+
+typedef struct watch_dir_t watch_dir_t;
+
+// an entry of a watched directory, with its own copy of its name and link target
+typedef struct watch_entry_t {
+    entry_info_t info;       // name and path point into data
+    column_widths_t widths;  // the widths of its own columns
+    watch_dir_t* subdir;     // with -R, the listing of the directory it is, NULL otherwise
+    uint64_t ino;            // from the dirent (or statx), tells a directory apart from one moved over it
+    unsigned char type;      // dirent type of the entry, for -R
+    char data[];             // name, then link target (both nul terminated)
+} watch_entry_t;
+
+// a watched directory, the entries listed the last time it was drawn
+struct watch_dir_t {
+    watch_dir_t* parent; // with -R, the directory it is an entry of, NULL for the directories given
+    int wd;         // inotify watch descriptor, -1 if it isn't watched
+    int error;      // errno if it couldn't be opened, 0 otherwise
+    int read_error; // errno if reading it failed part way, 0 otherwise
+
+    // in name order, or in the order they were read with -U (new entries are added at the end)
+    watch_entry_t** entries;
+    size_t length;
+    size_t capacity;
+
+    // the widest value of each column and how many entries have it, so an entry going away only costs a
+    // pass over the directory when it was the last one that wide
+    column_widths_t widths;
+    size_t at_width[WATCH_COLUMNS];
+    size_t num_quoted; // entries whose name is quoted, the names are lined up with -l if there are any
+
+    char path[];
+};
+
+// a change to an entry waiting to be applied, the entry is re-stat-ed whatever the change was
+typedef struct watch_event_t {
+    int wd;
+    char name[];
+} watch_event_t;
+
+// --watch: the directories are listed once with the same reader and processEntry as a normal listing and kept in
+// memory, with an inotify watch on each; changes are collected for WATCH_COALESCE_MS after the first one, then only
+// the entries they name are stat-ed again and everything is drawn again from memory
+struct watch_t {
+    context_t* context;
+    int fd; // inotify instance
+    vector_t* files; // the files given, stat-ed again on every redraw
+
+    watch_dir_t** roots; // the directories given
+    size_t num_roots;
+
+    // watched directories by watch descriptor
+    watch_dir_t** dirs;
+    size_t dirs_capacity;
+
+    vector_t* pending; // names of the changed entries, see eventOf
+    bool reload;       // events were lost, everything has to be read again
+    bool drawn;        // the listing has been drawn at least once
+    bool warned;       // a directory couldn't be watched, only reported once
+};
+
+static watch_dir_t* dirCreate(char* path, char* name, arena_t* arena);
+static watch_dir_t* dirOf(char* path);
+static void dirFree(watch_t* watch, watch_dir_t* dir);
+static void dirWatch(watch_t* watch, watch_dir_t* dir, int dir_fd);
+static int dirOpen(context_t* context, watch_dir_t* dir);
+static void dirLoad(watch_t* watch, watch_dir_t* dir);
+static char** loadVisit(void* arg, char* path, int dir_fd, int error, bool first, size_t* num_subdirs);
+static watch_entry_t* entryCreate(context_t* context, entry_info_t* entry_info, unsigned char type, uint64_t ino);
+static watch_entry_t* entryOf(char* name);
+static void entryFree(watch_t* watch, watch_entry_t* entry);
+static bool entryFind(watch_t* watch, watch_dir_t* dir, char* name, size_t* position);
+static void entryInsert(watch_dir_t* dir, watch_entry_t* entry, size_t position);
+static void entryRemove(watch_t* watch, watch_dir_t* dir, size_t position);
+static void entryUpdate(watch_t* watch, watch_dir_t* dir, int dir_fd, char* name);
+static unsigned* columnOf(column_widths_t* column_widths, int column);
+static void widthsAdd(watch_dir_t* dir, watch_entry_t* entry);
+static void widthsRemove(watch_dir_t* dir, watch_entry_t* entry);
+static bool readEvents(watch_t* watch);
+static void applyEvents(watch_t* watch);
+static int eventCompare(const void* a, const void* b);
+static watch_event_t* eventOf(char* name);
+static void drawAll(watch_t* watch);
+static void drawDir(watch_t* watch, watch_dir_t* dir, bool first);
+static uint64_t nowMs();
+
+// list the files and directories given and start watching the directories (the whole tree with -R)
+// returns NULL if inotify isn't available
+watch_t* watchCreate(context_t* context, vector_t* files, vector_t* directories) {
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    if(fd == -1) {
+        fprintf(stderr, "lsc: cannot watch: %s\n", strerror(errno));
+        return NULL;
+    }
+
+    watch_t* watch = calloc(1, sizeof(watch_t));
+
+    if(!watch) {
+        printf("malloc() failed...exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    watch->context = context;
+    watch->fd = fd;
+    watch->files = files;
+    watch->pending = vectorCreate();
+    watch->num_roots = directories->length;
+    watch->roots = malloc(sizeof(watch_dir_t*) * (directories->length + 1));
+
+    if(!watch->pending || !watch->roots) {
+        printf("malloc() failed...exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for(size_t i = 0; i < watch->num_roots; i++) {
+        watch->roots[i] = dirCreate(directories->items[i], NULL, context->names);
+        dirLoad(watch, watch->roots[i]);
+    }
+
+    return watch;
+}
+
+// draw the listing, then draw it again after every burst of changes; only returns if the events can't be read
+void watchRun(watch_t* watch) {
+    struct pollfd poll_fd = { .fd = watch->fd, .events = POLLIN };
+
+    drawAll(watch);
+
+    while(true) {
+        if(poll(&poll_fd, 1, -1) == -1 && errno != EINTR) {
+            break;
+        }
+
+        if(!readEvents(watch)) {
+            break;
+        }
+
+        // nothing that is shown changed (e.g. a hidden file)
+        if(watch->pending->length == 0 && !watch->reload) {
+            continue;
+        }
+
+        // the rest of the burst (up to WATCH_COALESCE_MS after its first change) is collected before anything is stat-ed
+        uint64_t deadline = nowMs() + WATCH_COALESCE_MS;
+
+        bool read = true;
+
+        for(uint64_t now = nowMs(); read && now < deadline; now = nowMs()) {
+            if(poll(&poll_fd, 1, deadline - now) > 0) {
+                read = readEvents(watch);
+            }
+        }
+
+        if(!read) {
+            break;
+        }
+
+        applyEvents(watch);
+        drawAll(watch);
+    }
+
+    fprintf(stderr, "lsc: cannot watch: %s\n", strerror(errno));
+}
+
+void watchFree(watch_t* watch) {
+    for(size_t i = 0; i < watch->num_roots; i++) {
+        dirFree(watch, watch->roots[i]);
+    }
+
+    for(size_t i = 0; i < watch->pending->length; i++) {
+        free(eventOf(watch->pending->items[i]));
+    }
+
+    close(watch->fd);
+    vectorFree(watch->pending);
+    free(watch->roots);
+    free(watch->dirs);
+    free(watch);
+}
+
+// a directory with nothing read yet, its path is path joined with name (or just path if name is NULL)
+// arena is only used while it is created
+static watch_dir_t* dirCreate(char* path, char* name, arena_t* arena) {
+    arena_mark_t mark = arenaMark(arena);
+    char* dir_path = name ? joinPath(arena, path, name) : path;
+
+    if(!dir_path) {
+        printf("malloc() failed...exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t path_len = strlen(dir_path);
+    watch_dir_t* dir = calloc(1, sizeof(watch_dir_t) + path_len + 1);
+
+    if(!dir) {
+        printf("malloc() failed...exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    dir->wd = -1;
+    memcpy(dir->path, dir_path, path_len + 1);
+    arenaRewind(arena, mark);
+
+    return dir;
+}
+
+// the directory a path returned by dirCreate belongs to
+static watch_dir_t* dirOf(char* path) {
+    return (watch_dir_t*)(path - offsetof(watch_dir_t, path));
+}
+
+// stop watching a directory and its subdirectories, and free them
+static void dirFree(watch_t* watch, watch_dir_t* dir) {
+    for(size_t i = 0; i < dir->length; i++) {
+        entryFree(watch, dir->entries[i]);
+    }
+
+    // the watch may have gone with the directory, or be another directory's by now (moved within the tree)
+    if(dir->wd != -1 && watch->dirs[dir->wd] == dir) {
+        inotify_rm_watch(watch->fd, dir->wd);
+        watch->dirs[dir->wd] = NULL;
+    }
+
+    free(dir->entries);
+    free(dir);
+}
+
+// add an inotify watch on the directory opened as dir_fd, through /proc so the length of its path doesn't matter
+static void dirWatch(watch_t* watch, watch_dir_t* dir, int dir_fd) {
+    char fd_path[64];
+    snprintf(fd_path, sizeof(fd_path), "/proc/self/fd/%d", dir_fd);
+
+    int wd = inotify_add_watch(watch->fd, fd_path, WATCH_EVENTS);
+
+    if(wd == -1) {
+        // the listing still works, it just isn't kept up to date (usually fs.inotify.max_user_watches is too low)
+        if(!watch->warned) {
+            fprintf(stderr, "lsc: cannot watch '%s': %s\n", dir->path, strerror(errno));
+            watch->warned = true;
+        }
+
+        return;
+    }
+
+    if((size_t)wd >= watch->dirs_capacity) {
+        size_t capacity = watch->dirs_capacity ? watch->dirs_capacity : 64;
+
+        while(capacity <= (size_t)wd) {
+            capacity *= 2;
+        }
+
+        watch->dirs = realloc(watch->dirs, sizeof(watch_dir_t*) * capacity);
+
+        if(!watch->dirs) {
+            printf("realloc() failed...exiting\n");
+            exit(EXIT_FAILURE);
+        }
+
+        memset(&watch->dirs[watch->dirs_capacity], 0, sizeof(watch_dir_t*) * (capacity - watch->dirs_capacity));
+        watch->dirs_capacity = capacity;
+    }
+
+    // a directory moved within the tree keeps its watch, the copy of it under its old name lets go of it
+    if(watch->dirs[wd] != NULL && watch->dirs[wd] != dir) {
+        watch->dirs[wd]->wd = -1;
+    }
+
+    watch->dirs[wd] = dir;
+    dir->wd = wd;
+}
+
+// open a watched directory again by its path, -1 if it is gone
+static int dirOpen(context_t* context, watch_dir_t* dir) {
+    int dir_fd = openat(AT_FDCWD, dir->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if(dir_fd == -1 && errno == ENAMETOOLONG) {
+        dir_fd = openDirectory(context, AT_FDCWD, dir->path, NULL);
+    }
+
+    return dir_fd;
+}
+
+// read and watch a directory with nothing read yet (and with -R, the tree under it)
+static void dirLoad(watch_t* watch, watch_dir_t* dir) {
+    if(!walkTree(watch->context->paths, NULL, dir->path, loadVisit, watch)) {
+        printf("malloc() failed...exiting\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// walkTree callback for dirLoad: read the directory at path, and with -R return the paths of its subdirectories
+static char** loadVisit(void* arg, char* path, int dir_fd, int error, bool first, size_t* num_subdirs) {
+    watch_t* watch = arg;
+    context_t* context = watch->context;
+    options_t* options = context->options;
+    vector_t* entry_vector = context->entry_vector;
+    watch_dir_t* dir = dirOf(path);
+
+    *num_subdirs = 0;
+
+    if(dir_fd == -1) {
+        dir->error = error;
+        return NULL;
+    }
+
+    // watched before it is read, so nothing that changes after it is read is missed
+    dirWatch(watch, dir, dir_fd);
+
+    vectorClear(entry_vector);
+    arenaReset(context->names);
+
+    dir_reader_t reader;
+    dirReaderInit(&reader, dir_fd, context->read_buffer, options->read_buffer_size, context->stats);
+
+    for(dir_entry_t entry; dirReaderNext(&reader, &entry); ) {
+        if(entry.name[0] == '\0' || (!options->all && entry.name[0] == '.')) {
+            continue;
+        }
+
+        char* name = dirNameCopy(context->names, &entry);
+
+        if(!name || !vectorPush(entry_vector, name)) {
+            printf("malloc() failed...exiting\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    dir->read_error = reader.error;
+
+    if(!options->unsorted && !sortNames(entry_vector->items, entry_vector->length, options->collate, context->names)) {
+        printf("malloc() failed...exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t count = entry_vector->length;
+    entry_info_t* entry_infos = arenaAlloc(context->names, sizeof(entry_info_t) * (count + 1));
+
+    if(!entry_infos) {
+        printf("malloc() failed...exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    processEntries(context, entry_infos, entry_vector, dir_fd);
+
+    vector_t* subdir_vector = context->subdir_vector;
+    vectorClear(subdir_vector);
+
+    for(size_t i = 0; i < count; i++) {
+        char* name = entry_vector->items[i];
+        dir_name_t* dir_name = dirNameOf(name);
+        watch_entry_t* entry = entryCreate(context, &entry_infos[i], dir_name->type, dir_name->ino);
+
+        entryInsert(dir, entry, dir->length);
+
+        if(options->recursive && entry->type == DT_DIR && strcmp(name, ".") != 0 && strcmp(name, "..") != 0) {
+            entry->subdir = dirCreate(dir->path, name, context->names);
+            entry->subdir->parent = dir;
+
+            if(!vectorPush(subdir_vector, entry->subdir->path)) {
+                printf("malloc() failed...exiting\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    vectorClear(entry_vector);
+    arenaReset(context->names);
+
+    *num_subdirs = subdir_vector->length;
+
+    if(*num_subdirs == 0) {
+        return NULL;
+    }
+
+    char** subdirs = arenaAlloc(context->paths, sizeof(char*) * *num_subdirs);
+
+    if(!subdirs) {
+        printf("malloc() failed...exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    memcpy(subdirs, subdir_vector->items, sizeof(char*) * *num_subdirs);
+
+    return subdirs;
+}
+
+// copy a processed entry out of the names arena, its link target is only kept if it is printed
+static watch_entry_t* entryCreate(context_t* context, entry_info_t* entry_info, unsigned char type, uint64_t ino) {
+    bool has_path = context->plan.read_links && entry_info->error == ENTRY_OK && entry_info->path != NULL;
+    size_t path_len = has_path ? strlen(entry_info->path) + 1 : 0;
+    watch_entry_t* entry = malloc(sizeof(watch_entry_t) + entry_info->name_len + 1 + path_len);
+
+    if(!entry) {
+        printf("malloc() failed...exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    entry->info = *entry_info;
+    entry->subdir = NULL;
+    entry->ino = ino;
+    entry->type = type;
+
+    memcpy(entry->data, entry_info->name, entry_info->name_len + 1);
+    entry->info.name = entry->data;
+    entry->info.path = NULL;
+
+    if(has_path) {
+        entry->info.path = &entry->data[entry_info->name_len + 1];
+        memcpy(entry->info.path, entry_info->path, path_len);
+    }
+
+    getColumnWidths(&entry->widths, &entry->info, 1, context);
+
+    return entry;
+}
+
+// the entry a name returned by entryCreate belongs to
+static watch_entry_t* entryOf(char* name) {
+    return (watch_entry_t*)(name - offsetof(watch_entry_t, data));
+}
+
+static void entryFree(watch_t* watch, watch_entry_t* entry) {
+    if(entry->subdir) {
+        dirFree(watch, entry->subdir);
+    }
+
+    free(entry);
+}
+
+// look for the entry called name, returns whether it was found and its position (or where it would go) in position
+static bool entryFind(watch_t* watch, watch_dir_t* dir, char* name, size_t* position) {
+    options_t* options = watch->context->options;
+
+    // with -U there is no order to search by, a new entry goes at the end
+    if(options->unsorted) {
+        for(size_t i = 0; i < dir->length; i++) {
+            if(strcmp(dir->entries[i]->info.name, name) == 0) {
+                *position = i;
+                return true;
+            }
+        }
+
+        *position = dir->length;
+        return false;
+    }
+
+    size_t low = 0;
+    size_t high = dir->length;
+
+    while(low < high) {
+        size_t middle = low + (high - low) / 2;
+        int compare = sortCompare(dir->entries[middle]->info.name, name, options->collate);
+
+        if(compare == 0) {
+            *position = middle;
+            return true;
+        }
+
+        if(compare < 0) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+
+    *position = low;
+    return false;
+}
+
+static void entryInsert(watch_dir_t* dir, watch_entry_t* entry, size_t position) {
+    if(dir->length == dir->capacity) {
+        dir->capacity = dir->capacity ? dir->capacity * 2 : 16;
+        dir->entries = realloc(dir->entries, sizeof(watch_entry_t*) * dir->capacity);
+
+        if(!dir->entries) {
+            printf("realloc() failed...exiting\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    memmove(&dir->entries[position + 1], &dir->entries[position], sizeof(watch_entry_t*) * (dir->length - position));
+    dir->entries[position] = entry;
+    dir->length++;
+
+    widthsAdd(dir, entry);
+}
+
+static void entryRemove(watch_t* watch, watch_dir_t* dir, size_t position) {
+    watch_entry_t* entry = dir->entries[position];
+
+    dir->length--;
+    memmove(&dir->entries[position], &dir->entries[position + 1], sizeof(watch_entry_t*) * (dir->length - position));
+
+    widthsRemove(dir, entry);
+    entryFree(watch, entry);
+}
+
+// stat the entry called name again (dir is opened as dir_fd) and replace it, add it or remove it if it's gone
+static void entryUpdate(watch_t* watch, watch_dir_t* dir, int dir_fd, char* name) {
+    context_t* context = watch->context;
+    options_t* options = context->options;
+
+    if(name[0] == '\0' || (!options->all && name[0] == '.')) {
+        return;
+    }
+
+    size_t position;
+    bool found = entryFind(watch, dir, name, &position);
+    struct statx statx_buffer;
+
+    // its type and inode number stand in for the dirent data a directory read would have given
+    dir_entry_t dirent = { .ino = 0, .type = DT_UNKNOWN, .name_len = strlen(name), .name = name };
+
+    if(statx(dir_fd, name, AT_SYMLINK_NOFOLLOW, STATX_TYPE | STATX_INO, &statx_buffer) == 0) {
+        dirent.ino = statx_buffer.stx_ino;
+        dirent.type = IFTODT(statx_buffer.stx_mode);
+    }
+    else if(errno == ENOENT) {
+        if(found) {
+            entryRemove(watch, dir, position);
+        }
+
+        return;
+    }
+
+    // any other error is listed like it would be by processEntry
+    char* copy = dirNameCopy(context->names, &dirent);
+    entry_info_t entry_info;
+
+    if(!copy) {
+        printf("malloc() failed...exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    processEntry(&entry_info, context, copy, dir_fd, NULL);
+
+    watch_entry_t* entry = entryCreate(context, &entry_info, dirent.type, dirent.ino);
+
+    if(found) {
+        watch_entry_t* old = dir->entries[position];
+
+        // the same directory keeps what was read of it, one moved over it has to be read
+        if(old->subdir && old->type == DT_DIR && entry->type == DT_DIR && old->ino == entry->ino) {
+            entry->subdir = old->subdir;
+            old->subdir = NULL;
+        }
+
+        dir->entries[position] = entry;
+        widthsAdd(dir, entry);
+        widthsRemove(dir, old);
+        entryFree(watch, old);
+    }
+    else {
+        entryInsert(dir, entry, position);
+    }
+
+    if(options->recursive && entry->type == DT_DIR && !entry->subdir) {
+        entry->subdir = dirCreate(dir->path, name, context->names);
+        entry->subdir->parent = dir;
+        dirLoad(watch, entry->subdir);
+    }
+
+    arenaReset(context->names);
+}
+
+// the variable width columns of column_widths_t by number
+static unsigned* columnOf(column_widths_t* column_widths, int column) {
+    switch(column) {
+        case 0: return &column_widths->ino;
+        case 1: return &column_widths->nlinks;
+        case 2: return &column_widths->user;
+        case 3: return &column_widths->group;
+        default: return &column_widths->size;
+    }
+}
+
+// count the widths of an entry added to dir
+static void widthsAdd(watch_dir_t* dir, watch_entry_t* entry) {
+    for(int column = 0; column < WATCH_COLUMNS; column++) {
+        unsigned width = *columnOf(&entry->widths, column);
+        unsigned* widest = columnOf(&dir->widths, column);
+
+        if(width > *widest) {
+            *widest = width;
+            dir->at_width[column] = 1;
+        }
+        else if(width == *widest) {
+            dir->at_width[column]++;
+        }
+    }
+
+    dir->num_quoted += entry->widths.name_needs_space;
+    dir->widths.name_needs_space = dir->num_quoted != 0;
+}
+
+// stop counting the widths of an entry no longer in dir, the widest of a column is looked for again if it was
+// the last entry that wide
+static void widthsRemove(watch_dir_t* dir, watch_entry_t* entry) {
+    for(int column = 0; column < WATCH_COLUMNS; column++) {
+        unsigned* widest = columnOf(&dir->widths, column);
+
+        if(*columnOf(&entry->widths, column) != *widest || --dir->at_width[column] != 0) {
+            continue;
+        }
+
+        *widest = 0;
+
+        for(size_t i = 0; i < dir->length; i++) {
+            unsigned width = *columnOf(&dir->entries[i]->widths, column);
+
+            if(width > *widest) {
+                *widest = width;
+                dir->at_width[column] = 1;
+            }
+            else if(width == *widest) {
+                dir->at_width[column]++;
+            }
+        }
+    }
+
+    dir->num_quoted -= entry->widths.name_needs_space;
+    dir->widths.name_needs_space = dir->num_quoted != 0;
+}
+
+// add the events waiting on the inotify instance to the pending changes
+// returns false if they can't be read
+static bool readEvents(watch_t* watch) {
+    char buffer[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    while(true) {
+        ssize_t length = read(watch->fd, buffer, sizeof(buffer));
+
+        if(length == -1) {
+            return errno == EAGAIN || errno == EINTR;
+        }
+
+        for(char* position = buffer; position < buffer + length; ) {
+            struct inotify_event* event = (struct inotify_event*)position;
+            position += sizeof(struct inotify_event) + event->len;
+
+            if(event->mask & IN_Q_OVERFLOW) {
+                watch->reload = true;
+                continue;
+            }
+
+            // the directory is gone (or no longer reachable), its entry goes with its parent's event
+            if(event->mask & IN_IGNORED) {
+                if((size_t)event->wd < watch->dirs_capacity && watch->dirs[event->wd]) {
+                    watch->dirs[event->wd]->wd = -1;
+                    watch->dirs[event->wd] = NULL;
+                }
+
+                continue;
+            }
+
+            // changes to a watched directory itself are also reported to its parent, by name
+            if(event->len == 0 || event->name[0] == '\0') {
+                continue;
+            }
+
+            if(!watch->context->options->all && event->name[0] == '.') {
+                continue;
+            }
+
+            size_t name_len = strlen(event->name);
+            watch_event_t* pending = malloc(sizeof(watch_event_t) + name_len + 1);
+
+            if(!pending) {
+                printf("malloc() failed...exiting\n");
+                exit(EXIT_FAILURE);
+            }
+
+            pending->wd = event->wd;
+            memcpy(pending->name, event->name, name_len + 1);
+
+            if(!vectorPush(watch->pending, pending->name)) {
+                printf("malloc() failed...exiting\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+}
+
+// bring the directories up to date with the pending changes, each entry is stat-ed once however often it changed
+static void applyEvents(watch_t* watch) {
+    context_t* context = watch->context;
+    vector_t* pending = watch->pending;
+
+    if(watch->reload) {
+        for(size_t i = 0; i < watch->num_roots; i++) {
+            char* path = watch->roots[i]->path;
+            watch_dir_t* root = dirCreate(path, NULL, context->names);
+
+            dirFree(watch, watch->roots[i]);
+            watch->roots[i] = root;
+        }
+
+        for(size_t i = 0; i < watch->num_roots; i++) {
+            dirLoad(watch, watch->roots[i]);
+        }
+    }
+    else {
+        // grouped by directory, so each is opened once
+        qsort(pending->items, pending->length, sizeof(char*), eventCompare);
+
+        int dir_fd = -1;
+        int open_wd = -1;
+
+        for(size_t i = 0; i < pending->length; i++) {
+            watch_event_t* event = eventOf(pending->items[i]);
+
+            if(i > 0 && eventCompare(&pending->items[i - 1], &pending->items[i]) == 0) {
+                continue;
+            }
+
+            // gone since, along with a directory removed by an earlier change
+            watch_dir_t* dir = (size_t)event->wd < watch->dirs_capacity ? watch->dirs[event->wd] : NULL;
+
+            if(!dir) {
+                continue;
+            }
+
+            if(event->wd != open_wd) {
+                if(dir_fd != -1) {
+                    close(dir_fd);
+                }
+
+                dir_fd = dirOpen(context, dir);
+                open_wd = event->wd;
+            }
+
+            // the directory itself went away, its parent's event removes it
+            if(dir_fd != -1) {
+                entryUpdate(watch, dir, dir_fd, event->name);
+            }
+        }
+
+        if(dir_fd != -1) {
+            close(dir_fd);
+        }
+
+        // what changed within a directory also changes its own entry in its parent (link count, size and
+        // modification time), which inotify doesn't report
+        for(size_t i = 0; i < pending->length; i++) {
+            watch_event_t* event = eventOf(pending->items[i]);
+
+            if(i > 0 && event->wd == eventOf(pending->items[i - 1])->wd) {
+                continue;
+            }
+
+            // looked up again, the changes above may have removed it
+            watch_dir_t* dir = (size_t)event->wd < watch->dirs_capacity ? watch->dirs[event->wd] : NULL;
+
+            if(!dir || !dir->parent) {
+                continue;
+            }
+
+            // copied, the directory (and its path) goes away if another one was moved over it
+            char name[NAME_MAX + 1];
+            watch_dir_t* parent = dir->parent;
+
+            snprintf(name, sizeof(name), "%s", strrchr(dir->path, '/') + 1);
+
+            int parent_fd = dirOpen(context, parent);
+
+            if(parent_fd != -1) {
+                entryUpdate(watch, parent, parent_fd, name);
+                close(parent_fd);
+            }
+        }
+    }
+
+    for(size_t i = 0; i < pending->length; i++) {
+        free(eventOf(pending->items[i]));
+    }
+
+    vectorClear(pending);
+    watch->reload = false;
+}
+
+// qsort callback for pending changes: by watch descriptor, then by name
+static int eventCompare(const void* a, const void* b) {
+    watch_event_t* event_a = eventOf(*(char**)a);
+    watch_event_t* event_b = eventOf(*(char**)b);
+
+    if(event_a->wd != event_b->wd) {
+        return event_a->wd < event_b->wd ? -1 : 1;
+    }
+
+    return strcmp(event_a->name, event_b->name);
+}
+
+// the pending change a name added by readEvents belongs to
+static watch_event_t* eventOf(char* name) {
+    return (watch_event_t*)(name - offsetof(watch_event_t, name));
+}
+
+// draw everything from memory like a normal listing (the files given are stat-ed again), over the last one
+// on a terminal, or after it and a blank line otherwise
+static void drawAll(watch_t* watch) {
+    context_t* context = watch->context;
+    output_t* out = context->out;
+
+    if(out->interactive) {
+        outputString(out, "\033[H\033[2J");
+    }
+    else if(watch->drawn) {
+        outputChar(out, '\n');
+    }
+
+    listFiles(context, watch->files, -1);
+    arenaReset(context->names);
+
+    if(context->error != 0) {
+        printf("malloc() failed...exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if(watch->files->length != 0 && watch->num_roots != 0) {
+        outputChar(out, '\n');
+    }
+
+    for(size_t i = 0; i < watch->num_roots; i++) {
+        drawDir(watch, watch->roots[i], true);
+
+        if(i < watch->num_roots - 1) {
+            outputChar(out, '\n');
+        }
+    }
+
+    outputFlush(out);
+    watch->drawn = true;
+}
+
+// draw a directory like listDirectoryContents, with the column widths kept up to date as it changed, then with
+// -R its subdirectories in the order they are listed
+static void drawDir(watch_t* watch, watch_dir_t* dir, bool first) {
+    context_t* context = watch->context;
+    options_t* options = context->options;
+    output_t* out = context->out;
+
+    if(!first) {
+        outputChar(out, '\n');
+    }
+
+    if(dir->error != 0) {
+        printError(out, "cannot open directory", dir->path, dir->error);
+        return;
+    }
+
+    if(options->print_header) {
+        printHeader(out, dir->path);
+    }
+
+    if(dir->read_error != 0) {
+        printError(out, "reading directory", dir->path, dir->read_error);
+    }
+
+    arena_mark_t names_mark = arenaMark(context->names);
+    size_t count = dir->length;
+    entry_info_t* entry_infos = arenaAlloc(context->names, sizeof(entry_info_t) * (count + 1));
+    char** names = arenaAlloc(context->names, sizeof(char*) * (count + 1));
+
+    if(!entry_infos || !names) {
+        printf("malloc() failed...exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for(size_t i = 0; i < count; i++) {
+        entry_infos[i] = dir->entries[i]->info;
+        names[i] = dir->entries[i]->data;
+    }
+
+    // kept in name order, -S / -t / -r reorder a copy
+    vector_t listed = { .length = count, .capacity = count, .items = names };
+    orderEntries(context, entry_infos, &listed);
+
+    if(context->error != 0) {
+        printf("malloc() failed...exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for(size_t i = 0; i < count; i++) {
+        printEntryError(&entry_infos[i], context);
+    }
+
+    for(size_t i = 0; i < count; i++) {
+        printEntry(&dir->widths, &entry_infos[i], context);
+    }
+
+    outputCheckpoint(out);
+
+    if(!options->recursive) {
+        arenaRewind(context->names, names_mark);
+        return;
+    }
+
+    // the subdirectories in the order they were listed, kept on the paths arena while they are drawn
+    arena_mark_t paths_mark = arenaMark(context->paths);
+    watch_dir_t** subdirs = arenaAlloc(context->paths, sizeof(watch_dir_t*) * (count + 1));
+    size_t num_subdirs = 0;
+
+    if(!subdirs) {
+        printf("malloc() failed...exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for(size_t i = 0; i < count; i++) {
+        watch_entry_t* entry = entryOf(names[i]);
+
+        if(entry->subdir) {
+            subdirs[num_subdirs++] = entry->subdir;
+        }
+    }
+
+    arenaRewind(context->names, names_mark);
+
+    for(size_t i = 0; i < num_subdirs; i++) {
+        drawDir(watch, subdirs[i], false);
+    }
+
+    arenaRewind(context->paths, paths_mark);
+}
+
+static uint64_t nowMs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
@@ -0,0 +1,17 @@
+#ifndef _WATCH_H_
+#define _WATCH_H_
+
+#include "../lsc.h"
+#include "context.h"
+#include "vector.h"
+
+// changes arriving within this many milliseconds of the first one are applied together, in a single redraw
+#define WATCH_COALESCE_MS 100
+
+typedef struct watch_t watch_t;
+
+watch_t* watchCreate(context_t* context, vector_t* files, vector_t* directories);
+void watchRun(watch_t* watch);
+void watchFree(watch_t* watch);
+
+#endif
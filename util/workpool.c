@@ -0,0 +1,206 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "workpool.h"
+
+static const size_t GROW_CAPACITY = 64;
+
+// passed to each thread so it knows which deque is its own
+typedef struct worker_arg_t {
+    workpool_t* pool;
+    size_t worker;
+} worker_arg_t;
+
+static void* workerMain(void* arg);
+static bool dequePopTail(work_deque_t* deque, work_item_t* item);
+static bool dequePopHead(work_deque_t* deque, work_item_t* item);
+
+// create a pool of num_workers threads, they wait for work straight away
+workpool_t* workpoolCreate(size_t num_workers) {
+    workpool_t* pool = malloc(sizeof(workpool_t));
+
+    if(!pool) {
+        printf("malloc() failed...exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    pool->num_workers = num_workers;
+    pool->threads = malloc(sizeof(pthread_t) * num_workers);
+    pool->deques = malloc(sizeof(work_deque_t) * num_workers);
+    pool->queued = 0;
+    pool->shutdown = false;
+
+    if(!pool->threads || !pool->deques) {
+        printf("malloc() failed...exiting\n");
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_mutex_init(&pool->idle_lock, NULL);
+    pthread_cond_init(&pool->idle_cond, NULL);
+
+    for(size_t i = 0; i < num_workers; i++) {
+        work_deque_t* deque = &pool->deques[i];
+
+        pthread_mutex_init(&deque->lock, NULL);
+        deque->items = NULL;
+        deque->capacity = 0;
+        deque->head = 0;
+        deque->length = 0;
+    }
+
+    for(size_t i = 0; i < num_workers; i++) {
+        worker_arg_t* arg = malloc(sizeof(worker_arg_t));
+
+        if(!arg) {
+            printf("malloc() failed...exiting\n");
+            exit(EXIT_FAILURE);
+        }
+
+        arg->pool = pool;
+        arg->worker = i;
+
+        if(pthread_create(&pool->threads[i], NULL, workerMain, arg) != 0) {
+            printf("pthread_create() failed...exiting\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    return pool;
+}
+
+// queue fn(arg) on the deque of the given worker
+// workers should submit to their own deque so related work stays on the same thread unless stolen
+void workpoolSubmit(workpool_t* pool, size_t worker, work_fn_t fn, void* arg) {
+    work_deque_t* deque = &pool->deques[worker];
+
+    pthread_mutex_lock(&deque->lock);
+
+    // the deque is a ring buffer, grow it and unwrap the items if it is full
+    if(deque->length == deque->capacity) {
+        size_t new_capacity = deque->capacity + GROW_CAPACITY;
+        work_item_t* items = malloc(sizeof(work_item_t) * new_capacity);
+
+        if(!items) {
+            printf("malloc() failed...exiting\n");
+            exit(EXIT_FAILURE);
+        }
+
+        for(size_t i = 0; i < deque->length; i++) {
+            items[i] = deque->items[(deque->head + i) % deque->capacity];
+        }
+
+        free(deque->items);
+        deque->items = items;
+        deque->capacity = new_capacity;
+        deque->head = 0;
+    }
+
+    work_item_t* item = &deque->items[(deque->head + deque->length) % deque->capacity];
+    item->fn = fn;
+    item->arg = arg;
+    deque->length++;
+
+    pthread_mutex_unlock(&deque->lock);
+
+    // wake up a sleeping worker to take it
+    pthread_mutex_lock(&pool->idle_lock);
+    pool->queued++;
+    pthread_cond_signal(&pool->idle_cond);
+    pthread_mutex_unlock(&pool->idle_lock);
+}
+
+// stop the workers once all queued work has run, then free the pool
+void workpoolFree(workpool_t* pool) {
+    pthread_mutex_lock(&pool->idle_lock);
+    pool->shutdown = true;
+    pthread_cond_broadcast(&pool->idle_cond);
+    pthread_mutex_unlock(&pool->idle_lock);
+
+    for(size_t i = 0; i < pool->num_workers; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    for(size_t i = 0; i < pool->num_workers; i++) {
+        pthread_mutex_destroy(&pool->deques[i].lock);
+        free(pool->deques[i].items);
+    }
+
+    pthread_mutex_destroy(&pool->idle_lock);
+    pthread_cond_destroy(&pool->idle_cond);
+
+    free(pool->deques);
+    free(pool->threads);
+    free(pool);
+}
+
+// worker loop: run our own work newest first, otherwise steal the oldest work of another worker
+static void* workerMain(void* arg) {
+    workpool_t* pool = ((worker_arg_t*)arg)->pool;
+    size_t worker = ((worker_arg_t*)arg)->worker;
+    free(arg);
+
+    for(;;) {
+        work_item_t item;
+        bool found = dequePopTail(&pool->deques[worker], &item);
+
+        for(size_t i = 1; !found && i < pool->num_workers; i++) {
+            found = dequePopHead(&pool->deques[(worker + i) % pool->num_workers], &item);
+        }
+
+        if(found) {
+            pthread_mutex_lock(&pool->idle_lock);
+            pool->queued--;
+            pthread_mutex_unlock(&pool->idle_lock);
+
+            item.fn(item.arg, worker);
+            continue;
+        }
+
+        // nothing to take, sleep until something is submitted
+        pthread_mutex_lock(&pool->idle_lock);
+
+        while(pool->queued == 0 && !pool->shutdown) {
+            pthread_cond_wait(&pool->idle_cond, &pool->idle_lock);
+        }
+
+        bool done = pool->queued == 0 && pool->shutdown;
+        pthread_mutex_unlock(&pool->idle_lock);
+
+        if(done) {
+            return NULL;
+        }
+    }
+}
+
+// take the most recently pushed item (used by the owner)
+static bool dequePopTail(work_deque_t* deque, work_item_t* item) {
+    pthread_mutex_lock(&deque->lock);
+
+    bool found = deque->length > 0;
+
+    if(found) {
+        deque->length--;
+        *item = deque->items[(deque->head + deque->length) % deque->capacity];
+    }
+
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+// take the oldest item (used by thieves)
+static bool dequePopHead(work_deque_t* deque, work_item_t* item) {
+    pthread_mutex_lock(&deque->lock);
+
+    bool found = deque->length > 0;
+
+    if(found) {
+        *item = deque->items[deque->head];
+        deque->head = (deque->head + 1) % deque->capacity;
+        deque->length--;
+    }
+
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
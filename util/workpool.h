@@ -0,0 +1,42 @@
+#ifndef _WORKPOOL_H_
+#define _WORKPOOL_H_
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+// a unit of work; worker is the index of the thread running it (0 to num_workers - 1)
+typedef void (*work_fn_t)(void* arg, size_t worker);
+
+typedef struct work_item_t {
+    work_fn_t fn;
+    void* arg;
+} work_item_t;
+
+// double ended queue owned by one worker, the owner pushes and pops at the tail, thieves take from the head
+typedef struct work_deque_t {
+    pthread_mutex_t lock;
+    work_item_t* items;
+    size_t capacity;
+    size_t head;
+    size_t length;
+} work_deque_t;
+
+// a fixed set of threads, each working on its own deque and stealing from the others when it runs dry
+typedef struct workpool_t {
+    size_t num_workers;
+    pthread_t* threads;
+    work_deque_t* deques;
+
+    // idle workers sleep on idle_cond until something is queued or the pool shuts down
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle_cond;
+    size_t queued;
+    bool shutdown;
+} workpool_t;
+
+workpool_t* workpoolCreate(size_t num_workers);
+void workpoolSubmit(workpool_t* pool, size_t worker, work_fn_t fn, void* arg);
+void workpoolFree(workpool_t* pool);
+
+#endif